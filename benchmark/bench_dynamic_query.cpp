@@ -22,7 +22,8 @@ using coord = double;
 #define SMALL_BATCH_DELETE
 
 // Define another benchmark
-template <int dim, class Tree, bool log>
+// [policy]: the LogTree merge policy is given by arguments 4 to 6, see [PolicyArgs]
+template <int dim, class Tree, bool log, bool policy = false>
 static void bench_dynamic_query(benchmark::State& state) {
   auto size = state.range(0);
   auto batch_percentage = state.range(1);
@@ -64,7 +65,12 @@ static void bench_dynamic_query(benchmark::State& state) {
   for (auto _ : state) {
     {
       state.PauseTiming();
-      Tree tree(log2size);
+      auto tree = [&]() {
+        if constexpr (policy)
+          return Tree(PolicyArgs(state, 4));
+        else
+          return Tree(log2size);
+      }();
       state.ResumeTiming();
 
       timer t("[dyn iq]");
@@ -119,6 +125,82 @@ static void bench_dynamic_query(benchmark::State& state) {
   }
 }
 
+// Moving objects: at every tick, [batch_percentage]% of the points move by a small random step,
+// and the tree is given their old and new positions. [combined]: with a single [LogTree::update],
+// otherwise with a bulk_erase followed by an insert.
+template <int dim, class Tree, bool combined>
+static void bench_moving_query(benchmark::State& state) {
+  typedef batchKdTree::point<dim> pointT;
+  auto size = state.range(0);
+  auto batch_percentage = state.range(1);
+  auto k = state.range(2);
+  DSType ds_type = (DSType)state.range(3);
+  constexpr size_t ticks = 10;
+
+  auto points_ = BenchmarkDS<dim>(size, ds_type, false);
+  const auto& points = points_;
+  auto n = points.size();
+
+  int log2size = (int)std::ceil(std::log2(n));
+  size_t div_size = (n * batch_percentage) / 100;
+
+  // a point moves by at most 1/1000 of the extent of the data set along each axis
+  double step[dim];
+  for (int d = 0; d < dim; d++) {
+    auto coords = parlay::tabulate(n, [&](size_t i) { return points[i].readCoord(d); });
+    auto [lo, hi] = std::minmax_element(coords.begin(), coords.end());
+    step[d] = (*hi - *lo) / 1000;
+  }
+
+  // the (inserts, deletes) of every tick
+  std::vector<std::pair<parlay::sequence<pointT>, parlay::sequence<pointT>>> moves;
+  auto cur = points;
+  for (size_t t = 0; t < ticks; t++) {
+    auto start = (t * div_size) % n;
+    auto deletes = parlay::tabulate(div_size, [&](size_t i) { return cur[(start + i) % n]; });
+    auto inserts = parlay::tabulate(div_size, [&](size_t i) {
+      auto p = deletes[i];
+      for (int d = 0; d < dim; d++) {
+        auto r = parlay::hash64((t * n + start + i) * dim + d) % 2001;
+        p[d] += step[d] * ((double)r / 1000 - 1);
+      }
+      return p;
+    });
+    parlay::parallel_for(0, div_size, [&](size_t i) { cur[(start + i) % n] = inserts[i]; });
+    moves.emplace_back(std::move(inserts), std::move(deletes));
+  }
+
+  // benchmark
+  for (auto _ : state) {
+    {
+      state.PauseTiming();
+      Tree tree(log2size);
+      tree.insert(points);
+      state.ResumeTiming();
+
+      timer t("[moving q]");
+      for (size_t i = 0; i < ticks; i++) {
+        const auto& inserts = moves[i].first;
+        const auto& deletes = moves[i].second;
+        if constexpr (combined) {
+          tree.update(inserts, deletes);
+        } else {
+          tree.bulk_erase(deletes);
+          tree.insert(inserts);
+        }
+        state.counters["update_" + std::to_string(i)] = t.get_next();
+      }
+
+      // QUERY
+      tree.template knn3<0, 0>(cur, k);
+      state.counters["knn"] = t.get_next();
+
+      state.PauseTiming();
+    }
+    state.ResumeTiming();
+  }
+}
+
 // Instantiate benchmarks
 BENCH(dynamic_query, 2, BHLTree_t<2>, false)
     ->ArgsProduct({{10'000'000},
@@ -134,6 +216,12 @@ BENCH(dynamic_query, 2, LogTree_t<2>, true)
                    {5},
                    //{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
                    {DS_UNIFORM_FILL, DS_UNIFORM_SPHERE}});
+// sweep the merge policy: leveled with fan-out 2 is the default binary counter
+BENCH(dynamic_query, 2, LogTree_t<2>, true, true)
+    ->ArgsProduct(
+        {{10'000'000}, {1, 5}, {5}, {DS_UNIFORM_FILL}, {LEVELED_MERGE}, {2, 4, 8}, {1}})
+    ->ArgsProduct(
+        {{10'000'000}, {1, 5}, {5}, {DS_UNIFORM_FILL}, {TIERED_MERGE}, {4, 8}, {1, 3}});
 // BENCH(dynamic_query, 3)
 //->ArgsProduct({{10'000'000},
 //{10, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 65, 70, 75, 80, 85, 90, 95, 100},
@@ -162,3 +250,13 @@ BENCH(dynamic_query, 5, LogTree_t<5>, true)
                    {5},
                    //{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
                    {DS_UNIFORM_FILL, DS_VISUAL_VAR}});
+
+// moving objects: bulk_erase + insert (false) against a single update (true)
+BENCH(moving_query, 2, LogTree_t<2>, false)
+    ->ArgsProduct({{10'000'000}, {1, 5, 10}, {5}, {DS_UNIFORM_FILL, DS_UNIFORM_SPHERE}});
+BENCH(moving_query, 2, LogTree_t<2>, true)
+    ->ArgsProduct({{10'000'000}, {1, 5, 10}, {5}, {DS_UNIFORM_FILL, DS_UNIFORM_SPHERE}});
+BENCH(moving_query, 5, LogTree_t<5>, false)
+    ->ArgsProduct({{10'000'000}, {1, 5, 10}, {5}, {DS_UNIFORM_FILL}});
+BENCH(moving_query, 5, LogTree_t<5>, true)
+    ->ArgsProduct({{10'000'000}, {1, 5, 10}, {5}, {DS_UNIFORM_FILL}});
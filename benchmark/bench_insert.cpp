@@ -9,6 +9,7 @@
 #include "batchKdtree/cache-oblivious/cokdtree.h"
 #include "batchKdtree/binary-heap-layout/bhlkdtree.h"
 #include "batchKdtree/log-tree/logtree.h"
+#include "batchKdtree/log-tree/versioned.h"
 #include "batchKdtree/shared/dual.h"
 
 #include <benchmark/benchmark.h>
@@ -19,7 +20,8 @@ using namespace benchIO;
 using coord = double;
 
 // Define another benchmark
-template <int dim, class Tree>
+// [policy]: the LogTree merge policy is given by arguments 3 to 5, see [PolicyArgs]
+template <int dim, class Tree, bool policy = false>
 static void bench_insert(benchmark::State& state) {
   auto size = state.range(0);
   auto batch_percentage = state.range(1);
@@ -35,7 +37,12 @@ static void bench_insert(benchmark::State& state) {
   for (auto _ : state) {
     {
       state.PauseTiming();
-      Tree tree(log2size);
+      auto tree = [&]() {
+        if constexpr (policy)
+          return Tree(PolicyArgs(state, 3));
+        else
+          return Tree(log2size);
+      }();
       state.ResumeTiming();
 
       // actual benchmark
@@ -52,6 +59,50 @@ static void bench_insert(benchmark::State& state) {
   }
 }
 
+// Latency of the individual inserts into a VersionedLogTree, as percentiles. In INSERT_ASYNC
+// mode an insert only stages its batch; the time to merge the last batches is in the total.
+template <int dim, class Tree, batchKdTree::InsertMode mode>
+static void bench_insert_latency(benchmark::State& state) {
+  auto size = state.range(0);
+  auto batch_size = state.range(1);
+  DSType ds_type = (DSType)state.range(2);
+
+  auto points_ = BenchmarkDS<dim>(size, ds_type);
+  const auto& points = points_;
+  std::vector<double> latencies;
+
+  // benchmark
+  for (auto _ : state) {
+    {
+      state.PauseTiming();
+      batchKdTree::VersionedLogTree<Tree> tree(mode);
+      state.ResumeTiming();
+
+      // actual benchmark
+      for (size_t pos = 0; pos < points.size(); pos += batch_size) {
+        auto next_pos = std::min(pos + batch_size, points.size());
+        timer t;
+        t.start();
+        tree.insert(points.cut(pos, next_pos));
+        latencies.push_back(t.stop());
+      }
+      tree.drain();
+
+      state.PauseTiming();
+    }
+    state.ResumeTiming();
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return 1000 * latencies[std::min(latencies.size() - 1, (size_t)(p * latencies.size()))];
+  };
+  state.counters["p50_ms"] = percentile(0.5);
+  state.counters["p99_ms"] = percentile(0.99);
+  state.counters["p999_ms"] = percentile(0.999);
+  state.counters["max_ms"] = latencies.back() * 1000;
+}
+
 // Instantiate benchmarks
 BENCH(insert, 2, COTree_t<2>)
     ->ArgsProduct({{10'000'000},
@@ -91,3 +142,13 @@ BENCH(insert, 7, LogTree_t<7>)
     ->ArgsProduct({{10'000'000},
                    {10, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 65, 70, 75, 80, 85, 90, 95, 100},
                    {DS_UNIFORM_FILL}});
+
+// sweep the merge policy: leveled with fan-out 2 is the default binary counter
+BENCH(insert, 2, LogTree_t<2>, true)
+    ->ArgsProduct({{10'000'000}, {1, 10, 100}, {DS_UNIFORM_FILL}, {LEVELED_MERGE}, {2, 4, 8}, {1}})
+    ->ArgsProduct({{10'000'000}, {1, 10, 100}, {DS_UNIFORM_FILL}, {TIERED_MERGE}, {4, 8}, {1, 3}});
+
+BENCH(insert_latency, 2, LogTree_t<2>, batchKdTree::INSERT_SYNC)
+    ->ArgsProduct({{10'000'000}, {1'000, 10'000, 100'000}, {DS_UNIFORM_FILL}});
+BENCH(insert_latency, 2, LogTree_t<2>, batchKdTree::INSERT_ASYNC)
+    ->ArgsProduct({{10'000'000}, {1'000, 10'000, 100'000}, {DS_UNIFORM_FILL}});
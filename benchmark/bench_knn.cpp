@@ -84,6 +84,75 @@ static void bench_knn3(benchmark::State& state) {
   }
 }
 
+// Define another benchmark
+template <int dim, int k_type>
+static void bench_knn4(benchmark::State& state) {
+  typedef LogTree_t<dim> Tree;
+  auto size = state.range(0);
+  auto k = state.range(1);
+  DSType ds_type = (DSType)state.range(2);
+  parlay::sequence<batchKdTree::point<dim>> points;
+  points = BenchmarkDS<dim>(size, ds_type);
+  Tree tree(points);
+
+  // benchmark
+  for (auto _ : state) {
+    RUN_AND_CLEAR((tree.template knn4<(k_type & 2), (k_type & 1)>(points, k)));
+  }
+}
+
+// knn with k fixed at compile time (sorted insertion buffer): {size, ds_type}
+template <int dim, class Tree, int K>
+static void bench_knn_fixed_k(benchmark::State& state) {
+  auto size = state.range(0);
+  DSType ds_type = (DSType)state.range(1);
+  parlay::sequence<batchKdTree::point<dim>> points;
+  points = BenchmarkDS<dim>(size, ds_type);
+  Tree tree(points);
+
+  // benchmark
+  for (auto _ : state) {
+    RUN_AND_CLEAR((tree.template knnFixedK<K>(points)));
+  }
+}
+
+// Approximate knn: {size, k, ds_type, eps (in percent), max_leaves}. Next to the time, reports
+// the recall of a sample of the queries against knnBuf::bruteforceKnn: the fraction of reported
+// neighbors that are no further than the exact k-th nearest one.
+template <int dim, class Tree>
+static void bench_approx_knn(benchmark::State& state) {
+  constexpr size_t RECALL_SAMPLE = 1000;
+  auto size = state.range(0);
+  auto k = state.range(1);
+  DSType ds_type = (DSType)state.range(2);
+  auto approx = batchKdTree::knnBuf::knnApprox(state.range(3) / 100.0, state.range(4));
+  parlay::sequence<batchKdTree::point<dim>> points;
+  points = BenchmarkDS<dim>(size, ds_type);
+  Tree tree(points);
+
+  // benchmark
+  for (auto _ : state) {
+    RUN_AND_CLEAR((tree.template knn<false, false>(points, k, approx)));
+  }
+
+  // recall, on a sample of the (shuffled) points
+  parlay::sequence<batchKdTree::point<dim>> sample(
+      points.begin(), points.begin() + std::min(RECALL_SAMPLE, points.size()));
+  auto exact = batchKdTree::knnBuf::bruteforceKnn(sample, points, k);
+  auto res = tree.template knn<false, false>(sample, k, approx);
+  size_t hits = 0;
+  for (size_t i = 0; i < sample.size(); i++) {
+    double kth = 0;
+    for (int j = 0; j < k; j++)
+      kth = std::max(kth, sample[i].dist(*exact[i * k + j]));
+    for (int j = 0; j < k; j++)
+      hits += (sample[i].dist(*res[i * k + j]) <= kth);
+  }
+  state.counters["recall"] = (double)hits / (k * sample.size());
+  state.counters["queries_per_sec"] = benchmark::Counter(
+      points.size(), benchmark::Counter::kIsIterationInvariantRate);
+}
+
 template <int dim, class Tree>
 static void bench_dual_knn(benchmark::State& state) {
   // typedef LogTree_t<dim> Tree;
@@ -131,6 +200,79 @@ BENCH(knn, 5, LogTree_t<5>, 0)
                    {5},
                    {DS_UNIFORM_FILL}})->Iterations(5);
 
+BENCH(knn4, 2, 0)
+    ->ArgsProduct({{10'000'000},
+                   {5},
+                   {DS_UNIFORM_FILL}})->Iterations(5);
+
+BENCH(knn4, 5, 0)
+    ->ArgsProduct({{10'000'000},
+                   {5},
+                   {DS_UNIFORM_FILL}})->Iterations(5);
+
+BENCH(knn_fixed_k, 2, COTree_t<2>, 5)
+    ->ArgsProduct({{10'000'000},
+                   {DS_UNIFORM_FILL}})->Iterations(5);
+
+BENCH(knn_fixed_k, 5, COTree_t<5>, 5)
+    ->ArgsProduct({{10'000'000},
+                   {DS_UNIFORM_FILL}})->Iterations(5);
+
+BENCH(knn_fixed_k, 5, LogTree_t<5>, 5)
+    ->ArgsProduct({{10'000'000},
+                   {DS_UNIFORM_FILL}})->Iterations(5);
+
+// Recall vs. speed of approximate knn
+BENCH(approx_knn, 5, COTree_t<5>)
+    ->ArgsProduct({{10'000'000},
+                   {5},
+                   {DS_UNIFORM_FILL},
+                   {0, 10, 50, 100, 200},
+                   {0}})->Iterations(5);
+
+BENCH(approx_knn, 5, COTree_t<5>)
+    ->ArgsProduct({{10'000'000},
+                   {5},
+                   {DS_UNIFORM_FILL},
+                   {0},
+                   {1, 2, 4, 8, 16}})->Iterations(5);
+
+BENCH(approx_knn, 5, LogTree_t<5>)
+    ->ArgsProduct({{10'000'000},
+                   {5},
+                   {DS_UNIFORM_FILL},
+                   {0, 10, 50, 100, 200},
+                   {0}})->Iterations(5);
+
+// the real high-dimensional datasets (the size is that of the file)
+BENCH(approx_knn, 10, COTree_t<10>)
+    ->ArgsProduct({{1'000'000},
+                   {5},
+                   {DS_HT},
+                   {0, 10, 50, 100, 200},
+                   {0}})->Iterations(5);
+
+BENCH(approx_knn, 10, LogTree_t<10>)
+    ->ArgsProduct({{1'000'000},
+                   {5},
+                   {DS_HT},
+                   {0},
+                   {1, 2, 4, 8, 16}})->Iterations(5);
+
+BENCH(approx_knn, 16, COTree_t<16>)
+    ->ArgsProduct({{4'000'000},
+                   {5},
+                   {DS_CHEM},
+                   {0, 10, 50, 100, 200},
+                   {0}})->Iterations(5);
+
+BENCH(approx_knn, 16, LogTree_t<16>)
+    ->ArgsProduct({{4'000'000},
+                   {5},
+                   {DS_CHEM},
+                   {0},
+                   {1, 2, 4, 8, 16}})->Iterations(5);
+
 // Instantiate benchmarks
 // BENCH(knn, 2, COTree_t<2>, 0)
 //     ->ArgsProduct({{10'000'000},
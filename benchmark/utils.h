@@ -300,3 +300,10 @@ constexpr int NUM_TREES = 21;
 constexpr int BUFFER_LOG2_SIZE = 10;
 template <int dim>
 using LogTree_t = batchKdTree::LogTree<NUM_TREES, BUFFER_LOG2_SIZE, dim, batchKdTree::point<dim>, parallel, coarsen>;
+
+// the LogTree merge policy given by the benchmark arguments [first, first + 3): LEVELED_MERGE or
+// TIERED_MERGE, the fan-out and the runs per level
+inline batchKdTree::mergePolicy PolicyArgs(const benchmark::State& state, int first) {
+  return batchKdTree::mergePolicy(
+      (int)state.range(first), (int)state.range(first + 1), (int)state.range(first + 2));
+}
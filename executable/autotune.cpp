@@ -0,0 +1,220 @@
+// This code is part of the project "Parallel Batch-Dynamic Kd-Trees"
+// Copyright (c) 2021-2022 Rahul Yesantharao, Yiqiu Wang, Laxman Dhulipala, Julian Shun
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Sweep the runtime tuning parameters (see batchKdtree/shared/tuning.h) on a sample workload and
+// write the best values to a profile. Load the profile at startup by pointing $BATCHKDTREE_TUNING
+// at it, or with tuning().load(path).
+//
+// Each parameter is swept in turn, the others fixed at their best values so far, and timed on the
+// operation it controls: build + knn for the cluster size, construction for the build and
+// multilevel partition base cases, bulk erase for the erase and bounding box base cases, range
+// queries and dual knn for the rest.
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <vector>
+#include "parlay/parallel.h"
+#include "common/get_time.h"
+#include "common/geometry.h"
+#include "common/parse_command_line.h"
+#include "dataset/uniform.h"
+
+#include "pargeo/pointIO.h"
+
+#include "batchKdtree/cache-oblivious/cokdtree.h"
+#include "batchKdtree/binary-heap-layout/bhlkdtree.h"
+#include "batchKdtree/shared/dual.h"
+#include "batchKdtree/shared/tuning.h"
+
+using namespace batchKdTree;
+
+struct TuneOptions {
+  std::string out_file;
+  int rounds;
+  int k;
+  size_t num_points;
+  int dim;
+};
+
+// minimum time of [rounds] runs of [run]; [run] times its own region of interest
+template <class F>
+double bestOf(int rounds, F run) {
+  double best = std::numeric_limits<double>::max();
+  for (int i = 0; i < rounds; i++)
+    best = std::min(best, run());
+  return best;
+}
+
+// set [field] to each of [candidates], keep the fastest according to [measure]
+template <class F>
+void sweep(const char* name,
+           size_t tuningParams::*field,
+           const std::vector<size_t>& candidates,
+           int rounds,
+           F measure) {
+  std::cout << name << ":";
+  size_t best_value = tuning().*field;
+  double best_time = std::numeric_limits<double>::max();
+  for (auto value : candidates) {
+    tuning().*field = value;
+    auto time = bestOf(rounds, measure);
+    std::cout << " " << value << " (" << time << ")";
+    if (time < best_time) {
+      best_time = time;
+      best_value = value;
+    }
+  }
+  tuning().*field = best_value;
+  std::cout << " -> " << best_value << std::endl;
+}
+
+template <int dim>
+void autotune(parlay::sequence<point<dim>>& P, const TuneOptions& opt) {
+  typedef point<dim> pointT;
+  typedef CO_KdTree<dim, pointT, true, true> coTree;
+  typedef BHL_KdTree<dim, pointT, true, true> bhlTree;
+  const std::vector<size_t> base_cases = {250, 500, 1000, 2000, 4000, 8000, 16000};
+  const std::vector<size_t> cluster_sizes = {4, 8, 16, 32, 64};
+  // subtrees below this size are split one level at a time: larger than the build base cases
+  const std::vector<size_t> partition_base_cases = {
+      12500, 25000, 50000, 100000, 200000, 400000, 800000};
+
+  // knn queries and erasures: every 10th point
+  parlay::sequence<pointT> sample;
+  for (size_t i = 0; i < P.size(); i += 10)
+    sample.push_back(P[i]);
+
+  // range query box: the middle 1% of the bounding box (in 2d)
+  pointT pMin = P[0], pMax = P[0];
+  for (const auto& p : P) {
+    pMin.minCoords(p);
+    pMax.maxCoords(p);
+  }
+  pointT qMin, qMax;
+  for (int i = 0; i < dim; i++) {
+    auto mid = (pMin[i] + pMax[i]) / 2, half = (pMax[i] - pMin[i]) / 20;
+    qMin[i] = mid - half;
+    qMax[i] = mid + half;
+  }
+
+  timer t;
+  auto build_knn = [&]() {
+    t.start();
+    bhlTree tree(P);
+    tree.knn(sample, opt.k);
+    return t.get_next();
+  };
+  auto co_build = [&]() {
+    t.start();
+    coTree tree(P);
+    return t.get_next();
+  };
+  auto bhl_build = [&]() {
+    t.start();
+    bhlTree tree(P);
+    return t.get_next();
+  };
+  auto co_bhl_build = [&]() { return co_build() + bhl_build(); };  // both layouts partition
+  auto erase = [&]() {
+    bhlTree tree(P);
+    auto to_erase = sample;
+    t.start();
+    tree.bulk_erase(to_erase);
+    return t.get_next();
+  };
+  auto range = [&]() {
+    bhlTree tree(P);
+    t.start();
+    for (int j = 0; j < 10; j++)
+      tree.orthogonalQuery(qMin, qMax);
+    return t.get_next();
+  };
+  auto dual_knn = [&]() {
+    bhlTree tree(P);
+    auto queries = sample;
+    t.start();
+    dualKnn(queries, tree, opt.k);
+    return t.get_next();
+  };
+  const int r = opt.rounds;
+
+  sweep("CLUSTER_SIZE", &tuningParams::cluster_size, cluster_sizes, r, build_knn);
+  sweep("CO_TOP_BUILD_BASE_CASE", &tuningParams::co_top_build_base_case, base_cases, r, co_build);
+  sweep("CO_BOTTOM_BUILD_BASE_CASE",
+        &tuningParams::co_bottom_build_base_case,
+        base_cases,
+        r,
+        co_build);
+  sweep("BHL_BUILD_BASE_CASE", &tuningParams::bhl_build_base_case, base_cases, r, bhl_build);
+  sweep("MULTILEVEL_PARTITION_BASE_CASE",
+        &tuningParams::multilevel_partition_base_case,
+        partition_base_cases,
+        r,
+        co_bhl_build);
+  sweep("ERASE_BASE_CASE", &tuningParams::erase_base_case, base_cases, r, erase);
+  sweep("BOUNDINGBOX_BASE_CASE", &tuningParams::boundingbox_base_case, base_cases, r, erase);
+  sweep("RANGEQUERY_BASE_CASE", &tuningParams::rangequery_base_case, base_cases, r, range);
+  sweep("DUALKNN_BASE_CASE", &tuningParams::dualknn_base_case, base_cases, r, dual_knn);
+  t.stop();
+
+  tuning().save(opt.out_file);
+  std::cout << "Wrote " << opt.out_file << ":\n";
+  tuning().write(std::cout);
+}
+
+template <int dim>
+void runAutotune(char* iFile, const TuneOptions& opt) {
+  auto P = iFile ? pargeo::pointIO::readPointsFromFile<point<dim>>(iFile)
+                 : pargeo::uniformInPolyPoints<dim, point<dim>>(opt.num_points, 1);
+  std::cout << "autotune: " << P.size() << " points, dim = " << dim
+            << ", #threads = " << parlay::num_workers() << std::endl;
+  autotune<dim>(P, opt);
+}
+
+int main(int argc, char* argv[]) {
+  commandLine P(argc,
+                argv,
+                "[-o <profile>] [-r <rounds>] [-k <k for knn>] [-n <points>] [-d <dim>] "
+                "[-i <inFile>]");
+  TuneOptions opt;
+  opt.out_file = P.getOptionValue("-o", "tuning.profile");
+  opt.rounds = P.getOptionIntValue("-r", 3);
+  opt.k = P.getOptionIntValue("-k", 5);
+  opt.num_points = P.getOptionLongValue("-n", 1000000);
+  opt.dim = P.getOptionIntValue("-d", 2);
+  char* iFile = P.getOptionValue("-i");
+  if (iFile) opt.dim = pargeo::pointIO::readDimensionFromFile(iFile);
+
+  if (opt.dim == 2) {
+    runAutotune<2>(iFile, opt);
+  } else if (opt.dim == 3) {
+    runAutotune<3>(iFile, opt);
+  } else if (opt.dim == 5) {
+    runAutotune<5>(iFile, opt);
+  } else if (opt.dim == 7) {
+    runAutotune<7>(iFile, opt);
+  } else {
+    throw std::runtime_error("autotune: unsupported dimension " + std::to_string(opt.dim));
+  }
+}
@@ -10,6 +10,7 @@
 
 #include "../include/batchKdtree/shared/utils.h"
 #include "../include/batchKdtree/shared/macro.h"
+#include "../include/batchKdtree/shared/tuning.h"
 
 using namespace batchKdTree;
 
@@ -68,10 +69,8 @@ void testSpatial(int argc, const char** argv) {
     throw std::runtime_error("invalid input");
 
   auto points = PARLAY_2D_TEST_POINTS(size);
-  parlay::sequence<bool> flags(points.size());
   size_t split_pt;
-  auto median = parallelSpatialPartition(
-      points.cut(0, points.size()), flags.cut(0, flags.size()), 0, split_pt);
+  auto median = parallelSpatialPartition(points.cut(0, points.size()), 0, split_pt);
 
   std::cout << "(median, split_pt) = (" << median << ", " << split_pt << ")" << std::endl;
 }
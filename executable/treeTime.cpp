@@ -46,13 +46,14 @@ enum TestType {
   KNN,
   KNN2,
   KNN3,
+  KNN4,
   DUAL_KNN,
   DELETE,
   INSERT,
   INSERT_DELETE
 };
 bool is_knn(const TestType& t) {
-  return (t == KNN) || (t == KNN2) || (t == KNN3) || (t == DUAL_KNN);
+  return (t == KNN) || (t == KNN2) || (t == KNN3) || (t == KNN4) || (t == DUAL_KNN);
 }
 
 static std::ostream& operator<<(std::ostream& os, const TestType& t) {
@@ -78,6 +79,9 @@ static std::ostream& operator<<(std::ostream& os, const TestType& t) {
     case KNN3:
       os << "KNN3";
       break;
+    case KNN4:
+      os << "KNN4";
+      break;
     case DUAL_KNN:
       os << "DUAL_KNN";
       break;
@@ -257,6 +261,11 @@ void timeKnn(parlay::sequence<point<dim>>& P, int rounds, int k, int k_type, con
       if (k_type == 1) tree.template knn3<false, true>(P, k);
       if (k_type == 2) tree.template knn3<true, false>(P, k);
       if (k_type == 3) tree.template knn3<true, true>(P, k);
+    } else if (type == KNN4) {
+      if (k_type == 0) tree.template knn4<false, false>(P, k);
+      if (k_type == 1) tree.template knn4<false, true>(P, k);
+      if (k_type == 2) tree.template knn4<true, false>(P, k);
+      if (k_type == 3) tree.template knn4<true, true>(P, k);
     } else {
       dualKnn(P, tree, k);
     }
@@ -354,6 +363,7 @@ void dispatchTest(parlay::sequence<point<dim>>& P, const TestOptions& test_optio
       break;
     }
     case DUAL_KNN:
+    case KNN4:
     case KNN3:
     case KNN2:
     case KNN: {
@@ -382,9 +392,9 @@ void dispatchTest(parlay::sequence<point<dim>>& P, const TestOptions& test_optio
 }
 
 static bool UseCO(const TestType& t) {
-  return (t != INSERT) && (t != INSERT_DELETE) && (t != KNN2) && (t != KNN3);
+  return (t != INSERT) && (t != INSERT_DELETE) && (t != KNN2) && (t != KNN3) && (t != KNN4);
 }
-static bool UseBHL(const TestType& t) { return (t != KNN2) && (t != KNN3); }
+static bool UseBHL(const TestType& t) { return (t != KNN2) && (t != KNN3) && (t != KNN4); }
 
 template <int dim, bool parallel, bool coarsen>
 void timeTrees(parlay::sequence<point<dim>>& P, const TestOptions& test_options) {
@@ -413,6 +423,7 @@ void timeTrees(parlay::sequence<point<dim>>& P, const TestOptions& test_options)
 #ifndef NDEBUG
     LogTree_t logtree(P);
     std::cout << " -> tree_mask = " << logtree.getTreeMask() << std::endl;
+    std::cout << " -> memory_footprint = " << logtree.memory_footprint() << " bytes" << std::endl;
 #endif
 
     // time it
@@ -477,6 +488,8 @@ TestOptions parseCmdLine(commandLine& P) {
     test_options.type = KNN2;
   } else if (type_str == "knn3") {
     test_options.type = KNN3;
+  } else if (type_str == "knn4") {
+    test_options.type = KNN4;
   } else if (type_str == "dual_knn") {
     test_options.type = DUAL_KNN;
   } else if (type_str == "delete") {
@@ -498,7 +511,7 @@ int main(int argc, char* argv[]) {
       argv,
       "[-o <outFile>] [-r <rounds>] [--serial, --parallel] [ --co, --bhl, "
       "--log] [--type "
-      "construction|range|contains|knn|knn2|knn3|dual_knn|delete|insert|insert_delete] [-k "
+      "construction|range|contains|knn|knn2|knn3|knn4|dual_knn|delete|insert|insert_delete] [-k "
       "<k for knn>] [--knn_type <[0,3]>] [--percentage <percentage for "
       "construction/deletion>] <inFile>");
   char* iFile = P.getArgument(0);
@@ -34,7 +34,9 @@
 
 namespace batchKdTree {
 
-inline bool buildInParallel(size_t num_points) { return num_points >= BHL_BUILD_BASE_CASE; }
+inline bool buildInParallel(size_t num_points) {
+  return num_points >= tuning().bhl_build_base_case;
+}
 
 // Dynamic (insert + delete) kd-tree with binary-heap layout
 template <int dim, class objT, bool parallel = false, bool coarsen = false>
@@ -42,13 +44,20 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
   typedef KdTree<dim, objT, parallel, coarsen> BaseTree;
   using typename BaseTree::nodeT;
 
-  static const auto leaf_size = (coarsen ? CLUSTER_SIZE : 1);
+  // points per leaf, fixed when the tree is constructed (see [tuning])
+  size_t leaf_size = (coarsen ? tuning().cluster_size : 1);
 
 #if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
-  void buildKdtRecursive(parlay::slice<objT *, objT *> items, int node_idx, int split_dim)
+  // [presplit] (if [presplit_levels] > 0) holds the splits of the next [presplit_levels] levels in
+  // heap order, starting at [presplit_idx]; [items] is already partitioned on them
+  void buildKdtRecursive(parlay::slice<objT *, objT *> items,
+                         int node_idx,
+                         int split_dim,
+                         const double *presplit = nullptr,
+                         size_t presplit_idx = 0,
+                         int presplit_levels = 0)
 #elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
   void buildKdtRecursive(parlay::slice<objT *, objT *> items,
-                         parlay::slice<bool *, bool *> flags,
                          int node_idx,
                          int split_dim)
 #endif
@@ -67,7 +76,21 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     size_t right_start;
 
 #if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
-    if (parallelBuild) {
+    parlay::sequence<double> splits;
+    if (presplit_levels == 0 && parallelBuild && multiLevelPartitionInParallel(items.size())) {
+      // split the next few levels at once (they must all be internal nodes)
+      int num_levels = MULTILEVEL_PARTITION_LEVELS;
+      while (num_levels > 1 && (items.size() >> num_levels) <= leaf_size)
+        num_levels--;
+      if (num_levels > 1 && multiLevelMedianPartition<objT>(items, split_dim, num_levels, splits)) {
+        presplit = splits.begin();
+        presplit_idx = 0;
+        presplit_levels = num_levels;
+      }
+    }
+    if (presplit_levels > 0) {
+      median = presplit[presplit_idx];
+    } else if (parallelBuild) {
       median = parallelMedianPartition<objT>(items, split_dim);
     } else {
       median = serialMedianPartition<objT>(items, split_dim);
@@ -75,7 +98,7 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     right_start = items.size() / 2;
 #elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
     if (parallelBuild) {
-      median = parallelSpatialPartition<objT>(items, flags, split_dim, right_start);
+      median = parallelSpatialPartition<objT>(items, split_dim, right_start);
     } else {
       median = serialSpatialPartition<objT>(items, split_dim, right_start);
     }
@@ -107,10 +130,17 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
       p->setLeft(&this->nodes[left_idx]);
       // this->parents[left_idx] = p;
 #if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
-      buildKdtRecursive(items.cut(0, right_start), left_idx, next_split_dim);
+      if (presplit_levels > 1)
+        buildKdtRecursive(items.cut(0, right_start),
+                          left_idx,
+                          next_split_dim,
+                          presplit,
+                          2 * presplit_idx + 1,
+                          presplit_levels - 1);
+      else
+        buildKdtRecursive(items.cut(0, right_start), left_idx, next_split_dim);
 #elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
-      buildKdtRecursive(
-          items.cut(0, right_start), flags.cut(0, right_start), left_idx, next_split_dim);
+      buildKdtRecursive(items.cut(0, right_start), left_idx, next_split_dim);
 #endif
     };
     auto right_f = [&]() {
@@ -122,12 +152,17 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
       p->setRight(&this->nodes[right_idx]);
       // this->parents[right_idx] = p;
 #if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
-      buildKdtRecursive(items.cut(right_start, items.size()), right_idx, next_split_dim);
+      if (presplit_levels > 1)
+        buildKdtRecursive(items.cut(right_start, items.size()),
+                          right_idx,
+                          next_split_dim,
+                          presplit,
+                          2 * presplit_idx + 2,
+                          presplit_levels - 1);
+      else
+        buildKdtRecursive(items.cut(right_start, items.size()), right_idx, next_split_dim);
 #elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
-      buildKdtRecursive(items.cut(right_start, items.size()),
-                        flags.cut(right_start, flags.size()),
-                        right_idx,
-                        next_split_dim);
+      buildKdtRecursive(items.cut(right_start, items.size()), right_idx, next_split_dim);
 #endif
     };
 
@@ -142,37 +177,34 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     p->recomputeBoundingBox();
   }
 
+  const bool initialize_items;
+
+  void allocate() {
+    BaseTree::allocate();
+    if (initialize_items && this->items.size() < this->max_size)
+      this->items = parlay::sequence<objT>(this->max_size);
+  }
+
   // Base Building Functions
   void buildKdt() {
     assert(this->size() > leaf_size);  // so it's not degenerate
     buildKdtRecursive(parlay::slice(this->items.begin(), this->items.begin() + this->size()), 0, 0);
   }
 
-  void buildKdt(parlay::slice<bool *, bool *> flags) {
-    assert(this->size() > leaf_size);  // so it's not degenerate
-    buildKdtRecursive(
-        parlay::slice(this->items.begin(), this->items.begin() + this->size()), flags, 0, 0);
-  }
-
   // cur_size, build_size, max_size, items are set before this is called
   void build() {
     assert(this->cur_size != 0);
-#if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
     buildKdt();
-#elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
-    auto n = this->items.size();
-    auto flags = parlay::sequence<bool>(n);
-    auto flagSlice = parlay::slice(flags.begin(), flags.end());
-    buildKdt(flagSlice);
-#endif
+    this->buildLeafMirror();
   }
 
  public:
-  BHL_KdTree(int log2size, bool initialize = true) : BaseTree(log2size) {
-    if (initialize) this->items = parlay::sequence<objT>(this->max_size);
-  }
-  BHL_KdTree(const parlay::slice<const objT *, const objT *> &points) : BaseTree(points) {
-    this->items = parlay::sequence<objT>(this->max_size);
+  // [initialize]: whether [items] is sized to capacity when the storage is allocated (needed for
+  // [insert]; trees that are only built from a moved sequence can skip it)
+  BHL_KdTree(int log2size, bool initialize = true)
+      : BaseTree(log2size), initialize_items(initialize) {}
+  BHL_KdTree(const parlay::slice<const objT *, const objT *> &points)
+      : BaseTree(points), initialize_items(true) {
     build(points);
   }
   BHL_KdTree(const parlay::sequence<objT> &points) : BHL_KdTree(points.cut(0, points.size())) {}
@@ -186,6 +218,7 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
   void build_no_bloom(const parlay::slice<const objT *, const objT *> &points) {
     assert(this->cur_size == 0);
     size_t n = points.size();
+    allocate();
 
     // save the input points into [items]
     // TODO: does this parallelize? items.assign(points.begin(), points.end());
@@ -207,17 +240,17 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
   }
 
   // should somehow indicate that inserts aren't allowed
+  // [points] is moved into [items]; the bloom filter is then built over the same array
   void build(parlay::sequence<objT> &&points) {
     assert(this->cur_size == 0);
     size_t n = points.size();
+    BaseTree::allocate();
     this->cur_size = n;
     this->build_size = n;
-    this->items = points;
-#ifdef ALL_USE_BLOOM
-    auto points_copy = this->items;
-    parlay::par_do([&]() { this->bloom_filter.build(points_copy); }, [&]() { build(); });
-#else
+    this->items = std::move(points);
     build();
+#ifdef ALL_USE_BLOOM
+    this->bloom_filter.build(this->items);
 #endif
   }
 
@@ -235,22 +268,22 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 
     auto insert_no_bloom = [&]() {
       if (this->cur_size == 0) {
+        if (this->build_size != 0) this->clearItems();  // everything was erased; reset [present]
         build_no_bloom(points);
       } else {
-        // gather points from tree
-        parlay::sequence<objT> gather(this->cur_size);
-        [[maybe_unused]] auto num_moved = this->moveElementsTo(gather.cut(0, this->cur_size));
-        assert(num_moved == gather.size());
-
-        parlay::parallel_for(0, gather.size() + points.size(), [&](size_t i) {
-          if (i < gather.size())
-            this->items[i] = gather[i];  // reinsert old items
-          else
-            this->items[i] = points[i - gather.size()];  // insert new items
-        });
+        // pack the live items into a fresh capacity-sized array, append the new points and hand
+        // the array over to [items]: one pass over the old items, no copy back
+        auto num_old = this->cur_size;
+        parlay::sequence<objT> gather(std::max(this->max_size, num_old + points.size()));
+        [[maybe_unused]] auto num_moved = this->moveElementsTo(gather.cut(0, num_old));
+        assert(num_moved == num_old);
+        parlay::parallel_for(
+            0, points.size(), [&](size_t i) { gather[num_old + i] = points[i]; });
+        BaseTree::allocate();
+        this->items = std::move(gather);
 
         // set sizes
-        this->cur_size = gather.size() + points.size();
+        this->cur_size = num_old + points.size();
         this->build_size = this->cur_size;
         build();
       }
@@ -263,6 +296,8 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 #endif
   }
 
+  // with [rebuild], the survivors are packed once and moved into a rebuilt tree; [points] may be
+  // reordered
   template <bool rebuild = true>
 #ifdef ALL_USE_BLOOM
   void bulk_erase(const parlay::sequence<objT> &points)
@@ -273,20 +308,14 @@ class BHL_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 #ifdef ALL_USE_BLOOM
     BaseTree::bulk_erase(points);
 #else
-    if (rebuild) {  // NOT logtree!
-      auto points_copy = points;
-      BaseTree::bulk_erase(points_copy);
-    } else {
-      BaseTree::bulk_erase(points);
-    }
+    BaseTree::bulk_erase(points);
 #endif
 
-    if (rebuild) {
+    if (rebuild) {  // NOT logtree!
       auto cursize = this->cur_size;
       parlay::sequence<objT> elements(cursize);
       this->moveElementsTo(elements.cut(0, cursize));
-      const auto &const_elements = elements;
-      build(const_elements.cut(0, cursize));
+      build(std::move(elements));
     }
   }
 };
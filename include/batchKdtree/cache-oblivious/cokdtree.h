@@ -49,14 +49,20 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
   typedef KdTree<dim, objT, parallel, coarsen> BaseTree;
   using typename BaseTree::nodeT;
 
-  static const auto leaf_size = (coarsen ? CLUSTER_SIZE : 1);
+  // points per leaf, fixed when the tree is constructed (see [tuning])
+  size_t leaf_size = (coarsen ? tuning().cluster_size : 1);
+
   // Recursive Build --------------------------------------------------------------------------
   // PARALLEL
+  // Top trees may come with [presplit]: the splits of all their levels in heap order, starting at
+  // [presplit_idx] (see multiLevelMedianPartition); [items] is already partitioned on them.
   template <bool top>
   void buildKdtRecursiveParallel(parlay::slice<objT *, objT *> items,
                                  nodeT *node_array,
                                  int split_dim,
-                                 int num_levels) {
+                                 int num_levels,
+                                 const double *presplit = nullptr,
+                                 size_t presplit_idx = 0) {
     assert(parallel);
     // DEBUG_MSG("buildKdt" << (top ? "Top" : "Bottom") << "Parallel(items.size() = " <<
     // items.size()
@@ -76,7 +82,8 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
         t.start();
 #endif
         assert(items.size() > 1);
-        auto median = parallelMedianPartition<objT>(items, split_dim);
+        auto median =
+            presplit ? presplit[presplit_idx] : parallelMedianPartition<objT>(items, split_dim);
         assert(node_array[0].isEmpty());
         new (&node_array[0]) nodeT(split_dim, median, items);
 #ifdef PRINT_COKDTREE_TIMINGS
@@ -107,8 +114,19 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 #endif
 
     // Make first call - builds the top tree and partitions [items] on that split.
+    // Large top trees partition all of their levels in one pass.
+    parlay::sequence<double> splits;
+    const double *top_presplit = presplit;
+    size_t top_presplit_idx = presplit_idx;
+    if (!presplit && top_num_levels > 1 && top_num_levels <= MULTILEVEL_PARTITION_LEVELS &&
+        multiLevelPartitionInParallel(items.size()) &&
+        multiLevelMedianPartition<objT>(items, split_dim, top_num_levels, splits)) {
+      top_presplit = splits.begin();
+      top_presplit_idx = 0;
+    }
     auto originalNodeArray = node_array;
-    buildKdtTopParallel(items, node_array, split_dim, top_num_levels);
+    buildKdtTopParallel(
+        items, node_array, split_dim, top_num_levels, top_presplit, top_presplit_idx);
 
 #ifdef PRINT_COKDTREE_TIMINGS
     if (print_timer) {
@@ -161,7 +179,9 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
             buildKdtTopParallel(items.cut(left_endpoint, right_endpoint),
                                 cur_node_array,
                                 (split_dim + top_num_levels) % dim,
-                                bottom_num_levels);
+                                bottom_num_levels,
+                                presplit,
+                                ((presplit_idx + 1) << top_num_levels) - 1 + i);
           } else {
             buildKdtBottomParallel(items.cut(left_endpoint, right_endpoint),
                                    cur_node_array,
@@ -203,12 +223,15 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
   void buildKdtTopParallel(parlay::slice<objT *, objT *> items,
                            nodeT *node_array,
                            int split_dim,
-                           int num_levels) {
+                           int num_levels,
+                           const double *presplit = nullptr,
+                           size_t presplit_idx = 0) {
     assert(parallel);
     if (buildTopInParallel(num_levels, items.size())) {
-      buildKdtRecursiveParallel<true>(items, node_array, split_dim, num_levels);
+      buildKdtRecursiveParallel<true>(
+          items, node_array, split_dim, num_levels, presplit, presplit_idx);
     } else {
-      buildKdtRecursive<true>(items, node_array, split_dim, num_levels);
+      buildKdtRecursive<true>(items, node_array, split_dim, num_levels, presplit, presplit_idx);
     }
   }
 
@@ -217,7 +240,7 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
                               int split_dim) {
     assert(parallel);
     int N = items.size();  // number of leaves
-    int num_levels = numLevels<coarsen>(N);
+    int num_levels = numLevels(N, leaf_size);
 
     if (buildBottomInParallel(num_levels, items.size())) {
       buildKdtRecursiveParallel<false>(items, node_array, split_dim, num_levels);
@@ -233,7 +256,9 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
   size_t buildKdtRecursive(parlay::slice<objT *, objT *> items,
                            nodeT *node_array,
                            int split_dim,
-                           int num_levels) {
+                           int num_levels,
+                           const double *presplit = nullptr,
+                           size_t presplit_idx = 0) {
     // DEBUG_MSG("buildKdt" << (top ? "Top" : "Bottom") << "(items.size() = " << items.size()
     //<< ", split_dim = " << split_dim << ", num_levels = " << num_levels
     //<< ")");
@@ -245,7 +270,8 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
       // Base case: perform a split
       if (num_levels == 1) {
         assert(items.size() > 1);
-        auto median = serialMedianPartition<objT>(items, split_dim);
+        auto median =
+            presplit ? presplit[presplit_idx] : serialMedianPartition<objT>(items, split_dim);
         assert(node_array[0].isEmpty());
         new (&node_array[0]) nodeT(split_dim, median, items);
         return 1;
@@ -288,7 +314,7 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 
     // Make first call - builds the top tree and partitions [items] on that split.
     auto originalNodeArray = node_array;
-    node_array += buildKdtTop(items, node_array, split_dim, top_num_levels);
+    node_array += buildKdtTop(items, node_array, split_dim, top_num_levels, presplit, presplit_idx);
 
     int num_subtrees = 1 << top_num_levels;
     assert(child_indices[top_num_levels].size() == (size_t)(num_subtrees / 2));
@@ -324,7 +350,9 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
         node_array += buildKdtTop(items.cut(left_endpoint, right_endpoint),
                                   node_array,
                                   (split_dim + top_num_levels) % dim,
-                                  bottom_num_levels);
+                                  bottom_num_levels,
+                                  presplit,
+                                  ((presplit_idx + 1) << top_num_levels) - 1 + i);
       } else {
         node_array += buildKdtBottom(items.cut(left_endpoint, right_endpoint),
                                      node_array,
@@ -359,13 +387,16 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
   size_t buildKdtTop(parlay::slice<objT *, objT *> items,
                      nodeT *node_array,
                      int split_dim,
-                     int num_levels) {
-    return buildKdtRecursive<true>(items, node_array, split_dim, num_levels);
+                     int num_levels,
+                     const double *presplit = nullptr,
+                     size_t presplit_idx = 0) {
+    return buildKdtRecursive<true>(
+        items, node_array, split_dim, num_levels, presplit, presplit_idx);
   }
 
   size_t buildKdtBottom(parlay::slice<objT *, objT *> items, nodeT *node_array, int split_dim) {
     int N = items.size();  // number of leaves
-    int num_levels = numLevels<coarsen>(N);
+    int num_levels = numLevels(N, leaf_size);
 
     return buildKdtRecursive<false>(items, node_array, split_dim, num_levels);
   }
@@ -376,13 +407,14 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     // DEBUG_MSG("buildKdtBottom: items.size() = " << this->items.size()
     //<< ", .size() = " << this->size());
     assert(this->size() > leaf_size);
-    assert(numLevels<coarsen>(this->size()) > 1);
+    assert(numLevels(this->size(), leaf_size) > 1);
     // initialize(numLevels(this->size()));
     if (parallel) {
       buildKdtBottomParallel(this->items.cut(0, this->size()), this->nodes, 0);
     } else {
       buildKdtBottom(this->items.cut(0, this->size()), this->nodes, 0);
     }
+    this->buildLeafMirror();
   }
 
   void buildKdt(__attribute__((unused)) parlay::slice<bool *, bool *> flags) {
@@ -426,9 +458,10 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
     this->mark_time("Build Called");
 #endif
     assert(this->cur_size == 0);
-    this->items = points;
+    this->allocate();
+    this->items = std::move(points);
     auto build_tree = [&]() {
-      auto n = points.size();
+      auto n = this->items.size();
       // this assertion holds for build, but not inserts
       // assert(n > this->capacity() / 2);
 
@@ -450,11 +483,10 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 #endif
     };
 
-#ifdef ALL_USE_BLOOM
-    auto points_copy = this->items;
-    parlay::par_do([&]() { this->bloom_filter.build(points_copy); }, build_tree);
-#else
     build_tree();
+#ifdef ALL_USE_BLOOM
+    // after the build, so the filter reads the same array without racing the partitioning
+    this->bloom_filter.build(this->items);
 #endif
     // if (parallel) {
     // auto flags = parlay::sequence<bool>(n);
@@ -479,22 +511,26 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 #endif
 
     if (this->cur_size == 0) {
+      if (this->build_size != 0) this->clear();  // everything was erased; reset [present]
       // could be move if points is a sequence
       parlay::sequence<objT> to_insert;
       to_insert.assign(points);
       build(std::move(to_insert));
     } else {
-      // gather points from tree
-      parlay::sequence<objT> gather(this->cur_size);
-      [[maybe_unused]] auto num_moved = this->moveElementsTo(gather.cut(0, this->cur_size));
-      assert(num_moved == gather.size());
-
-      // add the new points and rebuild
-      gather.append(points);
+      // gather points from tree into an array sized for the new points too, so it is never
+      // reallocated, then move it into the rebuilt tree
+      auto num_old = this->cur_size;
+      parlay::sequence<objT> gather(num_old + points.size());
+      [[maybe_unused]] auto num_moved = this->moveElementsTo(gather.cut(0, num_old));
+      assert(num_moved == num_old);
+      parlay::parallel_for(
+          0, points.size(), [&](size_t i) { gather[num_old + i] = points[i]; });
       build(std::move(gather));
     }
   }
 
+  // with [rebuild], the survivors are packed once and moved into a rebuilt tree; [points] may be
+  // reordered
   template <bool rebuild = true>
 #ifdef ALL_USE_BLOOM
   void bulk_erase(const parlay::sequence<objT> &points)
@@ -505,12 +541,7 @@ class CO_KdTree : public KdTree<dim, objT, parallel, coarsen> {
 #ifdef ALL_USE_BLOOM
     BaseTree::bulk_erase(points);
 #else
-    if (rebuild) {
-      auto points_copy = points;
-      BaseTree::bulk_erase(points_copy);
-    } else {
-      BaseTree::bulk_erase(points);
-    }
+    BaseTree::bulk_erase(points);
 #endif
 
     if (rebuild) {
@@ -35,20 +35,21 @@ void funnelSort() {
 }
 
 // kd-tree structure
-template <bool coarsen>
-inline int numLevels(int num_leaves) {
-  if (coarsen) num_leaves = (num_leaves + (CLUSTER_SIZE - 1)) / CLUSTER_SIZE;
+// [leaf_size] points per leaf (1 if the tree is not coarsened)
+inline int numLevels(int num_leaves, size_t leaf_size) {
+  num_leaves = (num_leaves + (leaf_size - 1)) / leaf_size;
   return 1 + (int)std::ceil(std::log2(num_leaves));  // number of levels
 }
 inline int numNodesTop(int num_levels) { return (1 << num_levels) - 1; }
 inline int numNodesBottom(size_t num_points) { return 2 * num_points - 1; }
 
 inline bool buildTopInParallel(__attribute__((unused)) int num_levels, size_t num_points) {
-  if (num_points < CO_TOP_BUILD_BASE_CASE) return false;
+  if (num_points < tuning().co_top_build_base_case) return false;
   return true;
 }
-inline bool buildBottomInParallel(__attribute__((unused)) int num_levels, size_t num_points) {
-  if (num_points < CO_BOTTOM_BUILD_BASE_CASE) return false;
+inline bool buildBottomInParallel(int num_levels, size_t num_points) {
+  if (num_levels <= 1) return false;  // a single leaf, whatever the tuned base case
+  if (num_points < tuning().co_bottom_build_base_case) return false;
   return true;
 }
 
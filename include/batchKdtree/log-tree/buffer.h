@@ -23,10 +23,15 @@
 
 #pragma once
 
+#define XXH_PRIVATE_API
 #include <parlay/parallel.h>
 #include <parlay/sequence.h>
+#include <xxHash/xxhash.h>
 
 #include "../shared/macro.h"
+#include "../shared/object.h"
+#include "../shared/bitmask.h"
+#include "../shared/utils.h"
 
 namespace batchKdTree {
 
@@ -35,42 +40,90 @@ class alignas(64) LogTreeBuffer {
   typedef point<dim> pointT;
   // simple wrapper around parlay::sequence
   parlay::sequence<objT> items;
-  parlay::sequence<bool> present;
+  bitMask present;
   size_t cur_size;
   size_t insert_size;
 
+  // Coordinate hash index over items[0, items.size() - insert_size): open addressing with linear
+  // probing on twice the capacity, so it is at most half full. A slot holds 1 + the position of an
+  // item (0 is empty). Erased items keep their slot until the index is rebuilt (on [clear] or when
+  // an insert compacts the buffer); lookups skip them through [present].
+  parlay::sequence<uint32_t> slots;
+
+  size_t slotOf(const objT &p) const {
+    return XXH64(p.coordinate(), dim * sizeof(double), 0) & (slots.size() - 1);
+  }
+
+  // add items[i] to the index; concurrent calls must be for different i
+  void indexItem(size_t i) {
+    auto s = slotOf(items[i]);
+    while (slots[s] != 0 || !__sync_bool_compare_and_swap(&slots[s], 0, (uint32_t)(i + 1)))
+      s = (s + 1) & (slots.size() - 1);
+  }
+  void indexItems(size_t s, size_t e) {
+    if (parallel) {
+      parlay::parallel_for(s, e, [&](size_t i) { indexItem(i); });
+    } else {
+      for (size_t i = s; i < e; i++)
+        indexItem(i);
+    }
+  }
+  void clearIndex() {
+    if (parallel) {
+      parlay::parallel_for(0, slots.size(), [&](size_t s) { slots[s] = 0; });
+    } else {
+      std::fill(slots.begin(), slots.end(), 0);
+    }
+  }
+
+  // call f(i) for every present items[i] equal to [p]
+  template <class F>
+  void forEachMatch(const objT &p, F f) const {
+    for (auto s = slotOf(p); slots[s] != 0; s = (s + 1) & (slots.size() - 1)) {
+      auto i = slots[s] - 1;
+      if (present[i] && items[i] == p) f(i);
+    }
+  }
+
  public:
   LogTreeBuffer() = delete;
-  LogTreeBuffer(int log2size)
+  // [initialize] is for the same signature as BHL_KdTree: the buffer always allocates its storage
+  LogTreeBuffer(int log2size, __attribute__((unused)) bool initialize = true)
       : items(1 << log2size),
         present(1 << log2size, false),
         cur_size(0),
-        insert_size(1 << log2size) {}
+        insert_size(1 << log2size),
+        slots(2 << log2size, 0) {}
 
   size_t size() const { return cur_size; }
+  size_t memory_footprint() const {
+    return items.capacity() * sizeof(objT) + present.memory_footprint() +
+           slots.capacity() * sizeof(uint32_t);
+  }
   bool empty() const { return cur_size == 0; }
   void clear() {
     insert_size = items.size();
     cur_size = 0;
-    present.assign(items.size(), false);
+    present.assign<parallel>(false);
+    clearIndex();
   }
 
-  size_t moveElementsTo(parlay::slice<objT *, objT *> dest) {
+  // pack the items into [dest], leaving the buffer unchanged
+  size_t copyElementsTo(parlay::slice<objT *, objT *> dest) const {
     auto cur_end = items.size() - insert_size;
     size_t ret;
     assert(dest.size() >= size());
     if (parallel) {
-      ret = parlay::pack_into(parlay::slice(items.begin(), items.begin() + cur_end),
-                              parlay::slice(present.begin(), present.begin() + cur_end),
-                              dest);
+      ret = present.packIntoParallel(items.begin(), 0, cur_end, dest.begin());
     } else {
-      ret = 0;
-      for (size_t i = 0; i < cur_end; i++) {
-        if (present[i]) {
-          dest[ret++] = items[i];
-        }
-      }
+      ret = present.packInto(items.begin(), 0, cur_end, dest.begin());
     }
+    assert(ret == size());
+    return ret;
+  }
+
+  size_t moveElementsTo(parlay::slice<objT *, objT *> dest) {
+    auto ret = copyElementsTo(dest);
     clear();
     return ret;
   }
@@ -86,17 +139,16 @@ class alignas(64) LogTreeBuffer {
     if (points.size() <= insert_size) {
       // place items
       auto cur_start = items.size() - insert_size;
-      parlay::parallel_for(0, points.size(), [&](size_t i) {
-        items[cur_start + i] = points[i];
-        present[cur_start + i] = true;
-      });
+      parlay::parallel_for(0, points.size(), [&](size_t i) { items[cur_start + i] = points[i]; });
+      present.assign<parallel>(cur_start, cur_start + points.size(), true);
+      indexItems(cur_start, cur_start + points.size());
       // update size fields
       this->cur_size += points.size();
       this->insert_size -= points.size();
     } else {
-      // gather elements
+      // gather elements (this clears the buffer and its index)
       parlay::sequence<objT> gather(cur_size);
-      moveElementsTo(gather.cut(0, cur_size));
+      moveElementsTo(gather.cut(0, gather.size()));
       // place elements
       auto new_size = gather.size() + points.size();
       parlay::parallel_for(0, new_size, [&](size_t i) {
@@ -105,20 +157,34 @@ class alignas(64) LogTreeBuffer {
         else
           this->items[i] = points[i - gather.size()];
       });
+      present.assign<parallel>(0, new_size, true);
+      indexItems(0, new_size);
       // update size fields
       this->cur_size = new_size;
       insert_size -= new_size;
     }
   }
 
+  // erase every present copy of each of [points], found through the hash index
   void bulk_erase(const parlay::sequence<objT> &points) {
-    parlay::parallel_for(0, points.size(), [&](size_t i) {
-      parlay::parallel_for(0, items.size() - insert_size, [&](size_t j) {
-        if (present[j] && (points[i] == items[j])) {
-          present[j] = false;
-        }
-      });
-    });
+    auto erase_point = [&](size_t i) {
+      size_t num_erased = 0;
+      forEachMatch(points[i], [&](size_t j) { num_erased += present.testAndReset(j); });
+      return num_erased;
+    };
+    size_t num_erased = 0;
+    if (parallel) {
+      num_erased = parlay::reduce(parlay::delayed_seq<size_t>(points.size(), erase_point));
+    } else {
+      for (size_t i = 0; i < points.size(); i++)
+        num_erased += erase_point(i);
+    }
+    cur_size -= num_erased;
+  }
+
+  template <bool _unused>
+  void bulk_erase(const parlay::sequence<objT> &points) {
+    bulk_erase(points);
   }
 
   template <bool _unused>
@@ -128,15 +194,12 @@ class alignas(64) LogTreeBuffer {
 
   // queries
   bool contains(const objT &p) const {
-    // TODO: not great, has a data race
     bool ret = false;
-    parlay::parallel_for(0, items.size() - insert_size, [&](size_t i) {
-      if (present[i] && (p == items[i])) ret = true;
-    });
+    forEachMatch(p, [&](size_t) { ret = true; });
     return ret;
   }
 
-  parlay::sequence<objT> orthogonalQuery(const objT &qMin, const objT &qMax) const {
+  parlay::sequence<objT> orthogonalQuery(const pointT &qMin, const pointT &qMax) const {
     auto cur_end = items.size() - insert_size;
 
     // check all points in parallel
@@ -160,37 +223,102 @@ class alignas(64) LogTreeBuffer {
     return ret;
   }
 
-  void knnSinglePoint(const objT &p, knnBuf::buffer<const pointT *> &buf) const {
+  // the two passes of a batched range query; the buffer is small, so these are serial scans
+  size_t rangeCount(const pointT &qMin, const pointT &qMax) const {
+    auto cur_end = items.size() - insert_size;
+    size_t ret = 0;
+    for (size_t i = 0; i < cur_end; i++)
+      if (present[i] && itemInBox(qMin, qMax, &items[i])) ret++;
+    return ret;
+  }
+  size_t orthogonalFill(const pointT &qMin, const pointT &qMax, objT *out) const {
+    auto cur_end = items.size() - insert_size;
+    size_t ret = 0;
+    for (size_t i = 0; i < cur_end; i++)
+      if (present[i] && itemInBox(qMin, qMax, &items[i])) out[ret++] = items[i];
+    return ret;
+  }
+
+  parlay::sequence<objT> ballQuery(const pointT &q, double radius) const {
+    auto cur_end = items.size() - insert_size;
+    auto rSqr = radius * radius;
+
+    // check all points in parallel
+    parlay::sequence<bool> in_ball(cur_end, false);
+    parlay::parallel_for(0, cur_end, [&](size_t i) {
+      if (present[i] && q.distSqr(items[i]) <= rSqr) in_ball[i] = true;
+    });
+
+    // construct return sequence
+    parlay::sequence<objT> ret(cur_end);
+    auto ret_size =
+        parlay::pack_into(parlay::slice(items.begin(), items.begin() + cur_end), in_ball, ret);
+    ret.resize(ret_size);
+    return ret;
+  }
+
+  // the two passes of a batched ball query, serial scans as for the boxes
+  size_t ballCount(const pointT &q, double radius) const {
+    auto cur_end = items.size() - insert_size;
+    auto rSqr = radius * radius;
+    size_t ret = 0;
+    for (size_t i = 0; i < cur_end; i++)
+      if (present[i] && q.distSqr(items[i]) <= rSqr) ret++;
+    return ret;
+  }
+  size_t ballFill(const pointT &q, double radius, objT *out) const {
+    auto cur_end = items.size() - insert_size;
+    auto rSqr = radius * radius;
+    size_t ret = 0;
+    for (size_t i = 0; i < cur_end; i++)
+      if (present[i] && q.distSqr(items[i]) <= rSqr) out[ret++] = items[i];
+    return ret;
+  }
+
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> ballQuery(
+      const parlay::sequence<pointT> &queries, const parlay::sequence<double> &radii) const {
+    assert(queries.size() == radii.size());
+    auto n = queries.size();
+    parlay::sequence<size_t> offsets(n + 1, 0);
+    parlay::parallel_for(0, n, [&](size_t i) { offsets[i] = ballCount(queries[i], radii[i]); });
+    parlay::scan_inplace(offsets);
+    parlay::sequence<objT> ret(offsets[n]);
+    parlay::parallel_for(
+        0, n, [&](size_t i) { ballFill(queries[i], radii[i], ret.begin() + offsets[i]); });
+    return {std::move(offsets), std::move(ret)};
+  }
+
+  template <class bufT>
+  void knnSinglePoint(const objT &p, bufT &buf) const {
     auto cur_end = items.size() - insert_size;
     for (size_t i = 0; i < cur_end; i++) {
       if (present[i]) {
-        auto dist = p.dist(items[i]);
-        // if (dist <= radius) {
-        const objT *item_ptr = items.begin() + i;
+        auto dist = p.distSqr(items[i]);
+        // if (dist <= radiusSqr) {
+        const pointT *item_ptr = items.begin() + i;
         buf.insert(knnBuf::elem(dist, item_ptr));
         //}
       }
     }
+    if (buf.hasK()) buf.keepK();  // leave the k nearest in front, as KdTree::knnSinglePoint does
   }
 
-  template <bool set_res, bool _update, bool _recurse_sibling>
+  template <bool set_res, bool _update, bool _recurse_sibling, class outT>
   void knnSinglePoint(
       const objT &p,
       int i,
       parlay::slice<knnBuf::elem<const pointT *> *, knnBuf::elem<const pointT *> *> &out,
-      parlay::slice<const pointT **, const pointT **> &res,
+      parlay::slice<outT *, outT *> &res,
       int k,
-      bool preload) const {
+      bool preload,
+      __attribute__((unused)) const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
+    // the buffer is scanned in full, so approximate search has nothing to skip
     auto buf = knnBuf::buffer<const pointT *>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
     if (preload) buf.ptr = k;
 
     knnSinglePoint(p, buf);
 
-    if (set_res) {
-      for (int j = 0; j < k; j++) {
-        res[i * k + j] = buf[j].entry;
-      }
-    }
+    if (set_res) storeKnnResults<objT>(res.begin() + i * k, buf);
   }
 
   void knn(const parlay::sequence<objT> &queries,
@@ -205,22 +333,23 @@ class alignas(64) LogTreeBuffer {
     }
   }
 
-  template <bool set_res, bool _update, bool _recurse_sibling>
+  template <bool set_res, bool _update, bool _recurse_sibling, class outT>
   void knn(const parlay::sequence<objT> &queries,
            parlay::slice<knnBuf::elem<const pointT *> *, knnBuf::elem<const pointT *> *> &out,
-           parlay::slice<const pointT **, const pointT **> &res,
+           parlay::slice<outT *, outT *> &res,
            int k,
-           bool preload = false) const {
-    assert(res.size() == k * queries.size());
+           bool preload = false,
+           const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
+    assert(!set_res || res.size() == k * queries.size());
     assert(out.size() == 2 * k * queries.size());
 
     if (parallel) {
       parlay::parallel_for(0, queries.size(), [&](size_t i) {
-        knnSinglePoint<set_res, false, false>(queries[i], i, out, res, k, preload);
+        knnSinglePoint<set_res, false, false>(queries[i], i, out, res, k, preload, approx);
       });
     } else {
       for (size_t i = 0; i < queries.size(); i++)
-        knnSinglePoint<set_res, false, false>(queries[i], i, out, res, k, preload);
+        knnSinglePoint<set_res, false, false>(queries[i], i, out, res, k, preload, approx);
     }
   }
 };
@@ -0,0 +1,143 @@
+// This code is part of the project "Parallel Batch-Dynamic Kd-Trees"
+// Copyright (c) 2021-2022 Rahul Yesantharao, Yiqiu Wang, Laxman Dhulipala, Julian Shun
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <parlay/parallel.h>
+#include <parlay/primitives.h>
+#include <parlay/sequence.h>
+
+namespace batchKdTree {
+
+// whether [objT] carries an id, see object.h
+template <class objT, class = void>
+struct hasId : std::false_type {};
+template <class objT>
+struct hasId<objT, std::void_t<typename objT::idT>> : std::true_type {};
+
+/*!
+ * Where the objects of the static trees of a LogTree are: id -> (tree, index in its items). The
+ * entries of a static tree are rewritten in bulk when it is built; the entries of the objects it
+ * loses are left behind, so a location is only a hint, checked against the tree before use (see
+ * [LogTree::locate]). Ids index the table directly, so it is sized by an explicit bound on the ids,
+ * and only suits ids that are unique and dense, like the positions of the objects in the input.
+ * The objects of the buffer are not located.
+ *
+ * A LogTree only keeps a locator once asked to (see [LogTree::locateIds]). For an [objT] without an
+ * id there is nothing to locate.
+ *
+ * The copies of a LogTree share its locator, but its entries follow the levels of one copy only:
+ * the one that claimed it last (see [claim]). A copy that finds it was claimed by another since
+ * builds a locator of its own.
+ */
+template <class objT, bool = hasId<objT>::value>
+class idLocator {
+ public:
+  static constexpr bool enabled = false;
+  template <class R>
+  void checkIds(const R&) const {}
+  template <class R>
+  void refresh(int, const R&) {}
+  bool claim(uint64_t&) { return true; }
+  size_t memory_footprint() const { return 0; }
+};
+
+template <class objT>
+class idLocator<objT, true> {
+  typedef typename objT::idT idT;
+
+  struct maxm {
+    using T = idT;
+    T identity = 0;
+    static T f(T a, T b) { return (std::max)(a, b); }
+  };
+
+ public:
+  static constexpr bool enabled = true;
+  struct location {
+    int tree = -1;
+    size_t idx = 0;
+  };
+
+  // locates the ids below [id_bound]; the tree building it holds [generation]
+  explicit idLocator(size_t id_bound) : locations(id_bound), owner(nextGeneration()) {}
+
+  size_t idBound() const { return locations.size(); }
+  uint64_t generation() const { return owner.load(std::memory_order_acquire); }
+
+  // Called by a tree holding generation [gen] before it reads or writes the entries. Succeeds if
+  // [gen] is still the owner's, and hands the tree a fresh generation, so the copies that shared
+  // [gen] find it stale from then on; fails if another copy claimed the locator since
+  bool claim(uint64_t& gen) {
+    auto expected = gen, next = nextGeneration();
+    if (!owner.compare_exchange_strong(expected, next, std::memory_order_acq_rel)) return false;
+    gen = next;
+    return true;
+  }
+
+  // throws if an object of [objects] has an id at or above the bound; called before [objects] are
+  // inserted, so the tree is left unchanged
+  template <class R>
+  void checkIds(const R& objects) const {
+    auto ids = parlay::delayed_seq<idT>(objects.size(), [&](size_t i) {
+      return (objects[i].id == objT::NO_ID) ? 0 : objects[i].id + 1;
+    });
+    auto size = (size_t)parlay::reduce(ids, maxm());
+    if (size > locations.size())
+      throw std::runtime_error("Object id " + std::to_string(size - 1) +
+                               " is not below the locator's id bound " +
+                               std::to_string(locations.size()));
+  }
+
+  // [items] are the items of static tree [tree]; their ids must be below the bound (see [checkIds])
+  template <class R>
+  void refresh(int tree, const R& items) {
+    parlay::parallel_for(0, items.size(), [&](size_t i) {
+      auto id = items[i].id;
+      if (id != objT::NO_ID) locations[id] = {tree, i};
+    });
+  }
+
+  location find(idT id) const { return (id < locations.size()) ? locations[id] : location(); }
+
+  size_t memory_footprint() const { return locations.capacity() * sizeof(location); }
+
+ private:
+  parlay::sequence<location> locations;
+  std::atomic<uint64_t> owner;
+
+  static uint64_t nextGeneration() {
+    static std::atomic<uint64_t> generations(0);
+    return ++generations;
+  }
+};
+
+}  // End namespace batchKdTree
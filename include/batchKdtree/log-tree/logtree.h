@@ -23,10 +23,15 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
+
 #include "../cache-oblivious/cokdtree.h"
 #include "../binary-heap-layout/bhlkdtree.h"
 #include "../shared/macro.h"
 #include "./buffer.h"
+#include "./locator.h"
+#include "./policy.h"
 
 #ifdef PRINT_LOGTREE_TIMINGS
 #include "common/get_time.h"
@@ -44,14 +49,6 @@ namespace batchKdTree {
   } while (false)*/
 
 #ifndef NDEBUG
-template <int NUM_TREES>
-static std::string treeMaskToString(int tree_mask) {
-  std::stringstream ss;
-  for (int i = NUM_TREES - 1; i >= 0; i--) {
-    ss << ((tree_mask >> i) & 1);
-  }
-  return ss.str();
-}
 static std::string seq_to_str(const parlay::sequence<int>& s) {
   std::stringstream ss;
   ss << "[";
@@ -64,8 +61,8 @@ static std::string seq_to_str(const parlay::sequence<int>& s) {
 }
 #endif
 
-template <int NUM_TREES,         // the number of static trees
-          int BUFFER_LOG2_SIZE,  // the size of the (dynamic) buffer tree
+template <int NUM_TREES,         // the number of static trees reserved up front, see [levels]
+          int BUFFER_LOG2_SIZE,  // the default size of the (dynamic) buffer tree
           int dim,
           class objT,
           bool parallel,  // defaults in kdtree.h forward decl
@@ -85,81 +82,216 @@ class LogTree {
 #ifdef LOGTREE_USE_BLOOM
   typedef BloomFilter<dim> BloomFilterT;
 #endif
-  static const size_t BUFFER_SIZE = (1 << BUFFER_LOG2_SIZE);
 
-  int tree_mask;  // represent whether the static trees are full or not
-  dynamicTree buffer_tree;
+  // a level of the forest: a static tree and, with LOGTREE_USE_BLOOM, its filter
+  struct level {
+    staticTree tree;
 #ifdef LOGTREE_USE_BLOOM
-  BloomFilterT buffer_bloom_filter;
+    BloomFilterT bloom_filter;
+#endif
+    explicit level(int log2size)
+#if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
+        : tree(log2size)
+#elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
+        : tree(log2size, false)
 #endif
-
-  // TODO: make sure this is on individual cache lines
-  staticTree* static_trees;  // TODO: maybe use a vector?
 #ifdef LOGTREE_USE_BLOOM
-  BloomFilterT* static_bloom_filters;
+          ,
+          bloom_filter(1 << log2size)
 #endif
-
-  static inline int nth_tree_log2size(int n) {
-    assert(n < NUM_TREES);
-    return (n + BUFFER_LOG2_SIZE);
-  }
-  // TODO: make this size_t
-  static inline size_t nth_tree_size(int n) { return 1 << nth_tree_log2size(n); }
-  static inline bool nth_bit_set(int x, int n) { return (x >> n) % 2; }
-  static inline void set_nth_bit(int& x, int n) { x |= (1 << n); }
-  static inline void unset_nth_bit(int& x, int n) { x &= ~(1 << n); }
-
- public:
-#ifdef ERASE_SEARCH_TIMES
-  double total_search_time = 0;
-  double total_bbox_time = 0;
-  double total_leaf_time = 0;
+    {
+    }
+    // a copy in fresh storage (see KdTree::copyFrom)
+    level(const level& other)
+#if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
+        : tree(log2Capacity(other.tree.capacity()))
+#elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
+        : tree(log2Capacity(other.tree.capacity()), false)
 #endif
-  static constexpr bool coarsen_ = coarsen;
-  LogTree()
-      : tree_mask(0),
-        buffer_tree(BUFFER_LOG2_SIZE, true)
 #ifdef LOGTREE_USE_BLOOM
-        ,
-        buffer_bloom_filter(1 << BUFFER_LOG2_SIZE)
+          ,
+          bloom_filter(other.bloom_filter)
 #endif
-  {
-    static_trees = (staticTree*)malloc(NUM_TREES * sizeof(staticTree));
+    {
+      tree.copyFrom(other.tree);
+    }
+  };
+  struct bufferLevel {
+    dynamicTree tree;
 #ifdef LOGTREE_USE_BLOOM
-    static_bloom_filters = (BloomFilterT*)malloc(NUM_TREES * sizeof(BloomFilterT));
-#endif
-    for (int i = 0; i < NUM_TREES; i++) {
-      auto curlog2size = nth_tree_log2size(i);
-#if (PARTITION_TYPE == PARTITION_OBJECT_MEDIAN)
-      new (&static_trees[i]) staticTree(curlog2size);
-#elif (PARTITION_TYPE == PARTITION_SPATIAL_MEDIAN)
-      new (&static_trees[i]) staticTree(curlog2size, false);
+    BloomFilterT bloom_filter;
 #endif
+    explicit bufferLevel(int log2size)
+        : tree(log2size, true)
 #ifdef LOGTREE_USE_BLOOM
-      new (&static_bloom_filters[i]) BloomFilterT(1 << curlog2size);
+          ,
+          bloom_filter(1 << log2size)
 #endif
+    {
     }
+    bufferLevel(const bufferLevel&) = delete;
+  };
+
+  mergePolicy policy;   // how the static trees are grouped in levels and merged
+  int buffer_log2size;  // the buffer holds up to 2^buffer_log2size points
+  // The buffer and the levels are held through shared pointers, so a copy of the tree shares all
+  // of their storage (see versioned.h). An update never writes to a shared level: it replaces it
+  // with a fresh one (see [takeLevel] and [writableLevel]), and the copy keeps the old contents.
+  // [levels] holds whole levels of the policy: it grows when a carry overflows the top level and
+  // drops the empty top levels after an erase.
+  std::shared_ptr<bufferLevel> buffer;
+  std::vector<std::shared_ptr<level>> levels;
+  // For objects with ids, where they are in the static trees (see [idLocator]); null until
+  // [locateIds] is called. Copies of the tree share it as well: its entries are only hints, checked
+  // against the levels of the tree using it, and they follow the copy holding the locator's current
+  // generation [locator_gen] (see [claimLocator]).
+  typedef idLocator<objT> locatorT;
+  std::shared_ptr<locatorT> locator;
+  uint64_t locator_gen = 0;
+
+  size_t bufferSize() const { return (size_t)1 << buffer_log2size; }
+  // whether static tree [i] holds points
+  bool inUse(size_t i) const { return !levels[i]->tree.empty(); }
+
+  // a static tree is sized to the run built in it
+  static inline int log2Capacity(size_t n) {
+    int ret = 0;
+    while (((size_t)1 << ret) < n)
+      ret++;
+    return ret;
   }
 
-  // hack to get treeTime to work
-  LogTree(__attribute__((unused)) int x) : LogTree() {}
-  template <class R>
-  LogTree(const R& points) : LogTree() {
-    insert(points);
+  // add empty static trees up to [num_trees], in whole levels
+  void growLevels(size_t num_trees) {
+    size_t runs = policy.runsPerLevel();
+    num_trees = (num_trees + runs - 1) / runs * runs;
+    while (levels.size() < num_trees)
+      levels.push_back(std::make_shared<level>(0));
   }
 
-  ~LogTree() {
-    for (int i = 0; i < NUM_TREES; i++) {
-      static_trees[i].~staticTree();  // destroy placement-new objects
+  // drop the empty levels at the top
+  void trimLevels() {
+    size_t runs = policy.runsPerLevel();
+    while (!levels.empty()) {
+      auto top = levels.end() - runs;
+      if (std::any_of(top, levels.end(), [](const auto& l) { return !l->tree.empty(); })) break;
+      levels.erase(top, levels.end());
+    }
+  }
 
+  // whether a copy of this tree holds [p] too; only the copying thread creates holders, so a
+  // count of 1 cannot race with a new reader. A count of 1 may follow another thread dropping its
+  // copy, so acquire before touching the level as its sole owner
+  template <class T>
+  static bool isShared(const std::shared_ptr<T>& p) {
+    if (p.use_count() > 1) return true;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return false;
+  }
+
+  /*!
+   * Move the live points of level [i] into [dest] and leave the level empty, with its storage
+   * released. A shared level is copied out and replaced by a fresh empty level instead.
+   */
+  size_t takeLevel(int i, parlay::slice<objT*, objT*> dest) {
+    if (isShared(levels[i])) {
+      auto ret = levels[i]->tree.copyElementsTo(dest);
+      levels[i] = std::make_shared<level>(0);
+      return ret;
+    }
+    auto ret = levels[i]->tree.moveElementsTo(dest);
+    levels[i]->tree.release();  // the level is empty until the next cascade
 #ifdef LOGTREE_USE_BLOOM
-      static_bloom_filters[i].~BloomFilterT();
+    levels[i]->bloom_filter.release();
 #endif
+    return ret;
+  }
+
+  // Same as above for the buffer, which keeps its storage
+  size_t takeBuffer(parlay::slice<objT*, objT*> dest) {
+    if (isShared(buffer)) {
+      auto ret = buffer->tree.copyElementsTo(dest);
+      buffer = std::make_shared<bufferLevel>(buffer_log2size);
+      return ret;
     }
-    free(static_trees);
+    auto ret = buffer->tree.moveElementsTo(dest);
+#ifdef LOGTREE_USE_BLOOM
+    buffer->bloom_filter.clear();
+#endif
+    return ret;
+  }
+
+  // build the empty level [i] (and its filter) over [items], in fresh storage if it is shared or
+  // sized for a different run
+  void buildLevel(int i, parlay::sequence<objT>&& items) {
+    assert(levels[i]->tree.empty());
+    auto log2size = log2Capacity(items.size());
+    if (isShared(levels[i]) || levels[i]->tree.capacity() != ((size_t)1 << log2size))
+      levels[i] = std::make_shared<level>(log2size);
+    levels[i]->tree.build(std::move(items));
 #ifdef LOGTREE_USE_BLOOM
-    free(static_bloom_filters);
+    levels[i]->bloom_filter.build(levels[i]->tree.items);
 #endif
+    if (locator) locator->refresh(i, levels[i]->tree.getItems().first);
+  }
+
+  // add [points] to the buffer (and its filter)
+  template <class R>
+  void fillBuffer(const R& points) {
+    assert(!isShared(buffer));
+#ifdef LOGTREE_USE_BLOOM
+    parlay::par_do([&]() { buffer->tree.insert(points); },
+                   [&]() { buffer->bloom_filter.insert(points); });
+#else
+    buffer->tree.insert(points);
+#endif
+  }
+
+  // level [i], copied into fresh storage first if it is shared
+  staticTree& writableLevel(int i) {
+    if (isShared(levels[i])) levels[i] = std::make_shared<level>(*levels[i]);
+    return levels[i]->tree;
+  }
+
+  // the buffer, copied into fresh storage first if it is shared
+  dynamicTree& writableBuffer() {
+    if (isShared(buffer)) {
+      parlay::sequence<objT> items(buffer->tree.size());
+      takeBuffer(items.cut(0, items.size()));
+      const auto& const_items = items;
+      fillBuffer(const_items.cut(0, const_items.size()));
+    }
+    return buffer->tree;
+  }
+
+ public:
+#ifdef ERASE_SEARCH_TIMES
+  double total_search_time = 0;
+  double total_bbox_time = 0;
+  double total_leaf_time = 0;
+#endif
+  static constexpr bool coarsen_ = coarsen;
+  typedef objT objT_;
+  typedef pointT pointT_;
+  // the static trees are added as the tree grows
+  explicit LogTree(const mergePolicy& policy_, int buffer_log2size_ = BUFFER_LOG2_SIZE)
+      : policy(policy_),
+        buffer_log2size(buffer_log2size_),
+        buffer((buffer_log2size_ >= 0 && buffer_log2size_ < 31)
+                   ? std::make_shared<bufferLevel>(buffer_log2size_)
+                   : throw std::runtime_error("Invalid buffer log2 size: " +
+                                              std::to_string(buffer_log2size_))) {
+    levels.reserve(NUM_TREES);
+  }
+  LogTree() : LogTree(mergePolicy()) {}
+  // O(number of static trees): the copy shares the buffer and every level with [other]
+  LogTree(const LogTree& other) = default;
+
+  // hack to get treeTime to work
+  LogTree(__attribute__((unused)) int x) : LogTree() {}
+  template <class R>
+  LogTree(const R& points) : LogTree() {
+    insert(points);
   }
 
   // MODIFY -----------------------------------------
@@ -172,15 +304,18 @@ class LogTree {
 #if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_INSERT_TIMINGS)
     timer t("[Insert]");
 #endif
+    if (locator) locator->checkIds(points);  // before anything is moved
+
     // compute number of moving elements in terms of buffers
-    int full_buffers = (int)(points.size() / BUFFER_SIZE);
-    int remainder = (int)(points.size() % BUFFER_SIZE);
+    const size_t BUFFER_SIZE = bufferSize();
+    size_t full_buffers = points.size() / BUFFER_SIZE;
+    size_t remainder = points.size() % BUFFER_SIZE;
     bool use_buffer = false;
 
     // check if buffer is involved
-    if (remainder + buffer_tree.size() > BUFFER_SIZE) {
+    if (remainder + buffer->tree.size() > BUFFER_SIZE) {
       full_buffers++;
-      remainder = (remainder + buffer_tree.size()) - BUFFER_SIZE;
+      remainder = (remainder + buffer->tree.size()) - BUFFER_SIZE;
       use_buffer = true;
     }
 
@@ -188,111 +323,58 @@ class LogTree {
     DEBUG_MSG("full buffers, remainder, use_buffer = " << full_buffers << ", " << remainder << ", "
                                                        << (use_buffer ? "true" : "false"));
 
-    // simulate which trees to gather
+    // simulate which trees to gather, see [mergePolicy::plan]
+    std::vector<size_t> slot_sizes(levels.size());
+    for (size_t i = 0; i < levels.size(); i++)
+      slot_sizes[i] = levels[i]->tree.size();
+    auto plan = policy.plan(slot_sizes, BUFFER_SIZE, full_buffers, use_buffer, buffer->tree.size());
+    for (const auto& m : plan)
+      growLevels(m.target + 1);  // the carries may have reached new levels
+
     // <buffer, points_start, points_end, gather trees, new tree>
     parlay::sequence<std::tuple<bool, size_t, size_t, parlay::sequence<int>, int>> moves;
     auto cur_points_end = points.size();
     bool have_used_buffer = false;
-    auto new_tree_mask = tree_mask + full_buffers;
-    DEBUG_MSG(treeMaskToString<NUM_TREES>(tree_mask) << "\n"
-                                                     << treeMaskToString<NUM_TREES>(new_tree_mask));
-
-    for (int i = NUM_TREES - 1; i >= 0;) {
-      if (nth_bit_set(new_tree_mask, i) && !nth_bit_set(tree_mask, i)) {
-        DEBUG_MSG("New Tree: " << i);
-        // tree [i] was not filled before but is now
-
-        // gather all the smaller trees
-        parlay::sequence<int> to_gather;
-        size_t size_gathered = 0;
-        int j = i - 1;
-        while (j >= 0) {
-          if (nth_bit_set(new_tree_mask, j)) {
-            if (nth_bit_set(tree_mask, j)) {
-              DEBUG_MSG(" - Skipping Tree (11)" << j);
-            } else {
-              break;
-            }
-
-          } else {
-            if (nth_bit_set(tree_mask, j)) {
-              DEBUG_MSG(" - Gathering Tree " << j);
-              to_gather.push_back(j);
-              size_gathered += nth_tree_size(j);
-            } else {
-              DEBUG_MSG(" - Skipping Tree (00)" << j);
-            }
-          }
-          j--;
-        }
-
-        auto num_from_points = nth_tree_size(i) - size_gathered;
-        full_buffers -= (num_from_points / BUFFER_SIZE);
-        DEBUG_MSG("num_from_points: " << num_from_points);
-
-        bool cur_uses_buffer = false;
-        if (use_buffer && (full_buffers == 0)) {
-          assert(!have_used_buffer);
-          have_used_buffer = true;
-          DEBUG_MSG(" - Gathering Buffer Tree ");
-          cur_uses_buffer = true;
-          num_from_points -= buffer_tree.size();  // we moved buffer tree in
-        }
-
-        auto cur_points_start = cur_points_end - num_from_points;
-        DEBUG_MSG("MOVE: [uses_buffer, point start, point end, trees, new tree] = ["
-                  << (cur_uses_buffer ? "true" : "false") << ", " << cur_points_start << ", "
-                  << cur_points_end << ", " << seq_to_str(to_gather) << ", " << i << "]");
-        moves.push_back(
-            {cur_uses_buffer, cur_points_start, cur_points_end, std::move(to_gather), i});
-
-        // reset counters
-        cur_points_end = cur_points_start;
-        i = j;
-      } else {  // otherwise, should be the same
-        assert(nth_bit_set(new_tree_mask, i) == nth_bit_set(tree_mask, i));
-        i--;
-      }
+    for (const auto& m : plan) {
+      auto cur_points_start = cur_points_end - m.new_points;
+      parlay::sequence<int> to_gather(m.slots.begin(), m.slots.end());
+      DEBUG_MSG("MOVE: [uses_buffer, point start, point end, trees, new tree] = ["
+                << (m.uses_buffer ? "true" : "false") << ", " << cur_points_start << ", "
+                << cur_points_end << ", " << seq_to_str(to_gather) << ", " << m.target << "]");
+      have_used_buffer |= m.uses_buffer;
+      moves.push_back(
+          {m.uses_buffer, cur_points_start, cur_points_end, std::move(to_gather), m.target});
+      cur_points_end = cur_points_start;
     }
-    assert(cur_points_end == (size_t)remainder);
-
-    // safety assertion, should remove later for release
-    if (full_buffers != 0)
-      throw std::runtime_error("Not enough trees! : full_buffers = " +
-                               std::to_string(full_buffers));
+    assert(cur_points_end == remainder);
+    assert(have_used_buffer == use_buffer);
 
 #if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_INSERT_TIMINGS)
     std::cout << "[Insert] Serial Computation: " << t.get_next() << "\n";
 #endif
     // REBUILD THE TREES -----------------------------
+    if (!moves.empty()) claimLocator();  // the static trees built below are located
 
     // need to serially empty buffer if it's used
     parlay::sequence<objT> buffer_points;
     if (have_used_buffer) {
-      buffer_points.resize(buffer_tree.size());
-      buffer_tree.moveElementsTo(buffer_points.cut(0, buffer_points.size()));
-
-#ifdef LOGTREE_USE_BLOOM
-      buffer_bloom_filter.clear();
-#endif
+      buffer_points.resize(buffer->tree.size());
+      takeBuffer(buffer_points.cut(0, buffer_points.size()));
     }
 
     // insert remainder into buffer
     auto fill_buff_f = [&]() {
-#ifdef LOGTREE_USE_BLOOM
-      parlay::par_do([&]() { buffer_tree.insert(points.cut(0, remainder)); },
-                     [&]() { buffer_bloom_filter.insert(points.cut(0, remainder)); });
-#else
-      buffer_tree.insert(points.cut(0, remainder));
-#endif
+      if (remainder == 0) return;
+      writableBuffer();
+      fillBuffer(points.cut(0, remainder));
     };
-    // use the simulated moves above to construct new trees
-    auto rebuild_static_f = [&](size_t i) {
+    // use the simulated moves above to gather the items of the new trees; every move gathers
+    // before any is built, since a new tree may go in a slot that another move empties
+    parlay::sequence<parlay::sequence<objT>> new_items(moves.size());
+    auto gather_static_f = [&](size_t i) {
       const auto& [uses_buffer, points_start, points_end, trees, new_tree] = moves[i];
       auto num_points = points_end - points_start;
-
-      // gather items
-      parlay::sequence<objT> cur_items;
+      auto& cur_items = new_items[i];
 
       // compute where each set of elements goes into [cur_items]
       parlay::sequence<size_t> gather_endpoints;
@@ -300,7 +382,7 @@ class LogTree {
       int cur_idx = 0;
       gather_endpoints[cur_idx++] = 0;                          // left endpoint
       for (int j = 0; j < (int)trees.size(); j++, cur_idx++) {  // tree endpoints
-        gather_endpoints[cur_idx] = static_trees[trees[j]].size() + gather_endpoints[cur_idx - 1];
+        gather_endpoints[cur_idx] = levels[trees[j]]->tree.size() + gather_endpoints[cur_idx - 1];
       }
       gather_endpoints[cur_idx] = num_points + gather_endpoints[cur_idx - 1];
       cur_idx++;
@@ -341,11 +423,9 @@ class LogTree {
         } else {
           // [0, num_trees) -> move a tree
           auto tree_idx = trees[idx];
-          assert(((int)tree_idx < new_tree));
           assert(gather_endpoints[idx + 1] - gather_endpoints[idx] ==
-                 static_trees[tree_idx].size());
-          static_trees[tree_idx].moveElementsTo(
-              cur_items.cut(gather_endpoints[idx], gather_endpoints[idx + 1]));
+                 levels[tree_idx]->tree.size());
+          takeLevel(tree_idx, cur_items.cut(gather_endpoints[idx], gather_endpoints[idx + 1]));
         }
       };
 
@@ -355,40 +435,23 @@ class LogTree {
         for (size_t idx = 0; idx < gather_endpoints.size() - 1; idx++)
           construct_points(idx);
       }
-      //#if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_INSERT_TIMINGS)
-      // if (new_tree == 16) {
-      // std::cout << "(16) Point Gather: " << t.get_next() << "\n";
-      //}
-      //#endif
-
-      // construct the new tree
-      assert(static_trees[new_tree].empty());
-      DEBUG_MSG("CONSTRUCTING TREE[" << new_tree << "]: " << cur_items.size() << " items");
+    };
+    // construct the new trees
+    auto rebuild_static_f = [&](size_t i) {
+      auto new_tree = std::get<4>(moves[i]);
+      assert(levels[new_tree]->tree.empty());
+      DEBUG_MSG("CONSTRUCTING TREE[" << new_tree << "]: " << new_items[i].size() << " items");
 
-#ifdef LOGTREE_USE_BLOOM
-#ifdef BLOOM_FILTER_BUILD_COPY
-      auto items_copy = cur_items;
-      parlay::par_do([&]() { static_trees[new_tree].build(std::move(cur_items)); },
-                     [&]() { static_bloom_filters[new_tree].build(items_copy); });
-#else
-      static_trees[new_tree].build(std::move(cur_items));
-      static_bloom_filters[new_tree].build(static_trees[new_tree].items);
-#endif
-#else
-      static_trees[new_tree].build(std::move(cur_items));
-#endif
+      // the items are moved into the level; its filter is built over the same array afterwards
+      buildLevel(new_tree, std::move(new_items[i]));
 
 #if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_INSERT_TIMINGS)
       std::cout << "[Insert] Tree[" << new_tree << "] Construction Time: " << t.get_next() << "\n";
 #endif
-      //#if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_INSERT_TIMINGS)
-      // if (new_tree == 16) {
-      // std::cout << "(16) Tree Build: " << t.get_next() << "\n";
-      //}
-      //#endif
     };
 
     if (parallel) {
+      parlay::parallel_for(0, moves.size(), gather_static_f, 1);
       parlay::parallel_for(
           0,
           moves.size() + 1,
@@ -402,14 +465,12 @@ class LogTree {
     } else {
       fill_buff_f();
       // rebuild the static trees
-      for (int i = 0; i < (int)moves.size(); i++) {
+      for (size_t i = 0; i < moves.size(); i++)
+        gather_static_f(i);
+      for (size_t i = 0; i < moves.size(); i++)
         rebuild_static_f(i);
-      }
     }
 
-    // update tree mask
-    tree_mask = new_tree_mask;
-
 #if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_INSERT_TIMINGS)
     std::cout << "[Insert] Build: " << t.get_next() << "\n";
     t.reportTotal("Total");
@@ -417,8 +478,99 @@ class LogTree {
 #endif
   }
 
+  // make the locator follow the levels of this tree before they are looked up or rebuilt through
+  // it: a copy of the tree that claimed the shared locator since leaves this one a locator of its
+  // own, at the cost of locating all its objects again
+  void claimLocator() {
+    if constexpr (locatorT::enabled) {
+      if (locator && !locator->claim(locator_gen)) locateIds(locator->idBound());
+    }
+  }
+
+  // the (static tree, item index) of the object with id [id] according to the locator, if it is
+  // present there and [match]es; (-1, 0) otherwise
+  template <class idT, class F>
+  std::pair<int, size_t> locate(idT id, F match) const {
+    auto loc = locator->find(id);
+    if (loc.tree < 0 || loc.tree >= (int)levels.size()) return {-1, 0};
+    auto [items, present] = levels[loc.tree]->tree.getItems();
+    if (loc.idx >= items.size() || !present[loc.idx] || !match(items[loc.idx])) return {-1, 0};
+    return {loc.tree, loc.idx};
+  }
+
+  /*!
+   * Erase the objects of [keys] (objects or ids) that the locator finds in the static trees,
+   * straight from their leaves: [id_of] gives the id of a key and [match] checks a located item
+   * against it. The located items are grouped by static tree, and the trees are erased from in
+   * parallel; a group large enough to erase in parallel (see [eraseInParallel]) goes through one
+   * [bulk_erase] pass instead of a walk from the root per item.
+   * Returns the keys that were not found.
+   */
+  template <class K, class I, class F>
+  parlay::sequence<K> eraseLocated(const parlay::sequence<K>& keys, I id_of, F match) {
+    claimLocator();
+    auto locs = parlay::tabulate(keys.size(), [&](size_t i) {
+      return locate(id_of(keys[i]), [&](const objT& item) { return match(keys[i], item); });
+    });
+
+    // sort the locations by (tree, index), once each, and find where the trees start
+    auto found = parlay::filter(locs, [](const auto& loc) { return loc.first >= 0; });
+    parlay::sort_inplace(found);
+    auto distinct = parlay::pack_index(parlay::delayed_seq<bool>(
+        found.size(), [&](size_t i) { return i == 0 || found[i] != found[i - 1]; }));
+    found = parlay::tabulate(distinct.size(), [&](size_t i) { return found[distinct[i]]; });
+    auto starts = parlay::pack_index(parlay::delayed_seq<bool>(
+        found.size(), [&](size_t i) { return i == 0 || found[i].first != found[i - 1].first; }));
+
+    auto erase_group = [&](size_t g) {
+      size_t s = starts[g], e = (g + 1 < starts.size()) ? starts[g + 1] : found.size();
+      // a shared tree is copied first, with its items at the same indices
+      auto& tree = writableLevel(found[s].first);
+      if (eraseInParallel(e - s)) {
+        auto items = tree.getItems().first;
+        auto to_erase =
+            parlay::tabulate(e - s, [&](size_t i) { return items[found[s + i].second]; });
+        auto size = tree.size();
+        tree.template bulk_erase<false>(to_erase);
+        // the search can miss an item whose coordinate equals a split value: those are erased by
+        // index below (and the others are skipped, as they are no longer present)
+        if (size - tree.size() == e - s) return;
+      }
+      for (size_t i = s; i < e; i++)
+        tree.template eraseAt<true>(found[i].second);
+    };
+    if (parallel) {
+      parlay::parallel_for(0, starts.size(), erase_group, 1);
+    } else {
+      for (size_t g = 0; g < starts.size(); g++)
+        erase_group(g);
+    }
+
+    auto rest = parlay::pack_index(parlay::delayed_seq<bool>(
+        keys.size(), [&](size_t i) { return locs[i].first < 0; }));
+    return parlay::tabulate(rest.size(), [&](size_t i) { return keys[rest[i]]; });
+  }
+
+  // Erase [points] from every tree, then take the depleted trees and return their points, to be
+  // reinserted by the caller. The objects found by the locator skip the search.
   template <bool bulk, class R>
-  void erase(const R& points) {
+  parlay::sequence<objT> eraseAndTakeDepleted(const R& points) {
+    if constexpr (locatorT::enabled) {
+      if (locator) {
+        auto rest = eraseLocated(
+            parlay::sequence<objT>(points.begin(), points.end()),
+            [](const objT& p) { return p.id; },
+            [](const objT& p, const objT& item) { return item == p; });
+        if (!rest.empty()) eraseFromTrees<bulk>(rest);
+        return takeDepleted();
+      }
+    }
+    eraseFromTrees<bulk>(points);
+    return takeDepleted();
+  }
+
+  template <bool bulk, class R>
+  void eraseFromTrees(const R& points) {
     constexpr int BUFFER_TREE_IDX = -1;
     auto tree_ids = gatherFullTrees();
     // PHASE 1: Erase points from trees ----------------------
@@ -430,14 +582,14 @@ class LogTree {
       timer t("[Delete]");
 #endif
 
-      parlay::sequence<pointT> to_erase;
+      parlay::sequence<objT> to_erase;
 #ifdef LOGTREE_USE_BLOOM
       if (i == BUFFER_TREE_IDX)
-        to_erase = buffer_bloom_filter.filter(points);
+        to_erase = buffer->bloom_filter.filter(points);
       else
-        to_erase = static_bloom_filters[i].filter(points);
+        to_erase = levels[i]->bloom_filter.filter(points);
 #else
-      to_erase = points;
+      to_erase.assign(points.begin(), points.end());
 #endif
 
 #if defined(PRINT_LOGTREE_TIMINGS) && defined(PRINT_DELETE_TIMINGS)
@@ -446,23 +598,31 @@ class LogTree {
       ss << "         -> " << to_erase.size() << " / " << points.size() << std::endl;
 #endif
 
+      // a tree shared with a snapshot is only copied if it holds one of the points
+      auto holds_any = [&](const auto& tree) {
+        return parlay::count_if(to_erase, [&](const objT& p) { return tree.contains(p); }) > 0;
+      };
+      if (i == BUFFER_TREE_IDX ? (isShared(buffer) && !holds_any(buffer->tree))
+                               : (isShared(levels[i]) && !holds_any(levels[i]->tree)))
+        return;
+
       if (bulk) {
         if (i == BUFFER_TREE_IDX) {
-          buffer_tree.template bulk_erase<false>(to_erase);
+          writableBuffer().template bulk_erase<false>(to_erase);
 #ifdef ERASE_SEARCH_TIMES
-          total_search_time += buffer_tree.total_search_time;
+          total_search_time += buffer->tree.total_search_time;
 #endif
         } else {
-          static_trees[i].template bulk_erase<false>(to_erase);
+          writableLevel(i).template bulk_erase<false>(to_erase);
 #ifdef ERASE_SEARCH_TIMES
-          total_search_time += static_trees[i].total_search_time;
+          total_search_time += levels[i]->tree.total_search_time;
 #endif
         }
       } else {
         if (i == BUFFER_TREE_IDX) {
-          buffer_tree.template erase<true>(to_erase);
+          writableBuffer().template erase<true>(to_erase);
         } else {
-          static_trees[i].template erase<true>(to_erase);
+          writableLevel(i).template erase<true>(to_erase);
         }
       }
 
@@ -479,30 +639,31 @@ class LogTree {
         erase_from_tree(i);
       }
     }
+  }
 
+  // take the depleted trees and return their points
+  parlay::sequence<objT> takeDepleted() {
     // PHASE 2: Collect all depleted trees
-    // compute depleted trees
+    // compute depleted trees: those that lost half of the points they were built with. Under any
+    // [mergePolicy], their points are pushed down by reinserting them. Empty slots are skipped.
     parlay::sequence<size_t> gather_points;
     parlay::sequence<int> depleted_trees;
-    auto new_tree_mask = tree_mask;
     gather_points.push_back(0);  // initialize
-    for (int i = 0; i < NUM_TREES; i++) {
-      if (static_trees[i].size() <= nth_tree_size(i) / 2) {
+    for (int i = 0; i < (int)levels.size(); i++) {
+      auto build_size = levels[i]->tree.get_build_size();
+      if (build_size > 0 && levels[i]->tree.size() <= build_size / 2) {
         // need to push down
         depleted_trees.push_back(i);
-        gather_points.push_back(gather_points.back() + static_trees[i].size());
-        unset_nth_bit(new_tree_mask, i);
+        gather_points.push_back(gather_points.back() + levels[i]->tree.size());
       }
     }
-    tree_mask = new_tree_mask;
 
     // gather depleted trees
     parlay::sequence<objT> points_to_move(gather_points.back());
     auto gather_tree = [&](size_t i) {
       auto tree_idx = depleted_trees[i];
-      assert(static_trees[tree_idx].size() == gather_points[i + 1] - gather_points[i]);
-      static_trees[tree_idx].moveElementsTo(
-          points_to_move.cut(gather_points[i], gather_points[i + 1]));
+      assert(levels[tree_idx]->tree.size() == gather_points[i + 1] - gather_points[i]);
+      takeLevel(tree_idx, points_to_move.cut(gather_points[i], gather_points[i + 1]));
     };
     if (parallel) {
       parlay::parallel_for(0, depleted_trees.size(), gather_tree);
@@ -510,9 +671,15 @@ class LogTree {
       for (size_t i = 0; i < depleted_trees.size(); i++)
         gather_tree(i);
     }
+    return points_to_move;
+  }
 
+  template <bool bulk, class R>
+  void erase(const R& points) {
+    auto points_to_move = eraseAndTakeDepleted<bulk>(points);
     // reinsert them
     insert(points_to_move);
+    trimLevels();
   }
 
   template <class R>
@@ -520,6 +687,76 @@ class LogTree {
     erase<true, R>(points);
   }
 
+  /*!
+   * Keep a locator for the ids below [id_bound] ([objT] must carry ids, see object.h), and locate
+   * the objects already in the static trees. From then on, [insert] throws on an id at or above the
+   * bound, and [erase] and [eraseIds] find the located objects without a search. The locator takes
+   * O([id_bound]) space, so the ids should be dense (see [idLocator]).
+   * Throws if an object already in the tree has an id at or above the bound.
+   */
+  void locateIds(size_t id_bound) {
+    static_assert(locatorT::enabled, "locateIds needs objects with ids");
+    auto next = std::make_shared<locatorT>(id_bound);
+    parlay::sequence<objT> items(buffer->tree.size());
+    buffer->tree.copyElementsTo(items.cut(0, items.size()));
+    next->checkIds(items);  // built into a static tree by a later insert
+    for (const auto& l : levels)
+      next->checkIds(l->tree.getItems().first);
+    for (size_t i = 0; i < levels.size(); i++)
+      next->refresh(i, levels[i]->tree.getItems().first);
+    locator_gen = next->generation();
+    locator = std::move(next);
+  }
+
+  // throws if the locator cannot hold the ids of [objects], as [insert] would (see [locateIds])
+  template <class R>
+  void checkIds(const R& objects) const {
+    if (locator) locator->checkIds(objects);
+  }
+
+  /*!
+   * Erase the objects with the given ids; the tree must keep a locator (see [locateIds]), or this
+   * throws. The objects of the static trees are found through the locator and erased straight
+   * from their leaves, with no search and no filter probe; the others are looked for in the buffer
+   * only, so the ids are expected to be unique (see [idLocator]).
+   */
+  template <class idT>
+  void eraseIds(const parlay::sequence<idT>& ids) {
+    static_assert(locatorT::enabled, "eraseIds needs objects with ids");
+    if (!locator) throw std::runtime_error("eraseIds needs an id locator, see locateIds");
+    auto rest = eraseLocated(
+        ids, [](idT id) { return id; }, [](idT id, const objT& item) { return item.id == id; });
+
+    if (!rest.empty() && !buffer->tree.empty()) {
+      std::sort(rest.begin(), rest.end());
+      parlay::sequence<objT> items(buffer->tree.size());
+      buffer->tree.copyElementsTo(items.cut(0, items.size()));
+      auto found = parlay::filter(items, [&](const objT& item) {
+        return std::binary_search(rest.begin(), rest.end(), item.id);
+      });
+      if (!found.empty()) writableBuffer().template bulk_erase<false>(found);
+    }
+
+    auto points_to_move = takeDepleted();
+    insert(points_to_move);
+    trimLevels();
+  }
+
+  /*!
+   * Erase [deletes], then insert [inserts], e.g. the old and new positions of moving points. The
+   * deletions are applied to every tree first; the points of the trees they deplete and [inserts]
+   * then go through a single [mergePolicy::plan], so each static tree is rebuilt at most once
+   * (an erase followed by an insert can rebuild the same tree twice).
+   */
+  template <bool bulk = true, class R1, class R2>
+  void update(const R1& inserts, const R2& deletes) {
+    if (locator) locator->checkIds(inserts);  // before anything is erased
+    auto points = eraseAndTakeDepleted<bulk>(deletes);
+    points.append(inserts);
+    insert(points);
+    trimLevels();
+  }
+
   /*
   // TODO: deduplicate points in bulk erase
   template <bool bulk>
@@ -528,21 +765,21 @@ class LogTree {
     parlay::sequence<int> delete_counts(NUM_TREES + 1);
 
     auto erase_from_tree = [&](size_t i) {
-      auto orig_size = (i == NUM_TREES) ? buffer_tree.size() : static_trees[i].size();
+      auto orig_size = (i == NUM_TREES) ? buffer->tree.size() : levels[i]->tree.size();
       if (bulk) {
         if (i == NUM_TREES) {
-          buffer_tree.template bulk_erase<false>(points);
+          buffer->tree.template bulk_erase<false>(points);
         } else {
-          static_trees[i].template bulk_erase<false>(points);
+          levels[i]->tree.template bulk_erase<false>(points);
         }
       } else {
         if (i == NUM_TREES) {
-          buffer_tree.template erase<true>(points);
+          buffer->tree.template erase<true>(points);
         } else {
-          static_trees[i].template erase<true>(points);
+          levels[i]->tree.template erase<true>(points);
         }
       }
-      auto new_size = (i == NUM_TREES) ? buffer_tree.size() : static_trees[i].size();
+      auto new_size = (i == NUM_TREES) ? buffer->tree.size() : levels[i]->tree.size();
       delete_counts[i] = orig_size - new_size;
     };
 
@@ -575,7 +812,7 @@ class LogTree {
       if (!nth_bit_set(new_tree_mask, i)) continue;
       if (delete_counts[i] == 0) continue;
 
-      auto new_size = static_trees[i].size();
+      auto new_size = levels[i]->tree.size();
       if (new_size > nth_tree_size(i) / 2) {
 #ifndef NDEBUG
         changes.emplace_back(NORMAL_ERASE, i);  // only record a normal erase for debugging
@@ -583,7 +820,7 @@ class LogTree {
       } else {
         if (i == 0) {                               // special case: have to think about buffer tree
           auto cutoff = BUFFER_SIZE - new_size;     // how much tree 0 needs to be full
-          if ((int)buffer_tree.size() <= cutoff) {  // buffer doesn't have enough -> move 0 down
+          if ((int)buffer->tree.size() <= cutoff) {  // buffer doesn't have enough -> move 0 down
             changes.emplace_back(MOVE_DOWN, i);
             unset_nth_bit(new_tree_mask, i);
           } else {  // buffer has enough -> move enough up to fill 0
@@ -622,7 +859,7 @@ class LogTree {
                   << ((p.second >= 0) ? nth_tree_size(p.second) : BUFFER_SIZE) << " points"
                   << std::endl;
       } else if (p.first == MOVE_DOWN) {
-        auto new_size = static_trees[p.second].size();
+        auto new_size = levels[p.second]->tree.size();
         auto cur_size = new_size + delete_counts[p.second];
         auto full_size = nth_tree_size(p.second);
         std::cout << "MOVE_DOWN[" << p.second << " -> " << p.second - 1 << "]: " << cur_size
@@ -642,17 +879,17 @@ class LogTree {
       } else if (p.first == MOVE_DOWN) {
         assert((p.second >= 0) && (p.second < NUM_TREES));
         // pull the elements out
-        parlay::sequence<objT> items_to_move(static_trees[p.second].size());
+        parlay::sequence<objT> items_to_move(levels[p.second]->tree.size());
         [[maybe_unused]] auto num_moved =
-            static_trees[p.second].moveElementsTo(items_to_move.cut(0, items_to_move.size()));
+            levels[p.second]->tree.moveElementsTo(items_to_move.cut(0, items_to_move.size()));
         assert(num_moved == items_to_move.size());
         if (p.second == 0) {
-          assert(buffer_tree.size() + items_to_move.size() <= BUFFER_SIZE);
+          assert(buffer->tree.size() + items_to_move.size() <= BUFFER_SIZE);
           const auto& const_items = items_to_move;
-          buffer_tree.insert(const_items.cut(0, const_items.size()));
+          buffer->tree.insert(const_items.cut(0, const_items.size()));
         } else {
-          assert(static_trees[p.second - 1].empty());
-          static_trees[p.second - 1].build(std::move(items_to_move));
+          assert(levels[p.second - 1]->tree.empty());
+          levels[p.second - 1]->tree.build(std::move(items_to_move));
         }
       } else {  // need to gather all the points
         // PHASE 1: compute size to move (serial because <= NUM_TREES trees total) -------
@@ -664,7 +901,7 @@ class LogTree {
           if (idx == DYNAMIC_BUFFER) {
             to_add = move_from_buffer;
           } else {
-            to_add = static_trees[idx].size();
+            to_add = levels[idx]->tree.size();
           }
           move_offsets[idx - p.first + 1] = move_offsets[idx - p.first] + to_add;
         }
@@ -677,13 +914,13 @@ class LogTree {
           int idx = (int)i - 1;
           if (idx == DYNAMIC_BUFFER) {
             // get buffer elements
-            parlay::sequence<objT> buffer_items(buffer_tree.size());
-            buffer_tree.moveElementsTo(buffer_items.cut(0, buffer_items.size()));
+            parlay::sequence<objT> buffer_items(buffer->tree.size());
+            buffer->tree.moveElementsTo(buffer_items.cut(0, buffer_items.size()));
 
             auto leave_behind = [&]() {
               // leave behind the extra elements
               const auto& const_buffer_items = buffer_items;
-              buffer_tree.insert(const_buffer_items.cut(move_from_buffer, buffer_items.size()));
+              buffer->tree.insert(const_buffer_items.cut(move_from_buffer, buffer_items.size()));
             };
 
             auto keep = [&]() {
@@ -704,8 +941,8 @@ class LogTree {
           } else {
             // gather the points
             assert(move_offsets[idx - p.first + 1] ==
-                   move_offsets[idx - p.first] + static_trees[idx].size());
-            static_trees[idx].moveElementsTo(
+                   move_offsets[idx - p.first] + levels[idx]->tree.size());
+            levels[idx]->tree.moveElementsTo(
                 items_to_move.cut(move_offsets[idx - p.first], move_offsets[idx - p.first + 1]));
           }
         };
@@ -719,7 +956,7 @@ class LogTree {
         }
 
         // move the elements
-        static_trees[p.second].build(std::move(items_to_move));
+        levels[p.second]->tree.build(std::move(items_to_move));
       }
     };
 
@@ -737,13 +974,14 @@ class LogTree {
 
   // QUERY -----------------------------------------
   bool contains(const objT& p) const {
+    const size_t num_trees = levels.size();
     if (parallel) {
-      parlay::sequence<bool> res(NUM_TREES + 1);
-      parlay::parallel_for(0, NUM_TREES + 1, [&](size_t i) {
-        if (i == NUM_TREES) {
-          res[i] = buffer_tree.contains(p);
+      parlay::sequence<bool> res(num_trees + 1);
+      parlay::parallel_for(0, num_trees + 1, [&](size_t i) {
+        if (i == num_trees) {
+          res[i] = buffer->tree.contains(p);
         } else {
-          res[i] = static_trees[i].contains(p);
+          res[i] = levels[i]->tree.contains(p);
         }
       });
 
@@ -752,33 +990,34 @@ class LogTree {
         if (b) return true;
       return false;
     } else {
-      if (buffer_tree.contains(p)) return true;
-      for (int i = 0; i < NUM_TREES; i++)
-        if (static_trees[i].contains(p)) return true;
+      if (buffer->tree.contains(p)) return true;
+      for (size_t i = 0; i < num_trees; i++)
+        if (levels[i]->tree.contains(p)) return true;
       return false;
     }
   }
 
-  parlay::sequence<objT> orthogonalQuery(const objT& qMin, const objT& qMax) const {
+  parlay::sequence<objT> orthogonalQuery(const pointT& qMin, const pointT& qMax) const {
+    const size_t num_trees = levels.size();
     if (parallel) {
-      parlay::sequence<parlay::sequence<objT>> res(NUM_TREES + 1);
-      parlay::parallel_for(0, NUM_TREES + 1, [&](size_t i) {
-        if (i == NUM_TREES) {
-          res[i] = buffer_tree.orthogonalQuery(qMin, qMax);
+      parlay::sequence<parlay::sequence<objT>> res(num_trees + 1);
+      parlay::parallel_for(0, num_trees + 1, [&](size_t i) {
+        if (i == num_trees) {
+          res[i] = buffer->tree.orthogonalQuery(qMin, qMax);
         } else {
-          res[i] = static_trees[i].orthogonalQuery(qMin, qMax);
+          res[i] = levels[i]->tree.orthogonalQuery(qMin, qMax);
         }
       });
 
       // result size
-      std::vector<size_t> offsets(NUM_TREES + 2);
+      std::vector<size_t> offsets(num_trees + 2);
       offsets[0] = 0;
-      for (int i = 1; i < NUM_TREES + 2; i++) {
+      for (size_t i = 1; i < num_trees + 2; i++) {
         offsets[i] = offsets[i - 1] + res[i - 1].size();
       }
 
       // reduce the result
-      parlay::sequence<objT> ret(offsets[NUM_TREES + 1]);
+      parlay::sequence<objT> ret(offsets[num_trees + 1]);
       parlay::parallel_for(0, res.size(), [&](size_t i) {
         assert(offsets[i + 1] - offsets[i] == res[i].size());
         parlay::parallel_for(0, res[i].size(), [&](size_t j) { ret[j + offsets[i]] = res[i][j]; });
@@ -786,31 +1025,200 @@ class LogTree {
       return ret;
     } else {
       parlay::sequence<objT> ret;
-      auto r = buffer_tree.orthogonalQuery(qMin, qMax);
+      auto r = buffer->tree.orthogonalQuery(qMin, qMax);
       ret.insert(ret.begin(), r.begin(), r.end());
-      for (int i = 0; i < NUM_TREES; i++) {
-        r = static_trees[i].orthogonalQuery(qMin, qMax);
+      for (size_t i = 0; i < num_trees; i++) {
+        r = levels[i]->tree.orthogonalQuery(qMin, qMax);
         ret.insert(ret.begin() + ret.size(), r.begin(), r.end());
       }
       return ret;
     }
   }
 
+  // the number of points in the box [qMin, qMax], without materializing them
+  size_t rangeCount(const pointT& qMin, const pointT& qMax) const {
+    size_t ret = buffer->tree.rangeCount(qMin, qMax);
+    for (const auto& l : levels)
+      ret += l->tree.rangeCount(qMin, qMax);
+    return ret;
+  }
+
+  // batched [rangeCount], in parallel across the boxes
+  parlay::sequence<size_t> rangeCount(const parlay::sequence<pointT>& qMins,
+                                      const parlay::sequence<pointT>& qMaxs) const {
+    assert(qMins.size() == qMaxs.size());
+    parlay::sequence<size_t> ret(qMins.size());
+    if (parallel) {
+      parlay::parallel_for(
+          0, qMins.size(), [&](size_t i) { ret[i] = rangeCount(qMins[i], qMaxs[i]); });
+    } else {
+      for (size_t i = 0; i < qMins.size(); i++)
+        ret[i] = rangeCount(qMins[i], qMaxs[i]);
+    }
+    return ret;
+  }
+
+  /*!
+   * Batched [orthogonalQuery], in parallel across the boxes: returns (offsets, results), where the
+   * points in the box [qMins[i], qMaxs[i]] are results[offsets[i], offsets[i + 1]). Every (box,
+   * tree) pair is counted first, so each tree writes its results straight into one array.
+   */
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> orthogonalQuery(
+      const parlay::sequence<pointT>& qMins, const parlay::sequence<pointT>& qMaxs) const {
+    assert(qMins.size() == qMaxs.size());
+    const size_t num_trees = levels.size();
+    const size_t T = num_trees + 1;  // the static trees, then the buffer
+    auto n = qMins.size();
+
+    // count pass: one entry per (box, tree), keeping the static trees' counts for the fill pass
+    parlay::sequence<size_t> counts(n * T + 1, 0);
+    parlay::sequence<rangeCountTree> recs(parallel ? n * T : 0);
+    auto count_box = [&](size_t i) {
+      for (size_t t = 0; t < num_trees; t++)
+        counts[i * T + t] =
+            levels[t]->tree.rangeCount(qMins[i], qMaxs[i], parallel ? &recs[i * T + t] : nullptr);
+      counts[i * T + num_trees] = buffer->tree.rangeCount(qMins[i], qMaxs[i]);
+    };
+    if (parallel) {
+      parlay::parallel_for(0, n, count_box);
+    } else {
+      for (size_t i = 0; i < n; i++)
+        count_box(i);
+    }
+    parlay::scan_inplace(counts);
+
+    // fill pass
+    parlay::sequence<objT> ret(counts[n * T]);
+    auto fill_box = [&](size_t i) {
+      for (size_t t = 0; t < num_trees; t++)
+        levels[t]->tree.orthogonalFill(qMins[i],
+                                       qMaxs[i],
+                                       ret.begin() + counts[i * T + t],
+                                       parallel ? &recs[i * T + t] : nullptr);
+      buffer->tree.orthogonalFill(qMins[i], qMaxs[i], ret.begin() + counts[i * T + num_trees]);
+    };
+    if (parallel) {
+      parlay::parallel_for(0, n, fill_box);
+    } else {
+      for (size_t i = 0; i < n; i++)
+        fill_box(i);
+    }
+
+    auto offsets = parlay::tabulate(n + 1, [&](size_t i) { return counts[i * T]; });
+    return {std::move(offsets), std::move(ret)};
+  }
+
+  // all the points within distance [radius] of [q]
+  parlay::sequence<objT> ballQuery(const pointT& q, double radius) const {
+    return ballQuery(parlay::sequence<pointT>(1, q), parlay::sequence<double>(1, radius)).second;
+  }
+
+  /*!
+   * Batched [ballQuery]: returns (offsets, results), where the points within radii[i] of
+   * queries[i] are results[offsets[i], offsets[i + 1]). As in the batched [orthogonalQuery], every
+   * (ball, tree) pair is counted first and then written straight into one array; the pairs run in
+   * parallel, so a single ball searches the trees in parallel too.
+   */
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> ballQuery(
+      const parlay::sequence<pointT>& queries, const parlay::sequence<double>& radii) const {
+    assert(queries.size() == radii.size());
+    const size_t num_trees = levels.size();
+    const size_t T = num_trees + 1;  // the static trees, then the buffer
+    auto n = queries.size();
+
+    // count pass: one entry per (ball, tree), keeping the static trees' counts for the fill pass
+    parlay::sequence<size_t> counts(n * T + 1, 0);
+    parlay::sequence<rangeCountTree> recs(parallel ? n * T : 0);
+    auto count_pair = [&](size_t j) {
+      auto i = j / T, t = j % T;
+      if (t == num_trees) {
+        counts[j] = buffer->tree.ballCount(queries[i], radii[i]);
+      } else {
+        counts[j] =
+            levels[t]->tree.ballCount(queries[i], radii[i], parallel ? &recs[j] : nullptr);
+      }
+    };
+    // fill pass
+    parlay::sequence<objT> ret;
+    auto fill_pair = [&](size_t j) {
+      auto i = j / T, t = j % T;
+      if (t == num_trees) {
+        buffer->tree.ballFill(queries[i], radii[i], ret.begin() + counts[j]);
+      } else {
+        levels[t]->tree.ballFill(
+            queries[i], radii[i], ret.begin() + counts[j], parallel ? &recs[j] : nullptr);
+      }
+    };
+
+    if (parallel) {
+      parlay::parallel_for(0, n * T, count_pair, 1);
+      parlay::scan_inplace(counts);
+      ret = parlay::sequence<objT>(counts[n * T]);
+      parlay::parallel_for(0, n * T, fill_pair, 1);
+    } else {
+      for (size_t j = 0; j < n * T; j++)
+        count_pair(j);
+      parlay::scan_inplace(counts);
+      ret = parlay::sequence<objT>(counts[n * T]);
+      for (size_t j = 0; j < n * T; j++)
+        fill_pair(j);
+    }
+
+    auto offsets = parlay::tabulate(n + 1, [&](size_t i) { return counts[i * T]; });
+    return {std::move(offsets), std::move(ret)};
+  }
+
+  // the buffer, if it is not empty, and every static tree in use (with a tiered [mergePolicy],
+  // several per level)
   parlay::sequence<int> gatherFullTrees() const {
     constexpr int BUFFER_TREE_IDX = -1;
-    // gather full trees
     parlay::sequence<int> tree_ids;
-    if (!buffer_tree.empty()) {
+    if (!buffer->tree.empty()) {
       tree_ids.push_back(BUFFER_TREE_IDX);
     }
-    for (int i = 0; i < NUM_TREES; i++) {
-      if (nth_bit_set(tree_mask, i)) tree_ids.push_back(i);
+    for (int i = 0; i < (int)levels.size(); i++) {
+      if (inUse(i)) tree_ids.push_back(i);
     }
     return tree_ids;
   }
 
+  // with no tree to search (e.g. a version whose base tree is empty), every neighbor is missing
+  template <class outT>
+  void storeNoNeighbors(parlay::slice<outT*, outT*> res) const {
+    parlay::parallel_for(0, res.size(), [&](size_t i) {
+      storeKnnResult<objT>(res[i], knnBuf::elem<const pointT*>());
+    });
+  }
+
+  // scratch space that callers may keep across knn calls, see knnbuffer.h
+  typedef knnBuf::workspace<const pointT*> knnWorkspace;
+
   template <bool update = false, bool recurse_sibling = false>
-  parlay::sequence<const pointT*> knn3(const parlay::sequence<objT>& queries, int k) const {
+  parlay::sequence<const pointT*> knn3(const parlay::sequence<objT>& queries,
+                                      int k,
+                                      const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    parlay::sequence<const pointT*> res(k * queries.size());
+    knn3<update, recurse_sibling>(queries, k, res.head(res.size()), approx);
+    return res;
+  }
+
+  template <bool update = false, bool recurse_sibling = false, class outT>
+  void knn3(const parlay::sequence<objT>& queries,
+           int k,
+           parlay::slice<outT*, outT*> res,
+           const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    knnWorkspace ws;
+    knn3<update, recurse_sibling>(queries, k, res, ws, approx);
+  }
+
+  // Same as above, with the scratch space taken from [ws]
+  template <bool update = false, bool recurse_sibling = false, class outT>
+  void knn3(const parlay::sequence<objT>& queries,
+            int k,
+            parlay::slice<outT*, outT*> res,
+            knnWorkspace& ws,
+            const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    assert(res.size() == k * queries.size());
 #ifdef PRINT_LOGTREE_TIMINGS
     timer t;
 #endif
@@ -833,13 +1241,9 @@ class LogTree {
     constexpr int BUFFER_TREE_IDX = -1;
     auto tree_ids = gatherFullTrees();
 
-    // result buffer
-    parlay::sequence<const pointT*> res(k * queries.size());
-    auto res_slice = res.head(res.size());
-
     // knn buffer
     auto out_size = (2 * k * queries.size());
-    parlay::sequence<knnBuf::elem<const pointT*>> out(out_size);
+    auto out = ws.template elems<parallel>(out_size);
 #ifdef PRINT_LOGTREE_TIMINGS
     std::cout << "[KNN3] Space Allocation: " << t.get_next() << "\n";
 #endif
@@ -854,11 +1258,11 @@ class LogTree {
 
       // call knn on this tree
       if (tree_id == BUFFER_TREE_IDX) {
-        buffer_tree.template knn<false, update, recurse_sibling>(
-            queries, out_slice, res_slice, k, preload);
+        buffer->tree.template knn<false, update, recurse_sibling>(
+            queries, out_slice, res, k, preload, approx);
       } else {
-        static_trees[tree_id].template knn<false, update, recurse_sibling>(
-            queries, out_slice, res_slice, k, preload);
+        levels[tree_id]->tree.template knn<false, update, recurse_sibling>(
+            queries, out_slice, res, k, preload, approx);
       }
 #ifdef PRINT_LOGTREE_TIMINGS
       std::cout << "[KNN3] Tree " << tree_id << " Query Time: " << t1.get_next() << "\n";
@@ -874,21 +1278,43 @@ class LogTree {
 
     // combine results
     for (size_t i = 0; i < queries.size(); i++) {
-      for (int g = 0; g < k; g++) {
-        res[i * k + g] = out[i * 2 * k + g].entry;
-      }
+      auto buf = knnBuf::buffer<const pointT*>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
+      buf.ptr = k;
+      storeKnnResults<objT>(res.begin() + i * k, buf);
     }
 #ifdef PRINT_LOGTREE_TIMINGS
     std::cout << "[KNN3] End: " << t.get_next() << "\n";
     t.reportTotal("[KNN3] Total");
     t.stop();
 #endif
+  }
 
+  template <bool update = false, bool recurse_sibling = false>
+  parlay::sequence<const pointT*> knn2(const parlay::sequence<objT>& queries,
+                                      int k,
+                                      const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    parlay::sequence<const pointT*> res(k * queries.size());
+    knn2<update, recurse_sibling>(queries, k, res.head(res.size()), approx);
     return res;
   }
 
-  template <bool update = false, bool recurse_sibling = false>
-  parlay::sequence<const pointT*> knn2(const parlay::sequence<objT>& queries, int k) const {
+  template <bool update = false, bool recurse_sibling = false, class outT>
+  void knn2(const parlay::sequence<objT>& queries,
+           int k,
+           parlay::slice<outT*, outT*> res,
+           const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    knnWorkspace ws;
+    knn2<update, recurse_sibling>(queries, k, res, ws, approx);
+  }
+
+  // Same as above, with the scratch space taken from [ws]
+  template <bool update = false, bool recurse_sibling = false, class outT>
+  void knn2(const parlay::sequence<objT>& queries,
+            int k,
+            parlay::slice<outT*, outT*> res,
+            knnWorkspace& ws,
+            const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    assert(res.size() == k * queries.size());
 
 #if SPATIAL_SORT == 2
   timer t; t.start();
@@ -908,14 +1334,10 @@ class LogTree {
     constexpr int BUFFER_TREE_IDX = -1;
     auto tree_ids = gatherFullTrees();
 
-    // result buffer
-    parlay::sequence<const pointT*> res(k * queries.size());
-    auto res_slice = res.head(res.size());
-
     // knn buffer
     auto out_size = (2 * k * queries.size());
-    parlay::sequence<knnBuf::elem<const pointT*>> out(out_size);
-    auto out_slice = out.head(out.size());
+    auto out = ws.template elems<parallel>(out_size);
+    auto out_slice = out.cut(0, out.size());
 
     auto run_on_point = [&](size_t i) {
       // knn point i through all the trees
@@ -923,19 +1345,123 @@ class LogTree {
         auto tree_id = tree_ids[j];
         auto preload = j > 0;  // buffer is full after first tree
         if (tree_id == BUFFER_TREE_IDX) {
-          buffer_tree.template knnSinglePoint<false, update, recurse_sibling>(
-              queries[i], i, out_slice, res_slice, k, preload);
+          buffer->tree.template knnSinglePoint<false, update, recurse_sibling>(
+              queries[i], i, out_slice, res, k, preload, approx);
         } else {
-          static_trees[tree_id].template knnSinglePoint<false, update, recurse_sibling>(
-              queries[i], i, out_slice, res_slice, k, preload);
+          levels[tree_id]->tree.template knnSinglePoint<false, update, recurse_sibling>(
+              queries[i], i, out_slice, res, k, preload, approx);
         }
       }
       // gather results
-      for (int j = 0; j < k; j++) {
-        res[i * k + j] = out_slice[(i * 2 * k) + j].entry;
+      auto buf = knnBuf::buffer<const pointT*>(k, out_slice.cut(i * 2 * k, (i + 1) * 2 * k));
+      buf.ptr = k;
+      storeKnnResults<objT>(res.begin() + i * k, buf);
+    };
+
+    if (parallel) {
+      parlay::parallel_for(0, queries.size(), run_on_point);
+    } else {
+      for (size_t i = 0; i < queries.size(); i++) {
+        run_on_point(i);
+      }
+    }
+  }
+
+  // Run the knn search of [q] through the trees [tree_ids] in order of the distance from [q] to
+  // their root bounding box, stopping at the first tree whose box is beyond the k-th distance.
+  // [order] is scratch space for one entry per tree.
+  template <bool update, bool recurse_sibling, class bufT>
+  void knnNearestTreesFirst(const objT& q,
+                            const parlay::sequence<int>& tree_ids,
+                            parlay::slice<std::pair<double, int>*, std::pair<double, int>*> order,
+                            bufT& buf) const {
+    constexpr int BUFFER_TREE_IDX = -1;
+    pointT p(q.coordinate());
+
+    // squared distance from [p] to the root bounding box of a tree
+    auto root_dist = [&](int tree_id) -> double {
+      if (tree_id == BUFFER_TREE_IDX) {
+#if (LOGTREE_BUFFER == ARR_BUFFER)
+        return 0;  // no bounding box: always visit the buffer first
+#else
+        auto root = buffer->tree.root();
+        return BoundingBoxDistanceSqr(p, p, root->getMin(), root->getMax());
+#endif
+      } else {
+        auto root = levels[tree_id]->tree.root();
+        return BoundingBoxDistanceSqr(p, p, root->getMin(), root->getMax());
       }
     };
 
+    assert(order.size() == tree_ids.size());
+    for (size_t j = 0; j < tree_ids.size(); j++)
+      order[j] = {root_dist(tree_ids[j]), tree_ids[j]};
+    std::sort(order.begin(), order.end());
+
+    for (size_t j = 0; j < tree_ids.size(); j++) {
+      // the remaining trees are all at least this far away
+      if (buf.hasK() && order[j].first > buf.pruneRadius()) break;
+      auto tree_id = order[j].second;
+      buf.nextTree();
+      if (tree_id == BUFFER_TREE_IDX) {
+#if (LOGTREE_BUFFER == ARR_BUFFER)
+        buffer->tree.knnSinglePoint(q, buf);
+#else
+        buffer->tree.template knnSinglePoint<update, recurse_sibling>(q, buf);
+#endif
+      } else {
+        levels[tree_id]->tree.template knnSinglePoint<update, recurse_sibling>(q, buf);
+      }
+    }
+  }
+
+  template <bool update = false, bool recurse_sibling = false>
+  parlay::sequence<const pointT*> knn4(
+      const parlay::sequence<objT>& queries,
+      int k,
+      const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    parlay::sequence<const pointT*> res(k * queries.size());
+    knn4<update, recurse_sibling>(queries, k, res.head(res.size()), approx);
+    return res;
+  }
+
+  // Like knn2, each query runs through the trees with a single buffer, but the trees are visited
+  // in order of the distance from the query to their root bounding box, and the search stops at
+  // the first tree whose box is beyond the current k-th distance.
+  template <bool update = false, bool recurse_sibling = false, class outT>
+  void knn4(const parlay::sequence<objT>& queries,
+            int k,
+            parlay::slice<outT*, outT*> res,
+            const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    knnWorkspace ws;
+    knn4<update, recurse_sibling>(queries, k, res, ws, approx);
+  }
+
+  // Same as above, with the scratch space taken from [ws]
+  template <bool update = false, bool recurse_sibling = false, class outT>
+  void knn4(const parlay::sequence<objT>& queries,
+            int k,
+            parlay::slice<outT*, outT*> res,
+            knnWorkspace& ws,
+            const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    assert(res.size() == k * queries.size());
+
+    auto tree_ids = gatherFullTrees();
+    const size_t T = tree_ids.size();
+    auto order = ws.treeOrder(T * queries.size());
+
+    // knn buffer
+    auto out_size = (2 * k * queries.size());
+    auto out = ws.template elems<parallel>(out_size);
+
+    auto run_on_point = [&](size_t i) {
+      auto buf = knnBuf::buffer<const pointT*>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
+      buf.setApprox(approx);
+      knnNearestTreesFirst<update, recurse_sibling>(
+          queries[i], tree_ids, order.cut(i * T, (i + 1) * T), buf);
+      storeKnnResults<objT>(res.begin() + i * k, buf);
+    };
+
     if (parallel) {
       parlay::parallel_for(0, queries.size(), run_on_point);
     } else {
@@ -943,12 +1469,77 @@ class LogTree {
         run_on_point(i);
       }
     }
+  }
 
+  // knn4 with k = K fixed at compile time, see KdTree::knnFixedK
+  template <int K, bool update = false, bool recurse_sibling = false>
+  parlay::sequence<const pointT*> knnFixedK(
+      const parlay::sequence<objT>& queries,
+      const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    parlay::sequence<const pointT*> res(K * queries.size());
+    knnFixedK<K, update, recurse_sibling>(queries, res.head(res.size()), approx);
     return res;
   }
 
+  template <int K, bool update = false, bool recurse_sibling = false, class outT>
+  void knnFixedK(const parlay::sequence<objT>& queries,
+                 parlay::slice<outT*, outT*> res,
+                 const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    knnWorkspace ws;
+    knnFixedK<K, update, recurse_sibling>(queries, res, ws, approx);
+  }
+
+  // Same as above, with the scratch space taken from [ws]
+  template <int K, bool update = false, bool recurse_sibling = false, class outT>
+  void knnFixedK(const parlay::sequence<objT>& queries,
+                 parlay::slice<outT*, outT*> res,
+                 knnWorkspace& ws,
+                 const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    assert(res.size() == K * queries.size());
+    auto tree_ids = gatherFullTrees();
+    const size_t T = tree_ids.size();
+    auto order = ws.treeOrder(T * queries.size());
+    auto run_on_point = [&](size_t i) {
+      knnBuf::buffer<const pointT*, K> buf;
+      buf.setApprox(approx);
+      knnNearestTreesFirst<update, recurse_sibling>(
+          queries[i], tree_ids, order.cut(i * T, (i + 1) * T), buf);
+      storeKnnResults<objT>(res.begin() + i * K, buf);
+    };
+    if (parallel) {
+      parlay::parallel_for(0, queries.size(), run_on_point);
+    } else {
+      for (size_t i = 0; i < queries.size(); i++)
+        run_on_point(i);
+    }
+  }
+
   template <bool update = false, bool recurse_sibling = false>
-  parlay::sequence<const pointT*> knn(const parlay::sequence<objT>& queries, int k) const {
+  parlay::sequence<const pointT*> knn(const parlay::sequence<objT>& queries,
+                                      int k,
+                                      const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    parlay::sequence<const pointT*> res(k * queries.size());
+    knn<update, recurse_sibling>(queries, k, res.head(res.size()), approx);
+    return res;
+  }
+
+  template <bool update = false, bool recurse_sibling = false, class outT>
+  void knn(const parlay::sequence<objT>& queries,
+           int k,
+           parlay::slice<outT*, outT*> res,
+           const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    knnWorkspace ws;
+    knn<update, recurse_sibling>(queries, k, res, ws, approx);
+  }
+
+  // Same as above, with the scratch space taken from [ws]
+  template <bool update = false, bool recurse_sibling = false, class outT>
+  void knn(const parlay::sequence<objT>& queries,
+           int k,
+           parlay::slice<outT*, outT*> res,
+           knnWorkspace& ws,
+           const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    assert(res.size() == k * queries.size());
 
 #if SPATIAL_SORT == 2
   timer t; t.start();
@@ -970,14 +1561,11 @@ class LogTree {
 #endif
     constexpr int BUFFER_TREE_IDX = -1;
     auto tree_ids = gatherFullTrees();
-
-    // result buffer
-    parlay::sequence<const pointT*> res(k * queries.size());
-    auto res_slice = res.head(res.size());
+    if (tree_ids.empty()) return storeNoNeighbors(res);
 
     // knn buffer
     auto out_size = (2 * k * queries.size());
-    parlay::sequence<knnBuf::elem<const pointT*>> out(out_size * (parallel ? tree_ids.size() : 1));
+    auto out = ws.template elems<parallel>(out_size * (parallel ? tree_ids.size() : 1));
 #ifdef PRINT_LOGTREE_TIMINGS
     std::cout << "[KNN] Space Allocation: " << t.get_next() << "\n";
 #endif
@@ -992,11 +1580,11 @@ class LogTree {
 
       // call knn on this tree
       if (tree_id == BUFFER_TREE_IDX) {
-        buffer_tree.template knn<false, update, recurse_sibling>(
-            queries, out_slice, res_slice, k, preload);
+        buffer->tree.template knn<false, update, recurse_sibling>(
+            queries, out_slice, res, k, preload, approx);
       } else {
-        static_trees[tree_id].template knn<false, update, recurse_sibling>(
-            queries, out_slice, res_slice, k, preload);
+        levels[tree_id]->tree.template knn<false, update, recurse_sibling>(
+            queries, out_slice, res, k, preload, approx);
       }
 #ifdef PRINT_LOGTREE_TIMINGS
       std::cout << "[KNN] Tree " << tree_id << " Query Time: " << t1.get_next() << "\n";
@@ -1028,15 +1616,13 @@ class LogTree {
             buf.insert(*(start_elem + g));
           }
         }
-        for (int g = 0; g < k; g++) {
-          res[i * k + g] = buf[g].entry;
-        }
+        storeKnnResults<objT>(res.begin() + i * k, buf);
       });
     } else {
       for (size_t i = 0; i < queries.size(); i++) {
-        for (int g = 0; g < k; g++) {
-          res[i * k + g] = out[i * 2 * k + g].entry;
-        }
+        auto buf = knnBuf::buffer<const pointT*>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
+        buf.ptr = k;
+        storeKnnResults<objT>(res.begin() + i * k, buf);
       }
     }
 #ifdef PRINT_LOGTREE_TIMINGS
@@ -1044,21 +1630,42 @@ class LogTree {
     t.reportTotal("[KNN] Total");
     t.stop();
 #endif
+  }
 
+  parlay::sequence<const pointT*> dualKnnBase(
+      const KdTree<dim, objT, parallel, coarsen>& queryTree,
+      int k,
+      const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    parlay::sequence<const pointT*> res(k * queryTree.size());
+    dualKnnBase(queryTree, k, res.head(res.size()), approx);
     return res;
   }
 
-  parlay::sequence<const pointT*> dualKnnBase(const KdTree<dim, objT, parallel, coarsen>& queryTree,
-                                              int k) const {
+  // results for queryTree.getItems()[i] are written to res[i * k, (i + 1) * k)
+  template <class outT>
+  void dualKnnBase(const KdTree<dim, objT, parallel, coarsen>& queryTree,
+                   int k,
+                   parlay::slice<outT*, outT*> res,
+                   const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    knnWorkspace ws;
+    dualKnnBase(queryTree, k, res, ws, approx);
+  }
+
+  // Same as above, with the scratch space taken from [ws]
+  template <class outT>
+  void dualKnnBase(const KdTree<dim, objT, parallel, coarsen>& queryTree,
+                   int k,
+                   parlay::slice<outT*, outT*> res,
+                   knnWorkspace& ws,
+                   const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+    assert(res.size() == k * queryTree.size());
 #ifdef PRINT_LOGTREE_TIMINGS
     timer t;
 #endif
 
     constexpr int BUFFER_TREE_IDX = -1;
     auto tree_ids = gatherFullTrees();
-
-    // result buffer
-    parlay::sequence<const pointT*> res(k * queryTree.size());
+    if (tree_ids.empty()) return storeNoNeighbors(res);
 
     // knn buffer
     auto out_size = (2 * k * queryTree.size());
@@ -1068,14 +1675,15 @@ class LogTree {
     auto multiplier =
         (parallel ? tree_ids.size() : 1);  // in atomic/array case, have separate buffers for each
 #endif
-    parlay::sequence<knnBuf::elem<const pointT*>> out(out_size * multiplier);
-    parlay::sequence<knnBuf::buffer<const pointT*>> bufs(queryTree.size() * multiplier);
+    auto out = ws.template elems<parallel>(out_size * multiplier);
+    auto bufs = ws.buffers(queryTree.size() * multiplier);
 
 #if (DUAL_KNN_MODE == DKNN_NONATOMIC_LEAF)
     // in non-atomic case, have to initialize buffers ahead of time
     //  -> in other cases, initialize buffers in each tree's thread
     auto setup_buffer = [&](size_t i) {
       bufs[i] = knnBuf::buffer<const pointT*>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
+      bufs[i].setApprox(approx);
     };
     if (parallel) {
       parlay::parallel_for(0, bufs.size(), setup_buffer);
@@ -1093,6 +1701,7 @@ class LogTree {
       auto setup_buffer = [&](size_t j) {
         auto idx = i * queryTree.size() + j;
         bufs[idx] = knnBuf::buffer<const pointT*>(k, out.cut(idx * 2 * k, (idx + 1) * 2 * k));
+        bufs[idx].setApprox(approx);
       };
       if (parallel) {
         parlay::parallel_for(0, queryTree.size(), setup_buffer);
@@ -1115,21 +1724,21 @@ class LogTree {
         //#if (LOGTREE_BUFFER == BHL_BUFFER)
         //#if (DUAL_KNN_MODE == DKNN_ARRAY)
         // DualKnnHelper(queryTree.unsafe_root(),
-        // buffer_tree.root(),
+        // buffer->tree.root(),
         // queryTree,
         // dualKnnDists,
-        // buffer_tree,
+        // buffer->tree,
         // buf_slice);
         //#else
         // DualKnnHelper(
-        // queryTree.unsafe_root(), buffer_tree.root(), queryTree, buffer_tree, buf_slice);
+        // queryTree.unsafe_root(), buffer->tree.root(), queryTree, buffer->tree, buf_slice);
         //#endif
         //#else
         timer t;
 #if (LOGTREE_BUFFER == ARR_BUFFER)
-        buffer_tree.knn(queryTree.items, buf_slice);
+        buffer->tree.knn(queryTree.items, buf_slice);
 #else
-        buffer_tree.template knn<false, false>(queryTree.items, buf_slice);
+        buffer->tree.template knn<false, false>(queryTree.items, buf_slice);
 #endif
 #ifdef PRINT_LOGTREE_TIMINGS
         std::cout << "[DKNN] SMALL KNN: " << t.get_next() << "\n";
@@ -1147,16 +1756,16 @@ class LogTree {
       } else {
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
         DualKnnHelper(queryTree.unsafe_root(),
-                      static_trees[tree_id].root(),
+                      levels[tree_id]->tree.root(),
                       queryTree,
                       dualKnnDists,
-                      static_trees[tree_id],
+                      levels[tree_id]->tree,
                       buf_slice);
 #else
         DualKnnHelper(queryTree.unsafe_root(),
-                      static_trees[tree_id].root(),
+                      levels[tree_id]->tree.root(),
                       queryTree,
-                      static_trees[tree_id],
+                      levels[tree_id]->tree,
                       buf_slice);
 #endif
       }
@@ -1175,15 +1784,23 @@ class LogTree {
       std::cout << "[DKNN] Setup: " << t.get_next() << std::endl;
 #endif
       for (size_t i = 0; i < tree_ids.size(); i++) {
+        if (i > 0 && approx.max_leaves > 0) {  // the buffers move on to the next tree
+          if (parallel) {
+            parlay::parallel_for(0, buf_slice.size(), [&](size_t j) { buf_slice[j].nextTree(); });
+          } else {
+            for (size_t j = 0; j < buf_slice.size(); j++)
+              buf_slice[j].nextTree();
+          }
+        }
         run_on_tree(i, buf_slice);
 #ifdef PRINT_LOGTREE_TIMINGS
         auto nth_tree_cur_size = [&](int id) {
           if (id == BUFFER_TREE_IDX) {
-            return buffer_tree.size();
+            return buffer->tree.size();
           } else {
-            assert(id < NUM_TREES);
+            assert(id < (int)levels.size());
             assert(id >= 0);
-            return static_trees[id].size();
+            return levels[id]->tree.size();
           }
         };
         auto tree_id = tree_ids[i];
@@ -1207,43 +1824,64 @@ class LogTree {
           }
         }
         buf.keepK();
-        for (int g = 0; g < k; g++) {
-          res[i * k + g] = buf[g].entry;
-        }
+        storeKnnResults<objT>(res.begin() + i * k, buf);
       });
 #else
       parlay::parallel_for(0, queryTree.size(), [&](size_t i) {
-        for (int g = 0; g < k; g++) {
-          res[i * k + g] = bufs[i][g].entry;
-        }
+        storeKnnResults<objT>(res.begin() + i * k, bufs[i]);
       });
 #endif
     } else {
       for (size_t i = 0; i < queryTree.size(); i++) {
-        for (int g = 0; g < k; g++) {
-          res[i * k + g] = bufs[i][g].entry;
-        }
+        storeKnnResults<objT>(res.begin() + i * k, bufs[i]);
       }
     }
-
-    return res;
   }
 
   // DEBUG
-  int getTreeMask() const { return tree_mask; }
+  // bit i is set when static tree i is in use, for the first 31 trees
+  int getTreeMask() const {
+    int mask = 0;
+    for (size_t i = 0; i < std::min<size_t>(levels.size(), 31); i++)
+      if (inUse(i)) mask |= (1 << i);
+    return mask;
+  }
+  const mergePolicy& getPolicy() const { return policy; }
+  // the number of static trees allocated, in use or not
+  size_t numTrees() const { return levels.size(); }
+  int getBufferLog2Size() const { return buffer_log2size; }
+
+  // the number of bytes held by this tree, including the storage of all allocated levels
+  size_t memory_footprint() const {
+    size_t res = sizeof(*this) + sizeof(bufferLevel) +
+                 levels.capacity() * sizeof(std::shared_ptr<level>) +
+                 levels.size() * sizeof(level) + buffer->tree.memory_footprint() +
+                 (locator ? locator->memory_footprint() : 0);
+    for (const auto& l : levels) {
+      res += l->tree.memory_footprint();
+    }
+#ifdef LOGTREE_USE_BLOOM
+    res += buffer->bloom_filter.memory_footprint();
+    for (const auto& l : levels) {
+      res += l->bloom_filter.memory_footprint();
+    }
+#endif
+    return res;
+  }
 
   // TODO: can make this better by tracking as inserts/deletes are done
   size_t size() const {
-    size_t res = buffer_tree.size();
-    for (int i = 0; i < NUM_TREES; i++) {
-      if (nth_bit_set(tree_mask, i)) res += static_trees[i].size();
+    size_t res = buffer->tree.size();
+    for (const auto& l : levels) {
+      res += l->tree.size();
     }
     return res;
   }
 
   void print(int tree_idx) const {
-    if (tree_idx < 0 || tree_idx >= NUM_TREES) throw std::runtime_error("tree_idx out of bounds!");
-    static_trees[tree_idx].print();
+    if (tree_idx < 0 || tree_idx >= (int)levels.size())
+      throw std::runtime_error("tree_idx out of bounds!");
+    levels[tree_idx]->tree.print();
   }
 };
 
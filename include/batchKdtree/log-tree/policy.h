@@ -0,0 +1,192 @@
+// This code is part of the project "Parallel Batch-Dynamic Kd-Trees"
+// Copyright (c) 2021-2022 Rahul Yesantharao, Yiqiu Wang, Laxman Dhulipala, Julian Shun
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../shared/macro.h"
+
+namespace batchKdTree {
+
+/*!
+ * How a LogTree lays its static trees (runs) out in levels, and how full buffers are carried into
+ * them. A run at level l holds at most BUFFER_SIZE * fanout^l points, and every full buffer
+ * arrives at level 0 as a run of its own.
+ *  - LEVELED_MERGE: a level holds a single run. An arriving run is merged into it if the two fit
+ *    together; otherwise both are merged and carried to level l + 1. Queries visit few trees, but
+ *    a level can be rewritten up to fanout - 1 times before it carries.
+ *  - TIERED_MERGE: a level holds up to [max_runs] runs. A run arriving at a full level is merged
+ *    with all of them and carried to level l + 1, so a point is rewritten once per level. The
+ *    carried run must fit in the next level: max_runs < fanout.
+ * The default, leveled with fan-out 2, is the binary counter of the original LogTree (and so is
+ * tiered with fan-out 2 and one run per level).
+ */
+struct mergePolicy {
+  int kind;      // LEVELED_MERGE or TIERED_MERGE
+  int fanout;    // the ratio between the run capacities of consecutive levels
+  int max_runs;  // runs per level, TIERED_MERGE only
+
+  mergePolicy(int kind_ = LOGTREE_MERGE_POLICY,
+              int fanout_ = LOGTREE_FANOUT,
+              int max_runs_ = LOGTREE_MAX_RUNS)
+      : kind(kind_), fanout(fanout_), max_runs(max_runs_) {
+    if (kind != LEVELED_MERGE && kind != TIERED_MERGE)
+      throw std::runtime_error("Invalid merge policy: " + std::to_string(kind));
+    if (fanout < 2) throw std::runtime_error("Merge fan-out must be at least 2");
+    if (kind == TIERED_MERGE && (max_runs < 1 || max_runs >= fanout))
+      throw std::runtime_error("Tiered merge needs 1 <= max_runs < fanout: (max_runs, fanout) = (" +
+                               std::to_string(max_runs) + ", " + std::to_string(fanout) + ")");
+  }
+
+  int runsPerLevel() const { return (kind == TIERED_MERGE) ? max_runs : 1; }
+
+  // the most points a run at [level] holds, saturating instead of overflowing
+  size_t runCapacity(int level, size_t buffer_size) const {
+    size_t ret = buffer_size;
+    for (int l = 0; l < level; l++) {
+      if (ret > std::numeric_limits<size_t>::max() / fanout)
+        return std::numeric_limits<size_t>::max();
+      ret *= fanout;
+    }
+    return ret;
+  }
+
+  // a run to build: the existing runs (by slot) and the new points it is made of
+  struct move {
+    std::vector<int> slots;
+    size_t new_points = 0;     // taken from the inserted batch
+    bool uses_buffer = false;  // whether the points of the buffer go in as well
+    size_t size = 0;
+    int target = -1;  // the slot the run is built in
+  };
+
+  /*!
+   * Plan the insertion of [full_buffers] full buffers into runs whose sizes are [slot_sizes] (0
+   * for an empty slot); slot s is at level s / runsPerLevel(). With [use_buffer], the first of
+   * them holds the [buffer_points] points of the buffer. The buffers are carried in one at a time,
+   * as if they had been inserted separately; only the runs that end up different are returned.
+   * A carry out of the top level starts a new level, so a target can be past the last slot.
+   */
+  std::vector<move> plan(const std::vector<size_t>& slot_sizes,
+                         size_t buffer_size,
+                         size_t full_buffers,
+                         bool use_buffer,
+                         size_t buffer_points) const {
+    int runs = runsPerLevel();
+    int num_slots = (int)slot_sizes.size();
+    auto kept = [](const move& r) {
+      return r.slots.size() == 1 && r.new_points == 0 && !r.uses_buffer;
+    };
+    auto absorb = [](move& r, const move& other) {
+      r.slots.insert(r.slots.end(), other.slots.begin(), other.slots.end());
+      r.new_points += other.new_points;
+      r.uses_buffer |= other.uses_buffer;
+      r.size += other.size;
+    };
+
+    std::vector<std::vector<move>> forest((num_slots + runs - 1) / runs);
+    for (int s = 0; s < num_slots; s++) {
+      if (slot_sizes[s] == 0) continue;
+      move r;
+      r.slots.push_back(s);
+      r.size = slot_sizes[s];
+      forest[s / runs].push_back(std::move(r));
+    }
+
+    // simulate the carries
+    for (size_t b = 0; b < full_buffers; b++) {
+      move r;
+      r.uses_buffer = use_buffer && b == 0;
+      r.new_points = buffer_size - (r.uses_buffer ? buffer_points : 0);
+      r.size = buffer_size;
+      for (int l = 0;; l++) {
+        if (l == (int)forest.size()) forest.emplace_back();
+        auto& cur = forest[l];
+        if ((int)cur.size() < runs) {
+          cur.push_back(std::move(r));
+          break;
+        }
+        if (kind == LEVELED_MERGE && cur[0].size + r.size <= runCapacity(l, buffer_size)) {
+          absorb(cur[0], r);
+          break;
+        }
+        for (const auto& other : cur)
+          absorb(r, other);
+        cur.clear();
+      }
+    }
+
+    // An existing run that was carried up and replaced by a run of new points no bigger than it
+    // stays where it is instead, and the new points are carried up in its place.
+    int num_levels = (int)forest.size();
+    std::vector<std::pair<int, int>> owner(num_slots, {-1, -1});  // (level, index)
+    for (int l = 0; l < num_levels; l++)
+      for (int j = 0; j < (int)forest[l].size(); j++)
+        for (int s : forest[l][j].slots)
+          owner[s] = {l, j};
+    for (int l = 0; l < num_levels; l++) {
+      for (auto& r : forest[l]) {
+        if (!r.slots.empty()) continue;
+        for (int s = l * runs; s < std::min((l + 1) * runs, num_slots); s++) {
+          if (slot_sizes[s] < r.size || owner[s].first <= l) continue;
+          auto& up = forest[owner[s].first][owner[s].second];
+          up.slots.erase(std::find(up.slots.begin(), up.slots.end(), s));
+          up.new_points += r.new_points;
+          up.uses_buffer |= r.uses_buffer;
+          up.size = up.size - slot_sizes[s] + r.size;
+          r = move();
+          r.slots.push_back(s);
+          r.size = slot_sizes[s];
+          owner[s] = {l, -1};
+          break;
+        }
+      }
+    }
+
+    // build the changed runs in the slots of their level that no kept run holds, preferring
+    // a slot they gather
+    std::vector<move> ret;
+    for (int l = 0; l < num_levels; l++) {
+      std::vector<bool> taken(runs, false);
+      for (const auto& r : forest[l])
+        if (kept(r)) taken[r.slots[0] - l * runs] = true;
+      for (auto& r : forest[l]) {
+        if (kept(r)) continue;
+        for (int s : r.slots)
+          if (s / runs == l && !taken[s - l * runs]) r.target = s;
+        for (int s = l * runs; r.target < 0; s++)
+          if (!taken[s - l * runs]) r.target = s;
+        taken[r.target - l * runs] = true;
+        ret.push_back(std::move(r));
+      }
+    }
+    return ret;
+  }
+};
+
+}  // End namespace batchKdTree
@@ -0,0 +1,302 @@
+// This code is part of the project "Parallel Batch-Dynamic Kd-Trees"
+// Copyright (c) 2021-2022 Rahul Yesantharao, Yiqiu Wang, Laxman Dhulipala, Julian Shun
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "./logtree.h"
+
+namespace batchKdTree {
+
+enum InsertMode {
+  INSERT_SYNC = 0,  // an insert returns once its batch is merged into the levels
+  INSERT_ASYNC      // an insert stages its batch and returns; a background thread merges it
+};
+
+/*!
+ * A LogTree whose queries run on immutable snapshots, so that they can overlap an update batch.
+ *
+ * An update copies the current version, which shares the buffer and every level with it (see
+ * [LogTree::levels]), applies the batch to the copy and publishes the copy with an atomic pointer
+ * swap. The copy never writes to shared storage: the levels the batch touches are copied into
+ * fresh storage (or rebuilt, when the batch merges them). A reader pins the version returned by
+ * [snapshot] for as long as it holds it, and the levels that were replaced are freed when the last
+ * version sharing them is released.
+ *
+ * In INSERT_ASYNC mode, an insert only builds a small tree over its batch and publishes it as a
+ * staged batch of the version, which queries consult along with the merged tree. A background
+ * thread folds all the staged batches into the merged tree with a single insert (so the carries
+ * run off the caller's thread) and publishes the result. At most [staging_budget] points are
+ * staged at a time (a larger batch is staged alone): inserts beyond that wait for the merge. An
+ * erase first waits for every staged batch to be merged. The background thread is not one of the
+ * scheduler's workers, and it runs the merge's parallel code while the callers may be running
+ * parallel queries of their own: INSERT_ASYNC needs a scheduler that accepts parallel work from
+ * several outside threads at once.
+ *
+ * Updates are serialized among themselves; readers never wait for them.
+ */
+template <class logTreeT>
+class VersionedLogTree {
+  typedef typename logTreeT::objT_ objT;
+  typedef typename logTreeT::pointT_ pointT;
+
+  // a batch inserted in INSERT_ASYNC mode and not merged yet, in a small tree of its own
+  struct stagedBatch {
+    parlay::sequence<objT> points;
+    logTreeT tree;
+
+    template <class R>
+    stagedBatch(const R& points_) : points(points_.begin(), points_.end()) {
+      const auto& const_points = points;
+      tree.insert(const_points);
+    }
+  };
+
+ public:
+  /*!
+   * A version of the tree: the merged LogTree and the batches staged since it was published,
+   * oldest first. The queries below consult both; in INSERT_SYNC mode nothing is staged.
+   */
+  class version {
+    friend class VersionedLogTree;
+    std::shared_ptr<const logTreeT> tree;
+    std::vector<std::shared_ptr<const stagedBatch>> staged;
+
+    // keep the k nearest of res[i * k, (i + 1) * k) and other[i * k, (i + 1) * k), both sorted,
+    // in place: count how many come from [res], then merge from the back
+    static void mergeKnn(const parlay::sequence<objT>& queries,
+                         int k,
+                         parlay::sequence<const pointT*>& res,
+                         const parlay::sequence<const pointT*>& other) {
+      parlay::parallel_for(0, queries.size(), [&](size_t i) {
+        auto cost = [&](const pointT* p) {
+          return p ? queries[i].distSqr(*p) : std::numeric_limits<double>::max();
+        };
+        auto a = res.begin() + i * k;
+        auto b = other.begin() + i * k;
+        int from_a = 0;
+        for (int j = 0; j < k; j++)
+          if (cost(a[from_a]) <= cost(b[j - from_a])) from_a++;
+        int ia = from_a - 1, ib = k - from_a - 1;
+        for (int j = k - 1; j >= 0; j--)
+          a[j] = (ib < 0 || (ia >= 0 && cost(a[ia]) > cost(b[ib]))) ? a[ia--] : b[ib--];
+      });
+    }
+
+   public:
+    // the merged part of the version, which is all of it when [numStaged] is 0
+    const logTreeT& merged() const { return *tree; }
+    size_t numStaged() const { return staged.size(); }
+
+    size_t size() const {
+      size_t ret = tree->size();
+      for (const auto& b : staged)
+        ret += b->tree.size();
+      return ret;
+    }
+
+    bool contains(const objT& p) const {
+      if (tree->contains(p)) return true;
+      for (const auto& b : staged)
+        if (b->tree.contains(p)) return true;
+      return false;
+    }
+
+    size_t rangeCount(const pointT& qMin, const pointT& qMax) const {
+      size_t ret = tree->rangeCount(qMin, qMax);
+      for (const auto& b : staged)
+        ret += b->tree.rangeCount(qMin, qMax);
+      return ret;
+    }
+
+    parlay::sequence<objT> orthogonalQuery(const pointT& qMin, const pointT& qMax) const {
+      auto ret = tree->orthogonalQuery(qMin, qMax);
+      for (const auto& b : staged)
+        ret.append(b->tree.orthogonalQuery(qMin, qMax));
+      return ret;
+    }
+
+    // the k nearest neighbors of every query, nearest first, as in [LogTree::knn]
+    parlay::sequence<const pointT*> knn(
+        const parlay::sequence<objT>& queries,
+        int k,
+        const knnBuf::knnApprox& approx = knnBuf::knnApprox()) const {
+      auto res = tree->knn(queries, k, approx);
+      for (const auto& b : staged)
+        mergeKnn(queries, k, res, b->tree.knn(queries, k, approx));
+      return res;
+    }
+  };
+  typedef std::shared_ptr<const version> snapshotT;
+
+ private:
+  const InsertMode mode;
+  const size_t staging_budget;
+  snapshotT current;  // only accessed through std::atomic_load / std::atomic_store
+
+  // the fields below are guarded by [update_mutex]
+  std::mutex update_mutex;
+  std::condition_variable staged_cv;  // a batch was staged, or the tree is being destroyed
+  std::condition_variable merged_cv;  // staged batches were merged, or an update finished
+  size_t staged_points = 0;
+  size_t waiting_updates = 0;  // updates waiting for the staged batches to be merged
+  bool stopping = false;
+  std::thread merger;  // INSERT_ASYNC only
+
+  void publish(std::shared_ptr<version> v) {
+    std::atomic_store(&current, snapshotT(std::move(v)));
+  }
+
+  // apply [f] to a copy of the merged tree, once nothing is staged, and publish it
+  template <class F>
+  void update(F f) {
+    std::unique_lock<std::mutex> lock(update_mutex);
+    waiting_updates++;
+    merged_cv.wait(lock, [&]() { return staged_points == 0; });
+    auto next = std::make_shared<version>();
+    auto next_tree = std::make_shared<logTreeT>(*snapshot()->tree);
+    f(*next_tree);
+    next->tree = std::move(next_tree);
+    publish(std::move(next));
+    waiting_updates--;
+    merged_cv.notify_all();
+  }
+
+  // INSERT_ASYNC: fold the staged batches into the merged tree until the tree is destroyed
+  void mergeStaged() {
+    std::unique_lock<std::mutex> lock(update_mutex);
+    while (true) {
+      staged_cv.wait(lock, [&]() { return stopping || staged_points > 0; });
+      if (staged_points == 0) return;  // stopping, and everything is merged
+
+      // only inserts can publish until this merge does, and they only append staged batches
+      auto cur = snapshot();
+      lock.unlock();
+      parlay::sequence<objT> points;
+      for (const auto& b : cur->staged)
+        points.append(b->points);
+      auto next_tree = std::make_shared<logTreeT>(*cur->tree);
+      next_tree->insert(points);
+      lock.lock();
+
+      auto next = std::make_shared<version>();
+      next->tree = std::move(next_tree);
+      auto latest = snapshot();
+      next->staged.assign(latest->staged.begin() + cur->staged.size(), latest->staged.end());
+      staged_points -= points.size();
+      publish(std::move(next));
+      merged_cv.notify_all();
+    }
+  }
+
+ public:
+  explicit VersionedLogTree(InsertMode mode_ = INSERT_SYNC,
+                            size_t staging_budget_ = LOGTREE_STAGING_BUDGET)
+      : mode(mode_), staging_budget(staging_budget_) {
+    auto v = std::make_shared<version>();
+    v->tree = std::make_shared<logTreeT>();
+    publish(std::move(v));
+    if (mode == INSERT_ASYNC) merger = std::thread([this]() { mergeStaged(); });
+  }
+  template <class R>
+  VersionedLogTree(const R& points) : VersionedLogTree() {
+    insert(points);
+  }
+
+  // merges what is still staged
+  ~VersionedLogTree() {
+    if (mode != INSERT_ASYNC) return;
+    {
+      std::lock_guard<std::mutex> lock(update_mutex);
+      stopping = true;
+    }
+    staged_cv.notify_one();
+    merger.join();
+  }
+
+  // the current version: it is not changed by later updates
+  snapshotT snapshot() const { return std::atomic_load(&current); }
+
+  // wait until every staged batch is merged
+  void drain() {
+    std::unique_lock<std::mutex> lock(update_mutex);
+    merged_cv.wait(lock, [&]() { return staged_points == 0; });
+  }
+
+  // MODIFY -----------------------------------------
+  template <class R>
+  void insert(const R& points) {
+    if (mode == INSERT_SYNC) {
+      update([&](logTreeT& tree) { tree.insert(points); });
+      return;
+    }
+    if (points.size() == 0) return;
+    auto batch = std::make_shared<const stagedBatch>(points);  // before taking the lock
+
+    std::unique_lock<std::mutex> lock(update_mutex);
+    merged_cv.wait(lock, [&]() {
+      return waiting_updates == 0 &&
+             (staged_points == 0 || staged_points + points.size() <= staging_budget);
+    });
+    // the merge would throw on the background thread; the locator checked is the one the merge
+    // will see, as [locateIds] only publishes once nothing is staged
+    snapshot()->tree->checkIds(points);
+    auto next = std::make_shared<version>(*snapshot());
+    next->staged.push_back(std::move(batch));
+    staged_points += points.size();
+    publish(std::move(next));
+    staged_cv.notify_one();
+  }
+
+  template <bool bulk = false, class R>
+  void erase(const R& points) {
+    update([&](logTreeT& tree) { tree.template erase<bulk, R>(points); });
+  }
+
+  template <class R>
+  void bulk_erase(const R& points) {
+    erase<true, R>(points);
+  }
+
+  // see [LogTree::locateIds]
+  void locateIds(size_t id_bound) {
+    update([&](logTreeT& tree) { tree.locateIds(id_bound); });
+  }
+
+  // see [LogTree::eraseIds]
+  template <class idT>
+  void eraseIds(const parlay::sequence<idT>& ids) {
+    update([&](logTreeT& tree) { tree.eraseIds(ids); });
+  }
+
+  // QUERY -----------------------------------------
+  size_t size() const { return snapshot()->size(); }
+};
+
+}  // End namespace batchKdTree
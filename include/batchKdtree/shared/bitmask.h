@@ -0,0 +1,182 @@
+// This code is part of the project "Parallel Batch-Dynamic Kd-Trees"
+// Copyright (c) 2021-2022 Rahul Yesantharao, Yiqiu Wang, Laxman Dhulipala, Julian Shun
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+#include <parlay/parallel.h>
+#include <parlay/primitives.h>
+#include <parlay/sequence.h>
+
+namespace batchKdTree {
+
+/*!
+ * Bit-packed [present] flags: bit i of word i / 64 is set iff item i is live.
+ * Clearing single bits is atomic, so erasures of neighbouring items from different threads are
+ * safe. Counting and packing work on a word (64 items) at a time.
+ */
+class bitMask {
+  static constexpr size_t WORD_BITS = 64;
+  // number of words handled by one task of the parallel pack
+  static constexpr size_t PACK_BLOCK_WORDS = 64;
+
+  parlay::sequence<uint64_t> words;
+  size_t n;
+
+  static size_t numWords(size_t n) { return (n + WORD_BITS - 1) / WORD_BITS; }
+  // mask of the bits [lo, hi) of a word; 0 <= lo < hi <= 64
+  static uint64_t rangeMask(size_t lo, size_t hi) {
+    uint64_t high = (hi == WORD_BITS) ? ~0ULL : ((1ULL << hi) - 1);
+    return high & ~((1ULL << lo) - 1);
+  }
+
+ public:
+  bitMask() : n(0) {}
+  bitMask(size_t n, bool value = false) : words(numWords(n), value ? ~0ULL : 0ULL), n(n) {}
+
+  size_t size() const { return n; }
+  size_t capacity() const { return words.capacity(); }
+  size_t memory_footprint() const { return words.capacity() * sizeof(uint64_t); }
+
+  bool operator[](size_t i) const { return (words[i / WORD_BITS] >> (i % WORD_BITS)) & 1; }
+
+  void set(size_t i) {
+    __atomic_fetch_or(&words[i / WORD_BITS], 1ULL << (i % WORD_BITS), __ATOMIC_RELAXED);
+  }
+  void reset(size_t i) {
+    __atomic_fetch_and(&words[i / WORD_BITS], ~(1ULL << (i % WORD_BITS)), __ATOMIC_RELAXED);
+  }
+  // reset bit i; return whether this call cleared it (false if it was already clear)
+  bool testAndReset(size_t i) {
+    uint64_t bit = 1ULL << (i % WORD_BITS);
+    return __atomic_fetch_and(&words[i / WORD_BITS], ~bit, __ATOMIC_RELAXED) & bit;
+  }
+
+  /*!
+   * The bits [pos, pos + len) as the low bits of a word; len <= 64.
+   */
+  uint64_t getBits(size_t pos, size_t len) const {
+    assert(len <= WORD_BITS && pos + len <= n);
+    if (len == 0) return 0;
+    size_t w = pos / WORD_BITS, off = pos % WORD_BITS;
+    uint64_t ret = words[w] >> off;
+    if (off != 0 && off + len > WORD_BITS) ret |= words[w + 1] << (WORD_BITS - off);
+    return (len == WORD_BITS) ? ret : (ret & ((1ULL << len) - 1));
+  }
+
+  /*!
+   * Set the bits [s, e) to [value]. Only the two boundary words are written atomically, so this
+   * must not race with writes to the interior of the range.
+   */
+  template <bool parallel = false>
+  void assign(size_t s, size_t e, bool value) {
+    if (s >= e) return;
+    size_t ws = s / WORD_BITS, we = (e - 1) / WORD_BITS;
+    auto write = [&](size_t w, uint64_t m) {
+      if (value)
+        __atomic_fetch_or(&words[w], m, __ATOMIC_RELAXED);
+      else
+        __atomic_fetch_and(&words[w], ~m, __ATOMIC_RELAXED);
+    };
+    if (ws == we) {
+      write(ws, rangeMask(s % WORD_BITS, e - we * WORD_BITS));
+      return;
+    }
+    write(ws, rangeMask(s % WORD_BITS, WORD_BITS));
+    write(we, rangeMask(0, e - we * WORD_BITS));
+    uint64_t fill = value ? ~0ULL : 0ULL;
+    if (parallel) {
+      parlay::parallel_for(ws + 1, we, [&](size_t w) { words[w] = fill; });
+    } else {
+      for (size_t w = ws + 1; w < we; w++)
+        words[w] = fill;
+    }
+  }
+
+  template <bool parallel = false>
+  void assign(bool value) {
+    assign<parallel>(0, n, value);
+  }
+
+  // number of set bits in [s, e)
+  size_t count(size_t s, size_t e) const {
+    size_t ret = 0;
+    for (size_t i = s; i < e; i += WORD_BITS)
+      ret += __builtin_popcountll(getBits(i, std::min(WORD_BITS, e - i)));
+    return ret;
+  }
+
+  // whether all of the bits [s, e) are set
+  bool all(size_t s, size_t e) const {
+    for (size_t i = s; i < e; i += WORD_BITS) {
+      auto len = std::min(WORD_BITS, e - i);
+      if (getBits(i, len) != rangeMask(0, len)) return false;
+    }
+    return true;
+  }
+
+  /*!
+   * Copy src[i - s] for every set bit i in [s, e) to the front of [dest], in order; return the
+   * number of items copied. Runs of 64 live items are copied as a block, empty words are skipped.
+   */
+  template <class T, class outIt>
+  size_t packInto(const T *src, size_t s, size_t e, outIt dest) const {
+    size_t ret = 0;
+    for (size_t i = s; i < e; i += WORD_BITS) {
+      auto len = std::min(WORD_BITS, e - i);
+      auto bits = getBits(i, len);
+      if (bits == rangeMask(0, len)) {
+        std::copy(src + (i - s), src + (i - s) + len, dest + ret);
+        ret += len;
+      } else {
+        while (bits != 0) {
+          dest[ret++] = src[i - s + __builtin_ctzll(bits)];
+          bits &= bits - 1;
+        }
+      }
+    }
+    return ret;
+  }
+
+  // parallel version of the above: count each block, scan, then pack the blocks independently
+  template <class T, class outIt>
+  size_t packIntoParallel(const T *src, size_t s, size_t e, outIt dest) const {
+    constexpr size_t block = PACK_BLOCK_WORDS * WORD_BITS;
+    if (e - s <= block) return packInto(src, s, e, dest);
+    size_t num_blocks = (e - s + block - 1) / block;
+    auto offsets = parlay::tabulate(num_blocks, [&](size_t b) {
+      return count(s + b * block, std::min(e, s + (b + 1) * block));
+    });
+    size_t total = parlay::scan_inplace(offsets);
+    parlay::parallel_for(0, num_blocks, [&](size_t b) {
+      size_t bs = s + b * block;
+      packInto(src + (bs - s), bs, std::min(e, bs + block), dest + offsets[b]);
+    });
+    return total;
+  }
+};
+
+}  // End namespace batchKdTree
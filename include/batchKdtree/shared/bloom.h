@@ -23,6 +23,13 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #define XXH_PRIVATE_API
 #include <common/geometry.h>
 #include <parlay/parallel.h>
@@ -31,115 +38,101 @@
 
 namespace batchKdTree {
 
-#define ATOMIC_BUCKETS
-//#define BIT_VECTOR
-
+/*!
+ * Blocked Bloom filter: every key lives in a single 64-byte block, and sets one bit in each of
+ * the block's 8 words. The block and the 8 bit positions all come from one XXH64 of the
+ * coordinates (the positions by double hashing), so a probe is one hash and one cache miss. The
+ * filter has about 8 bits per key (for 8 probes, a false positive rate of a few percent).
+ */
 template <int dim>
 class BloomFilter {
-  static constexpr int NUM_ARRAYS = 4;
+  static constexpr int WORDS_PER_BLOCK = 8;
+  static constexpr int BITS_PER_KEY = 8;
+  static constexpr int KEYS_PER_BLOCK = 64 * WORDS_PER_BLOCK / BITS_PER_KEY;
   static constexpr int EMPTY_BUCKETS_GRANULARITY = 1024;
   static constexpr int FILL_BUCKETS_GRANULARITY = 1024;
 
-#ifdef ATOMIC_BUCKETS
-#ifdef BIT_VECTOR
-  typedef char bucketT;
-#else
-  typedef bool bucketT;
-#endif
-  std::atomic<bucketT> *buckets[NUM_ARRAYS];
-#else
-  std::vector<char> buckets[NUM_ARRAYS];
-#endif
+  struct alignas(64) block {
+    uint64_t words[WORDS_PER_BLOCK];
+  };
+  static_assert(sizeof(block) == 64, "a block should be one cache line");
 
   typedef point<dim> pointT;
 
-  const size_t num_buckets;
-  const size_t buckets_size;
+  size_t num_blocks;
+  block *blocks = nullptr;  // allocated by the first insert, see [release]
 
-  size_t hash(const pointT &p, int bucket_num) {
-    auto h = (uint64_t)XXH64(p.x, dim * sizeof(double), bucket_num);
-    return h % num_buckets;
+  void allocate() {
+    if (blocks != nullptr) return;
+    blocks = static_cast<block *>(std::aligned_alloc(sizeof(block), num_blocks * sizeof(block)));
+    if (blocks == nullptr) throw std::bad_alloc();
+    std::fill(blocks, blocks + num_blocks, block());
   }
 
-  static inline bool bit_set(char val, int bit) { return ((val) & (1 << bit)) != 0; }
-  static inline char set_bit(char val, int bit) { return ((val) | (1 << bit)); }
-
-  bool get(int j, size_t idx) {
-#ifdef ATOMIC_BUCKETS
-#ifdef BIT_VECTOR
-    return bit_set(buckets[j][idx / 8], idx % 8);
-#else
-    return buckets[j][idx];
-#endif
-#else
-    return buckets[j][idx];
-#endif
+  // return the block of [p]; write the bit of [p] in each of its words to [masks]
+  size_t locate(const pointT &p, uint64_t *masks) const {
+    auto h = (uint64_t)XXH64(p.x, dim * sizeof(double), 0);
+    auto g = (uint32_t)h;                                          // first probe
+    auto step = (uint32_t)((h * 0x9E3779B97F4A7C15ULL) >> 32) | 1;  // odd stride
+    for (int i = 0; i < WORDS_PER_BLOCK; i++)
+      masks[i] = 1ULL << ((g + i * step) >> 26);  // top 6 bits
+    // map the high half of the hash onto [0, num_blocks) without a division
+    return ((h >> 32) * num_blocks) >> 32;
   }
 
-  void set(int j, size_t idx) {
-    if (!get(j, idx)) {
-#ifdef ATOMIC_BUCKETS
-#ifdef BIT_VECTOR
-      bucketT exp = buckets[j][idx / 8];
-      while (!buckets[j][idx / 8].compare_exchange_weak(exp, set_bit(exp, idx % 8)) &&
-             !bit_set(exp, idx % 8))
-        ;
-#else
-      bucketT exp = 0;
-      buckets[j][idx].compare_exchange_strong(exp, 1);
-#endif
+  static bool contains(const block &b, const uint64_t *masks) {
+#if defined(__AVX2__)
+    auto w = reinterpret_cast<const __m256i *>(b.words);
+    auto m = reinterpret_cast<const __m256i *>(masks);
+    return _mm256_testc_si256(_mm256_load_si256(w), _mm256_loadu_si256(m)) &
+           _mm256_testc_si256(_mm256_load_si256(w + 1), _mm256_loadu_si256(m + 1));
 #else
-      buckets[j][idx] = 1;
+    uint64_t missing = 0;
+    for (int i = 0; i < WORDS_PER_BLOCK; i++)
+      missing |= masks[i] & ~b.words[i];
+    return missing == 0;
 #endif
-    }
   }
 
  public:
   BloomFilter(size_t num_points)
-      : num_buckets(num_points * 2),
-        buckets_size(
-#ifdef BIT_VECTOR
-            (num_points * 2 + 7) / 8
-#else
-            num_points * 2
-#endif
-        ) {
-    // TODO: compute better bound for [num_buckets]
-    for (int i = 0; i < NUM_ARRAYS; i++) {
-#ifdef ATOMIC_BUCKETS
-      buckets[i] = new std::atomic<bucketT>[buckets_size];
-#else
-      buckets[i].resize(buckets_size, 0);
-#endif
-    }
+      : num_blocks(std::max<size_t>(1, (num_points + KEYS_PER_BLOCK - 1) / KEYS_PER_BLOCK)) {}
+  BloomFilter(const BloomFilter &other) : num_blocks(other.num_blocks) {
+    if (other.blocks == nullptr) return;
+    allocate();
+    std::copy(other.blocks, other.blocks + num_blocks, blocks);
   }
+  BloomFilter &operator=(const BloomFilter &) = delete;
+
+  ~BloomFilter() { release(); }
 
-#ifdef ATOMIC_BUCKETS
-  ~BloomFilter() {
-    for (int i = 0; i < NUM_ARRAYS; i++) {
-      delete[] buckets[i];
-    }
+  // free the blocks; the filter is empty until the next insert
+  void release() {
+    std::free(blocks);
+    blocks = nullptr;
   }
-#endif
 
   void clear() {
-    // empty buckets
-    parlay::parallel_for(0, NUM_ARRAYS, [&](size_t i) {
-      parlay::parallel_for(
-          0, buckets_size, [&](size_t j) { buckets[i][j] = 0; }, EMPTY_BUCKETS_GRANULARITY);
-    });
+    if (blocks == nullptr) return;
+    parlay::parallel_for(
+        0, num_blocks, [&](size_t i) { blocks[i] = block(); }, EMPTY_BUCKETS_GRANULARITY);
   }
 
+  // the number of bytes held by the blocks
+  size_t memory_footprint() const { return blocks ? num_blocks * sizeof(block) : 0; }
+
   template <class R>
   void insert(const R &points) {
-    // set buckets
+    allocate();
     parlay::parallel_for(
         0,
         points.size(),
         [&](size_t i) {
-          for (int j = 0; j < NUM_ARRAYS; j++) {
-            auto idx = hash(points[i], j);
-            set(j, idx);
+          uint64_t masks[WORDS_PER_BLOCK];
+          auto &b = blocks[locate(points[i], masks)];
+          for (int j = 0; j < WORDS_PER_BLOCK; j++) {
+            if ((__atomic_load_n(&b.words[j], __ATOMIC_RELAXED) & masks[j]) == 0)
+              __atomic_fetch_or(&b.words[j], masks[j], __ATOMIC_RELAXED);
           }
         },
         FILL_BUCKETS_GRANULARITY);
@@ -151,17 +144,16 @@ class BloomFilter {
     insert(points);
   }
 
-  bool might_contain(const point<dim> &p) {
-    for (int i = 0; i < NUM_ARRAYS; i++) {
-      auto idx = hash(p, i);
-      if (!get(i, idx)) return false;
-    }
-    return true;
+  bool might_contain(const point<dim> &p) const {
+    if (blocks == nullptr) return false;
+    uint64_t masks[WORDS_PER_BLOCK];
+    return contains(blocks[locate(p, masks)], masks);
   }
 
   template <class R>
-  parlay::sequence<point<dim>> filter(const R &points) {
-    return parlay::filter(points, [this](const point<dim> &p) { return this->might_contain(p); });
+  auto filter(const R &points) const {
+    typedef std::decay_t<decltype(points[0])> objT;
+    return parlay::filter(points, [this](const objT &p) { return this->might_contain(p); });
   }
 };
 
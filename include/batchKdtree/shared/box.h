@@ -75,11 +75,12 @@ inline BoxComparison boxCompare(const point<dim> &pMin1,
 
 // Assumes the nodes have up-to-date bounding boxes!
 // Taken from: https://github.com/scipy/scipy/blob/v1.6.3/scipy/spatial/kdtree.py#L153-L165
+// Squared distance between two boxes: the knn searches compare in squared space throughout.
 template <int dim>
-double BoundingBoxDistance(const point<dim> &pMin1,
-                           const point<dim> &pMax1,
-                           const point<dim> &pMin2,
-                           const point<dim> &pMax2) {
+inline double BoundingBoxDistanceSqr(const point<dim> &pMin1,
+                                     const point<dim> &pMax1,
+                                     const point<dim> &pMin2,
+                                     const point<dim> &pMax2) {
   double dist = 0;
   for (int i = 0; i < dim; ++i) {
     // compute the shortest distance in this dimension
@@ -88,7 +89,42 @@ double BoundingBoxDistance(const point<dim> &pMin1,
     dim_val = std::max(dim_val, pMin2.coordinate(i) - pMax1.coordinate(i));
     dist += dim_val * dim_val;
   }
-  return std::sqrt(dist);
+  return dist;
+}
+
+template <int dim>
+double BoundingBoxDistance(const point<dim> &pMin1,
+                           const point<dim> &pMax1,
+                           const point<dim> &pMin2,
+                           const point<dim> &pMax2) {
+  return std::sqrt(BoundingBoxDistanceSqr(pMin1, pMax1, pMin2, pMax2));
+}
+
+/*!
+ * <Serial> Compare the ball of squared radius [rSqr] around [q] to a box, in the manner of
+ * [BoundingBoxDistanceSqr].
+ * @return BOX_INCLUDE if the ball contains the whole box, BOX_EXCLUDE if it misses it entirely
+ */
+template <int dim>
+inline BoxComparison ballCompare(const point<dim> &q,
+                                 double rSqr,
+                                 const point<dim> &pMin,
+                                 const point<dim> &pMax) {
+  double near = 0, far = 0;
+  for (int i = 0; i < dim; ++i) {
+    double below = pMin.coordinate(i) - q.coordinate(i);
+    double above = q.coordinate(i) - pMax.coordinate(i);
+    double near_i = std::max(0.0, std::max(below, above));
+    double far_i = std::max(std::abs(below), std::abs(above));
+    near += near_i * near_i;
+    far += far_i * far_i;
+  }
+  if (near > rSqr)
+    return BOX_EXCLUDE;
+  else if (far <= rSqr)
+    return BOX_INCLUDE;
+  else
+    return BOX_OVERLAP;
 }
 
 /*!
@@ -33,10 +33,14 @@
 namespace batchKdTree {
 
 // Top-level wrappers for calling dual knn
-template <int dim, class objT, bool parallel, bool coarsen>
-parlay::sequence<const point<dim> *> dualKnn(parlay::sequence<objT> &queries,
-                                             const KdTree<dim, objT, parallel, coarsen> &rTree,
-                                             int k) {
+// [queries] is reordered in place; the results for queries[i] are written to
+// res[i * k, (i + 1) * k). [approx] selects approximate search (see knnbuffer.h)
+template <int dim, class objT, bool parallel, bool coarsen, class outT>
+void dualKnn(parlay::sequence<objT> &queries,
+             const KdTree<dim, objT, parallel, coarsen> &rTree,
+             int k,
+             parlay::slice<outT *, outT *> res,
+             const knnBuf::knnApprox &approx = knnBuf::knnApprox()) {
   // construct query tree
 #ifdef PRINT_DKNN_TIMINGS
   timer t;
@@ -47,10 +51,8 @@ parlay::sequence<const point<dim> *> dualKnn(parlay::sequence<objT> &queries,
   std::cout << "[DKNN] Query Tree Construction: " << t.get_next() << "\n";
 #endif
 
-  auto ret = rTree.dualKnnBase(qTree, k);  // call dual knn
-  queries = std::move(qTree.items);        // move the query points back
-
-  return ret;
+  rTree.dualKnnBase(qTree, k, res, approx);  // call dual knn
+  queries = std::move(qTree.items);  // move the query points back
 }
 
 template <int NUM_TREES,         // the number of static trees
@@ -58,11 +60,13 @@ template <int NUM_TREES,         // the number of static trees
           int dim,
           class objT,
           bool parallel,
-          bool coarsen>
-parlay::sequence<const point<dim> *> dualKnn(
-    parlay::sequence<objT> &queries,
-    const LogTree<NUM_TREES, BUFFER_LOG2_SIZE, dim, objT, parallel, coarsen> &rTree,
-    int k) {
+          bool coarsen,
+          class outT>
+void dualKnn(parlay::sequence<objT> &queries,
+             const LogTree<NUM_TREES, BUFFER_LOG2_SIZE, dim, objT, parallel, coarsen> &rTree,
+             int k,
+             parlay::slice<outT *, outT *> res,
+             const knnBuf::knnApprox &approx = knnBuf::knnApprox()) {
   // construct query tree
 #ifdef PRINT_DKNN_TIMINGS
   timer t;
@@ -73,9 +77,34 @@ parlay::sequence<const point<dim> *> dualKnn(
   std::cout << "[DKNN] Query Tree Construction: " << t.get_next() << "\n";
 #endif
 
-  auto ret = rTree.dualKnnBase(qTree, k);  // call dual knn
-  queries = std::move(qTree.items);        // move the query points back
+  rTree.dualKnnBase(qTree, k, res, approx);  // call dual knn
+  queries = std::move(qTree.items);  // move the query points back
+}
 
+template <int dim, class objT, bool parallel, bool coarsen>
+parlay::sequence<const point<dim> *> dualKnn(
+    parlay::sequence<objT> &queries,
+    const KdTree<dim, objT, parallel, coarsen> &rTree,
+    int k,
+    const knnBuf::knnApprox &approx = knnBuf::knnApprox()) {
+  parlay::sequence<const point<dim> *> ret(k * queries.size());
+  dualKnn(queries, rTree, k, ret.head(ret.size()), approx);
+  return ret;
+}
+
+template <int NUM_TREES,         // the number of static trees
+          int BUFFER_LOG2_SIZE,  // the size of the (dynamic) buffer tree
+          int dim,
+          class objT,
+          bool parallel,
+          bool coarsen>
+parlay::sequence<const point<dim> *> dualKnn(
+    parlay::sequence<objT> &queries,
+    const LogTree<NUM_TREES, BUFFER_LOG2_SIZE, dim, objT, parallel, coarsen> &rTree,
+    int k,
+    const knnBuf::knnApprox &approx = knnBuf::knnApprox()) {
+  parlay::sequence<const point<dim> *> ret(k * queries.size());
+  dualKnn(queries, rTree, k, ret.head(ret.size()), approx);
   return ret;
 }
 
@@ -131,8 +160,8 @@ void DualKnnHelper(kdNode<dim, objT, parallel> *Q,
   // used below for the one-sided recursion cases
   auto one_sided_recurse =
       [&](bool recurseInParallel, nodeT *Q1, const nodeT *R1, nodeT *Q2, const nodeT *R2) {
-        auto dist1 = KdNodeBoundingBoxDistance(Q1, R1);
-        auto dist2 = KdNodeBoundingBoxDistance(Q2, R2);
+        auto dist1 = KdNodeBoundingBoxDistanceSqr(Q1, R1);
+        auto dist2 = KdNodeBoundingBoxDistanceSqr(Q2, R2);
         if (dist1 < dist2) {  // 1 before 2
           if (recurseInParallel) {
             parlay::par_do([&]() { recurse(Q1, R1); }, [&]() { recurse(Q2, R2); });
@@ -151,9 +180,9 @@ void DualKnnHelper(kdNode<dim, objT, parallel> *Q,
       };
 
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
-  if (KdNodeBoundingBoxDistance(Q, R) > dualKnnDists[qTree.node_idx(Q)]) {
+  if (KdNodeBoundingBoxDistanceSqr(Q, R) > dualKnnDists[qTree.node_idx(Q)]) {
 #else
-  if (KdNodeBoundingBoxDistance(Q, R) > Q->dualKnnDist) {
+  if (KdNodeBoundingBoxDistanceSqr(Q, R) > Q->dualKnnDist) {
 #endif
     // definitely no updates here
     return;
@@ -164,7 +193,7 @@ void DualKnnHelper(kdNode<dim, objT, parallel> *Q,
     auto q_end = Q->getEndValue() - q_items.begin();
     assert(q_end > q_start);
     assert(q_start >= 0);
-    assert(Q->subtree_items.size() == (size_t)(q_end - q_start));
+    assert(Q->subtreeItems().size() == (size_t)(q_end - q_start));
     assert(qTree.size() == q_items.size());
 
     // leaves are small -> don't bother parallelizing
@@ -173,13 +202,20 @@ void DualKnnHelper(kdNode<dim, objT, parallel> *Q,
       assert(q_idx >= 0);
       assert(q_idx < bufs.size());
       auto &q_out = bufs[q_idx];
-      auto q_radius = q_out.hasK() ? q_out.keepK().cost : std::numeric_limits<double>::max();
+      auto q_radius = q_out.hasK() ? q_out.pruneRadius() : std::numeric_limits<double>::max();
 
-      // relax in all the points in R
-      R->knnAddToBuffer(q_items[q_idx], rTree.items.begin(), rTree.present, q_out, q_radius);
+      // relax in all the points in R, unless an approximate search spent its leaf budget
+      if (!q_out.outOfLeaves()) {
+        R->knnAddToBuffer(q_items[q_idx],
+                          rTree.items.begin(),
+                          rTree.present,
+                          rTree.getLeafMirror(),
+                          q_out,
+                          q_radius);
+      }
 
       // update the new radius
-      auto q_new_radius = q_out.hasK() ? q_out.keepK().cost : std::numeric_limits<double>::max();
+      auto q_new_radius = q_out.hasK() ? q_out.pruneRadius() : std::numeric_limits<double>::max();
       Q_new_radius = std::max(Q_new_radius, q_new_radius);
     }
 
@@ -196,20 +232,21 @@ void DualKnnHelper(kdNode<dim, objT, parallel> *Q,
 
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
     dualKnnDists[qTree.node_idx(Q)] =
-        std::max(dualKnnDists[qTree.node_idx(Q->left)], dualKnnDists[qTree.node_idx(Q->right)]);
+        std::max(dualKnnDists[qTree.node_idx(Q->getLeft())],
+                 dualKnnDists[qTree.node_idx(Q->getRight())]);
 #else
-    Q->update_dual_knn_dist(std::max(Q->left->dualKnnDist, Q->right->dualKnnDist));
+    Q->update_dual_knn_dist(std::max(Q->getLeft()->dualKnnDist, Q->getRight()->dualKnnDist));
 #endif
   } else {  // neither is leaf, all 4 recursive steps
-    auto QlRl_dist = KdNodeBoundingBoxDistance(Q->getLeft(), R->getLeft());
-    auto QlRr_dist = KdNodeBoundingBoxDistance(Q->getLeft(), R->getRight());
+    auto QlRl_dist = KdNodeBoundingBoxDistanceSqr(Q->getLeft(), R->getLeft());
+    auto QlRr_dist = KdNodeBoundingBoxDistanceSqr(Q->getLeft(), R->getRight());
     // closer R child to Q->getLeft()
     auto Ql_R1 = (QlRl_dist < QlRr_dist) ? R->getLeft() : R->getRight();
     // further R child to Q->getLeft()
     auto Ql_R2 = (QlRl_dist < QlRr_dist) ? R->getRight() : R->getLeft();
 
-    auto QrRl_dist = KdNodeBoundingBoxDistance(Q->getRight(), R->getLeft());
-    auto QrRr_dist = KdNodeBoundingBoxDistance(Q->getRight(), R->getRight());
+    auto QrRl_dist = KdNodeBoundingBoxDistanceSqr(Q->getRight(), R->getLeft());
+    auto QrRr_dist = KdNodeBoundingBoxDistanceSqr(Q->getRight(), R->getRight());
     auto Qr_R1 = (QrRl_dist < QrRr_dist) ? R->getLeft() : R->getRight();
     auto Qr_R2 = (QrRl_dist < QrRr_dist) ? R->getRight() : R->getLeft();
 
@@ -226,9 +263,10 @@ void DualKnnHelper(kdNode<dim, objT, parallel> *Q,
     }
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
     dualKnnDists[qTree.node_idx(Q)] =
-        std::max(dualKnnDists[qTree.node_idx(Q->left)], dualKnnDists[qTree.node_idx(Q->right)]);
+        std::max(dualKnnDists[qTree.node_idx(Q->getLeft())],
+                 dualKnnDists[qTree.node_idx(Q->getRight())]);
 #else
-    Q->update_dual_knn_dist(std::max(Q->left->dualKnnDist, Q->right->dualKnnDist));
+    Q->update_dual_knn_dist(std::max(Q->getLeft()->dualKnnDist, Q->getRight()->dualKnnDist));
 #endif
   }
 }
@@ -24,19 +24,34 @@
 #pragma once
 
 #include <atomic>
+#include <limits>
+#include <memory>
 #include "parlay/parallel.h"
 #include "parlay/sequence.h"
 #include "common/geometry.h"
 
 #include "macro.h"
+#include "tuning.h"
 #include "knnbuffer.h"
 #include "box.h"
+#include "leafscan.h"
+#include "bitmask.h"
 
 namespace batchKdTree {
 
 template <int dim, class objT, bool parallel, bool coarsen>
 class KdTree;
 
+/*!
+ * The left-child counts [kdNode::orthogonalCount] (or [kdNode::ballCount]) found where it recursed
+ * in parallel, in the shape of that recursion. [kdNode::orthogonalFill] ([kdNode::ballFill]) reads
+ * them to place the right child's output instead of counting the left child again.
+ */
+struct rangeCountTree {
+  size_t left_count = 0;
+  std::unique_ptr<rangeCountTree> left, right;
+};
+
 // make dim intrinsic to objt todo
 template <int dim, class objT, bool parallel>
 class kdNode {
@@ -46,8 +61,7 @@ class kdNode {
   typedef kdNode<dim, objT, parallel> nodeT;
 
   // TODO: split leaf/non-leaf node data
-  // leaf nodes
-  int num_points;
+  int num_points;  // number of present items in the subtree
   // non-leaf node
   int split_dimension;  // TODO: think about making this dynamic, instead of alternating
   floatT split_value;
@@ -68,23 +82,22 @@ class kdNode {
 #endif
 
   bool computeRangeQueryInParallel() const {
-    return false;
     if (!left || !right) return false;  // only one child
-    return subtree_items.size() >= RANGEQUERY_BASE_CASE;
+    return subtree_items.size() >= tuning().rangequery_base_case;
   }
   bool computeBoundingBoxInParallel() const {
     if (!left || !right) return false;  // only one child
-    return subtree_items.size() >= BOUNDINGBOX_BASE_CASE;
+    return subtree_items.size() >= tuning().boundingbox_base_case;
   }
   bool dualKnnRecurseInParallel() const {
     if (!left || !right) return false;  // only one child
-    return subtree_items.size() >= DUALKNN_BASE_CASE;
+    return subtree_items.size() >= tuning().dualknn_base_case;
   }
 
  public:
   // non-leaf
   kdNode(int split_dimension_, floatT split_value_, parlay::slice<objT *, objT *> subtree_items_)
-      : num_points(-1),
+      : num_points(subtree_items_.size()),
         split_dimension(split_dimension_),
         split_value(split_value_),
         subtree_items(std::move(subtree_items_)),
@@ -99,7 +112,6 @@ class kdNode {
   // leaf
   kdNode(parlay::slice<objT *, objT *> subtree_items_) : kdNode(-1, 0, subtree_items_) {
     assert(subtree_items.size() > 0);
-    num_points = subtree_items.size();
     pMin = pointT(subtree_items[0].coordinate());
     pMax = pointT(subtree_items[0].coordinate());
     for (const auto &pt : subtree_items) {
@@ -121,10 +133,10 @@ class kdNode {
                       parlay::sequence<double> &dualKnnDists) {
 #endif
     double new_rad = 0;
-    if (isLeaf() && buf_slice[subtree_items.begin() - tree_start].hasK()) {
-      for (auto it = subtree_items.begin(); it != subtree_items.end(); ++it) {
+    if (isLeaf() && buf_slice[getStartValue() - tree_start].hasK()) {
+      for (auto it = getStartValue(); it != getEndValue(); ++it) {
         auto idx = it - tree_start;
-        new_rad = std::max(new_rad, buf_slice[idx].keepK().cost);
+        new_rad = std::max(new_rad, buf_slice[idx].pruneRadius());
       }
     } else {
       auto update_node = [&](kdNode<dim, objT, parallel> *n) {
@@ -181,7 +193,6 @@ class kdNode {
 #endif
 
   void removePoints(int num) {
-    assert(isLeaf());
     assert(num >= 0);
     assert(num <= num_points);
     num_points -= num;
@@ -191,7 +202,8 @@ class kdNode {
   void setEmpty() { split_dimension = -2; }
 
   void recomputeBoundingBox() {
-    // assumes child bounding boxes are computed
+    // assumes child bounding boxes (and counts) are computed
+    if (!isLeaf()) num_points = (left ? left->num_points : 0) + (right ? right->num_points : 0);
     if (left && right) {
       pMin = pointT(left->getMin().coordinate());
       pMax = pointT(left->getMax().coordinate());
@@ -208,10 +220,10 @@ class kdNode {
     }
   }
 
-  void recomputeBoundingBoxLeaf(const objT *tree_start, const parlay::sequence<bool> &present) {
+  void recomputeBoundingBoxLeaf(const objT *tree_start, const bitMask &present) {
     assert(isLeaf());
     bool first = true;
-    for (auto it = subtree_items.begin(); it != subtree_items.end(); ++it) {
+    for (auto it = getStartValue(); it != getEndValue(); ++it) {
       if (present[it - tree_start]) {
         if (first) {
           pMin = pointT(it->coordinate());
@@ -225,6 +237,23 @@ class kdNode {
     }
   }
 
+  // point the subtree at a copy of its tree's items and nodes: [old_items] moved to [new_items] and
+  // [old_nodes] to [new_nodes]
+  void rebase(const objT *old_items, objT *new_items, const nodeT *old_nodes, nodeT *new_nodes) {
+    subtree_items = parlay::slice<objT *, objT *>(
+        new_items + (subtree_items.begin() - old_items),
+        new_items + (subtree_items.end() - old_items));
+    if (left) left = new_nodes + (left - old_nodes);
+    if (right) right = new_nodes + (right - old_nodes);
+    if (parallel && computeBoundingBoxInParallel()) {
+      parlay::par_do([&]() { left->rebase(old_items, new_items, old_nodes, new_nodes); },
+                     [&]() { right->rebase(old_items, new_items, old_nodes, new_nodes); });
+    } else {
+      if (left) left->rebase(old_items, new_items, old_nodes, new_nodes);
+      if (right) right->rebase(old_items, new_items, old_nodes, new_nodes);
+    }
+  }
+
   // recompute for entire subtree
   void recomputeBoundingBoxSubtree() {
     if (parallel && computeBoundingBoxInParallel()) {
@@ -245,16 +274,14 @@ class kdNode {
   bool isLeaf() const { return (left == nullptr) && (right == nullptr); }
   bool isEmpty() const { return split_dimension == -2; }
 
-  int countPoints() const {
-    if (isLeaf()) return num_points;
-    return left->countPoints() + right->countPoints();
-  }
+  int countPoints() const { return num_points; }
 
-  const auto &getValues() const {
+  parlay::slice<objT *, objT *> getValues() const {
     assert(isLeaf());
-    return subtree_items;
+    return subtreeItems();
   }
 
+  parlay::slice<objT *, objT *> subtreeItems() const { return subtree_items; }
   const objT *getStartValue() const { return subtree_items.begin(); }
   const objT *getEndValue() const { return subtree_items.end(); }
 
@@ -282,229 +309,314 @@ class kdNode {
   // return right->contains(p);
   //}
 
-  // TODO: can probably make this recurse more intelligently if we precompute return sizes
-  void orthogonalQuery(const objT &qMin,
-                       const objT &qMax,
-                       const objT *tree_start,
-                       const parlay::sequence<bool> &present,
-                       parlay::sequence<objT> &ret) const {
-    auto cmp = boxCompare(qMin, qMax, pMin, pMax);
-    if (cmp == BOX_EXCLUDE) {
-      return;
-    } else if (cmp == BOX_INCLUDE) {  // query box contains node box -> take all the points
-      // allocate space for new points
-      auto orig_ret_size = ret.size();
-      ret.resize(ret.size() + subtree_items.size());  // TODO: precompute the exact size
-
-      // compute [present] subarray
-      auto start = getStartValue() - tree_start;
-      auto end = getEndValue() - tree_start;
-      assert(end > start);
-      assert(subtree_items.size() == (size_t)(end - start));
-
-      auto num_added = parlay::pack_into(
-          subtree_items, present.cut(start, end), ret.cut(orig_ret_size, ret.size()));
-
-      // resize
-      ret.resize(orig_ret_size + num_added);
-    } else {
-      assert(cmp == BOX_OVERLAP);
-      if (isLeaf()) {
-        // TODO: maybe do this more intelligently? (precompute and/or parallelize)
-        for (auto it = subtree_items.begin(); it != subtree_items.end(); ++it) {
-          if (present[it - tree_start] && itemInBox(qMin, qMax, it)) {
-            ret.push_back(it);
-          }
-        }
-      } else if (parallel && computeRangeQueryInParallel()) {
-        assert(left);
-        assert(right);
-
-        parlay::sequence<objT> right_ret;
-
-        parlay::par_do(
-            [&]() { left->orthogonalQuery(qMin, qMax, tree_start, present, ret); },
-            [&]() { right->orthogonalQuery(qMin, qMax, tree_start, present, right_ret); });
-
-        // put right_ret into ret
-        ret.insert(ret.begin() + ret.size(), right_ret.begin(), right_ret.end());
-      } else {
-        if (left) left->orthogonalQuery(qMin, qMax, tree_start, present, ret);
-        if (right) right->orthogonalQuery(qMin, qMax, tree_start, present, ret);
+  // call f(item) for every present item of this leaf that is in the box [qMin, qMax]
+  template <class F>
+  void leafInBoxForEach(const pointT &qMin,
+                        const pointT &qMax,
+                        const objT *tree_start,
+                        const bitMask &present,
+                        const leafMirror<dim> &mirror,
+                        F f) const {
+    assert(isLeaf());
+    size_t start = getStartValue() - tree_start;
+    bool in_box[LEAF_SCAN_BLOCK];
+    for (size_t b = 0; b < subtree_items.size(); b += LEAF_SCAN_BLOCK) {
+      auto n = std::min(LEAF_SCAN_BLOCK, subtree_items.size() - b);
+      if (!mirror.empty()) leafInBox(mirror, start + b, n, qMin, qMax, in_box);  // a block at once
+      for (auto live = present.getBits(start + b, n); live != 0; live &= live - 1) {
+        auto i = __builtin_ctzll(live);
+        auto it = subtree_items.begin() + b + i;
+        if (mirror.empty() ? itemInBox(qMin, qMax, it) : in_box[i]) f(*it);
       }
     }
   }
 
-#if FEWER_SQRT == 1
-
-  void knnAddToBuffer(const pointT &q,
-                      const objT *tree_start,
-                      const parlay::sequence<bool> &present,
-                      knnBuf::buffer<const pointT *> &out,
-                      double radiusSqr = std::numeric_limits<double>::max()) const {
-    // TODO: maybe parallelize?
-    auto start = getStartValue() - tree_start;
-    [[maybe_unused]] auto end = getEndValue() - tree_start;
-    assert(end > start);
-    assert(subtree_items.size() == (size_t)(end - start));
-
-    for (size_t i = 0; i < subtree_items.size(); i++) {
-      if (present[start + i]) {  // point isn't deleted
-        // auto dist = q.dist(subtree_items[i]);
-        auto dist = q.distSqr(subtree_items[i]);
-        if (dist <= radiusSqr) {  // point within radius of interest
-          const pointT *item_ptr = subtree_items.begin() + i;
-          out.insert(knnBuf::elem(dist, item_ptr));
-        }
+  // call f(item) for every present item of this leaf within distance sqrt([rSqr]) of [q]
+  template <class F>
+  void leafInBallForEach(const pointT &q,
+                         double rSqr,
+                         const objT *tree_start,
+                         const bitMask &present,
+                         const leafMirror<dim> &mirror,
+                         F f) const {
+    assert(isLeaf());
+    size_t start = getStartValue() - tree_start;
+    double dists[LEAF_SCAN_BLOCK];
+    for (size_t b = 0; b < subtree_items.size(); b += LEAF_SCAN_BLOCK) {
+      auto n = std::min(LEAF_SCAN_BLOCK, subtree_items.size() - b);
+      if (!mirror.empty()) leafDistSqr(mirror, start + b, n, q, dists);
+      for (auto live = present.getBits(start + b, n); live != 0; live &= live - 1) {
+        auto i = __builtin_ctzll(live);
+        auto it = subtree_items.begin() + b + i;
+        if ((mirror.empty() ? q.distSqr(*it) : dists[i]) <= rSqr) f(*it);
       }
     }
   }
 
-  template <bool update>
-  void knnPrune(const pointT &q,
-                const objT *tree_start,
-                const parlay::sequence<bool> &present,
-                double &radiusSqr,
-                pointT &qMin,
-                pointT &qMax,
-                knnBuf::buffer<const pointT *> &out) const {
-    if (update) {
-      // compute current radius
-      auto tmp = out.keepK();
-      auto newRadiusSqr = tmp.cost;
-
-      // update the query box if necessary
-      if (newRadiusSqr < radiusSqr) {
-        radiusSqr = newRadiusSqr;
-        double radius = sqrt(radiusSqr);
-        // create box based on radius
-        for (int i = 0; i < dim; i++) {
-          qMin[i] = q.coordinate(i) - radius;
-          qMax[i] = q.coordinate(i) + radius;
-        }
-      }
+  /*!
+   * The number of present items in the box [qMin, qMax]; this is the first pass of a range query,
+   * used to size the output of [orthogonalFill]. If [rec] is given, the counts the fill pass
+   * needs are recorded in it.
+   */
+  size_t orthogonalCount(const pointT &qMin,
+                         const pointT &qMax,
+                         const objT *tree_start,
+                         const bitMask &present,
+                         const leafMirror<dim> &mirror,
+                         rangeCountTree *rec = nullptr) const {
+    auto cmp = boxCompare(qMin, qMax, getMin(), getMax());
+    if (cmp == BOX_EXCLUDE) {
+      return 0;
+    } else if (cmp == BOX_INCLUDE) {  // query box contains node box -> count all the points
+      assert(present.count(getStartValue() - tree_start, getEndValue() - tree_start) ==
+             (size_t)num_points);
+      return num_points;
     }
-
-    // search only the intersection of the subtree with the radius-box
-    auto cmp = boxCompare(qMin, qMax, pMin, pMax);
-    switch (cmp) {
-      case BOX_EXCLUDE: {
-        return;
-      }
-      case BOX_INCLUDE: {
-        knnAddToBuffer(q, tree_start, present, out, radiusSqr);
-        break;
-      }
-      case BOX_OVERLAP: {
-        if (isLeaf()) {
-          knnAddToBuffer(q, tree_start, present, out, radiusSqr);
-        } else {
-          left->knnPrune<update>(q, tree_start, present, radiusSqr, qMin, qMax, out);
-          right->knnPrune<update>(q, tree_start, present, radiusSqr, qMin, qMax, out);
-        }
-        break;
+    assert(cmp == BOX_OVERLAP);
+    if (isLeaf()) {
+      size_t ret = 0;
+      leafInBoxForEach(qMin, qMax, tree_start, present, mirror, [&](const objT &) { ret++; });
+      return ret;
+    } else if (parallel && computeRangeQueryInParallel()) {
+      size_t left_count, right_count;
+      rangeCountTree *left_rec = nullptr, *right_rec = nullptr;
+      if (rec) {
+        rec->left = std::make_unique<rangeCountTree>();
+        rec->right = std::make_unique<rangeCountTree>();
+        left_rec = rec->left.get();
+        right_rec = rec->right.get();
       }
+      parlay::par_do(
+          [&]() {
+            left_count = left->orthogonalCount(qMin, qMax, tree_start, present, mirror, left_rec);
+          },
+          [&]() {
+            right_count =
+                right->orthogonalCount(qMin, qMax, tree_start, present, mirror, right_rec);
+          });
+      if (rec) rec->left_count = left_count;
+      return left_count + right_count;
+    } else {
+      size_t ret = 0;
+      if (left) ret += left->orthogonalCount(qMin, qMax, tree_start, present, mirror);
+      if (right) ret += right->orthogonalCount(qMin, qMax, tree_start, present, mirror);
+      return ret;
     }
   }
 
-  // Taken with modifications from:
-  // https://github.mit.edu/yiqiuw/pargeo/blob/master/knnSearch/kdTree/kdtKnn.h#L365
-  template <bool update, bool recurse_sibling>
-  void knnHelper(const pointT &q,
-                 const objT *tree_start,
-                 const parlay::sequence<bool> &present,
-                 knnBuf::buffer<const pointT *> &out) const {
-    // first, find the leaf
-    nodeT *other_child;
+  /*!
+   * Write the present items in the box [qMin, qMax] to [out], which must have room for
+   * [orthogonalCount] items; return the number written. Where the two children are filled in
+   * parallel, the right child's output goes after the left child's count, taken from [rec] (as
+   * recorded by [orthogonalCount] for the same box) or else counted here.
+   */
+  size_t orthogonalFill(const pointT &qMin,
+                        const pointT &qMax,
+                        const objT *tree_start,
+                        const bitMask &present,
+                        const leafMirror<dim> &mirror,
+                        objT *out,
+                        const rangeCountTree *rec = nullptr) const {
+    auto cmp = boxCompare(qMin, qMax, getMin(), getMax());
+    if (cmp == BOX_EXCLUDE) {
+      return 0;
+    } else if (cmp == BOX_INCLUDE) {  // query box contains node box -> take all the points
+      auto start = getStartValue() - tree_start;
+      auto end = getEndValue() - tree_start;
+      return (parallel && computeRangeQueryInParallel())
+                 ? present.packIntoParallel(subtree_items.begin(), start, end, out)
+                 : present.packInto(subtree_items.begin(), start, end, out);
+    }
+    assert(cmp == BOX_OVERLAP);
     if (isLeaf()) {
-      knnAddToBuffer(q, tree_start, present, out);
-      return;  // base case
+      size_t ret = 0;
+      leafInBoxForEach(
+          qMin, qMax, tree_start, present, mirror, [&](const objT &o) { out[ret++] = o; });
+      return ret;
+    } else if (parallel && computeRangeQueryInParallel()) {
+      assert(!rec || (rec->left && rec->right));
+      auto left_count =
+          rec ? rec->left_count : left->orthogonalCount(qMin, qMax, tree_start, present, mirror);
+      const rangeCountTree *left_rec = rec ? rec->left.get() : nullptr;
+      const rangeCountTree *right_rec = rec ? rec->right.get() : nullptr;
+      size_t right_count;
+      parlay::par_do(
+          [&]() { left->orthogonalFill(qMin, qMax, tree_start, present, mirror, out, left_rec); },
+          [&]() {
+            right_count = right->orthogonalFill(
+                qMin, qMax, tree_start, present, mirror, out + left_count, right_rec);
+          });
+      return left_count + right_count;
     } else {
-      if (q.coordinate(split_dimension) < split_value) {
-        // TODO: hint to compiler that [left] will pretty much never be null
-        if (left) left->knnHelper<update, recurse_sibling>(q, tree_start, present, out);
-        other_child = right;
-      } else {
-        if (right) right->knnHelper<update, recurse_sibling>(q, tree_start, present, out);
-        other_child = left;
-      }
+      size_t ret = 0;
+      if (left) ret += left->orthogonalFill(qMin, qMax, tree_start, present, mirror, out);
+      if (right) ret += right->orthogonalFill(qMin, qMax, tree_start, present, mirror, out + ret);
+      return ret;
     }
+  }
 
-    // now, check alternate children with aggressive pruning
-    if (!out.hasK()) {
-      // try finding knn on other child
-      if (recurse_sibling) {
-        other_child->knnHelper<update, recurse_sibling>(q, tree_start, present, out);
-      } else {
-        other_child->knnAddToBuffer(q, tree_start, present, out);
+  /*!
+   * The number of present items within distance sqrt([rSqr]) of [q], the first pass of a ball
+   * query, as [orthogonalCount] is for a box: subtrees inside the ball are answered from their
+   * counts, and [rec] records the counts [ballFill] needs.
+   */
+  size_t ballCount(const pointT &q,
+                   double rSqr,
+                   const objT *tree_start,
+                   const bitMask &present,
+                   const leafMirror<dim> &mirror,
+                   rangeCountTree *rec = nullptr) const {
+    auto cmp = ballCompare(q, rSqr, getMin(), getMax());
+    if (cmp == BOX_EXCLUDE) {
+      return 0;
+    } else if (cmp == BOX_INCLUDE) {  // ball contains node box -> count all the points
+      assert(present.count(getStartValue() - tree_start, getEndValue() - tree_start) ==
+             (size_t)num_points);
+      return num_points;
+    }
+    assert(cmp == BOX_OVERLAP);
+    if (isLeaf()) {
+      size_t ret = 0;
+      leafInBallForEach(q, rSqr, tree_start, present, mirror, [&](const objT &) { ret++; });
+      return ret;
+    } else if (parallel && computeRangeQueryInParallel()) {
+      size_t left_count, right_count;
+      rangeCountTree *left_rec = nullptr, *right_rec = nullptr;
+      if (rec) {
+        rec->left = std::make_unique<rangeCountTree>();
+        rec->right = std::make_unique<rangeCountTree>();
+        left_rec = rec->left.get();
+        right_rec = rec->right.get();
       }
+      parlay::par_do(
+          [&]() { left_count = left->ballCount(q, rSqr, tree_start, present, mirror, left_rec); },
+          [&]() {
+            right_count = right->ballCount(q, rSqr, tree_start, present, mirror, right_rec);
+          });
+      if (rec) rec->left_count = left_count;
+      return left_count + right_count;
     } else {
-      double radiusSqr = std::numeric_limits<double>::max();
-      pointT qMin, qMax;
-
-      if (!update) {
-        // compute current radius
-        auto tmp = out.keepK();
-        auto newRadiusSqr = tmp.cost;
-
-        // update the query box if necessary
-        if (newRadiusSqr < radiusSqr) {
-          radiusSqr = newRadiusSqr;
-          double radius = sqrt(radiusSqr);
-          // create box based on radius
-          for (int i = 0; i < dim; i++) {
-            qMin[i] = q.coordinate(i) - radius;
-            qMax[i] = q.coordinate(i) + radius;
-          }
-        } else {
-          assert(false);
-        }
-      }
-
-      other_child->knnPrune<update>(q, tree_start, present, radiusSqr, qMin, qMax, out);
+      size_t ret = 0;
+      if (left) ret += left->ballCount(q, rSqr, tree_start, present, mirror);
+      if (right) ret += right->ballCount(q, rSqr, tree_start, present, mirror);
+      return ret;
     }
   }
 
-#else
+  /*!
+   * Write the present items within distance sqrt([rSqr]) of [q] to [out], which must have room for
+   * [ballCount] items; return the number written. Parallel children are placed as in
+   * [orthogonalFill], from [rec] (recorded by [ballCount] for the same ball) or else counted here.
+   */
+  size_t ballFill(const pointT &q,
+                  double rSqr,
+                  const objT *tree_start,
+                  const bitMask &present,
+                  const leafMirror<dim> &mirror,
+                  objT *out,
+                  const rangeCountTree *rec = nullptr) const {
+    auto cmp = ballCompare(q, rSqr, getMin(), getMax());
+    if (cmp == BOX_EXCLUDE) {
+      return 0;
+    } else if (cmp == BOX_INCLUDE) {  // ball contains node box -> take all the points
+      auto start = getStartValue() - tree_start;
+      auto end = getEndValue() - tree_start;
+      return (parallel && computeRangeQueryInParallel())
+                 ? present.packIntoParallel(subtree_items.begin(), start, end, out)
+                 : present.packInto(subtree_items.begin(), start, end, out);
+    }
+    assert(cmp == BOX_OVERLAP);
+    if (isLeaf()) {
+      size_t ret = 0;
+      leafInBallForEach(
+          q, rSqr, tree_start, present, mirror, [&](const objT &o) { out[ret++] = o; });
+      return ret;
+    } else if (parallel && computeRangeQueryInParallel()) {
+      assert(!rec || (rec->left && rec->right));
+      auto left_count =
+          rec ? rec->left_count : left->ballCount(q, rSqr, tree_start, present, mirror);
+      const rangeCountTree *left_rec = rec ? rec->left.get() : nullptr;
+      const rangeCountTree *right_rec = rec ? rec->right.get() : nullptr;
+      size_t right_count;
+      parlay::par_do(
+          [&]() { left->ballFill(q, rSqr, tree_start, present, mirror, out, left_rec); },
+          [&]() {
+            right_count =
+                right->ballFill(q, rSqr, tree_start, present, mirror, out + left_count, right_rec);
+          });
+      return left_count + right_count;
+    } else {
+      size_t ret = 0;
+      if (left) ret += left->ballFill(q, rSqr, tree_start, present, mirror, out);
+      if (right) ret += right->ballFill(q, rSqr, tree_start, present, mirror, out + ret);
+      return ret;
+    }
+  }
 
+  // The knn searches below work on squared distances: buffer costs, radii and the dual knn node
+  // bounds are all squared, and the sqrt is taken only when a result is handed to the caller.
+  template <class bufT>
   void knnAddToBuffer(const pointT &q,
                       const objT *tree_start,
-                      const parlay::sequence<bool> &present,
-                      knnBuf::buffer<const pointT *> &out,
-                      double radius = std::numeric_limits<double>::max()) const {
+                      const bitMask &present,
+                      const leafMirror<dim> &mirror,
+                      bufT &out,
+                      double radiusSqr = std::numeric_limits<double>::max()) const {
     // TODO: maybe parallelize?
+    out.visitLeaf();
     auto start = getStartValue() - tree_start;
     [[maybe_unused]] auto end = getEndValue() - tree_start;
     assert(end > start);
-    assert(subtree_items.size() == (size_t)(end - start));
+    assert(subtreeItems().size() == (size_t)(end - start));
+
+    if (!mirror.empty()) {  // compute the distances a block at a time
+      double dists[LEAF_SCAN_BLOCK];
+      for (size_t b = 0; b < subtree_items.size(); b += LEAF_SCAN_BLOCK) {
+        auto n = std::min(LEAF_SCAN_BLOCK, subtree_items.size() - b);
+        leafDistSqr(mirror, start + b, n, q, dists);
+        for (auto live = present.getBits(start + b, n); live != 0; live &= live - 1) {
+          auto i = __builtin_ctzll(live);
+          if (dists[i] <= radiusSqr) {
+            const pointT *item_ptr = subtree_items.begin() + b + i;
+            out.insert(knnBuf::elem(dists[i], item_ptr));
+          }
+        }
+      }
+      return;
+    }
 
-    for (size_t i = 0; i < subtree_items.size(); i++) {
-      if (present[start + i]) {  // point isn't deleted
-        auto dist = q.dist(subtree_items[i]);
-        if (dist <= radius) {  // point within radius of interest
-          const pointT *item_ptr = subtree_items.begin() + i;
+    // only visit the points that aren't deleted, a word of [present] at a time
+    for (size_t b = 0; b < subtree_items.size(); b += LEAF_SCAN_BLOCK) {
+      auto n = std::min(LEAF_SCAN_BLOCK, subtree_items.size() - b);
+      for (auto live = present.getBits(start + b, n); live != 0; live &= live - 1) {
+        auto i = b + __builtin_ctzll(live);
+        auto dist = q.distSqr(subtreeItems()[i]);
+        if (dist <= radiusSqr) {  // point within radius of interest
+          const pointT *item_ptr = subtreeItems().begin() + i;
           out.insert(knnBuf::elem(dist, item_ptr));
         }
       }
     }
   }
 
-  template <bool update>
+  template <bool update, class bufT>
   void knnPrune(const pointT &q,
                 const objT *tree_start,
-                const parlay::sequence<bool> &present,
-                double &radius,
+                const bitMask &present,
+                const leafMirror<dim> &mirror,
+                double &radiusSqr,
                 pointT &qMin,
                 pointT &qMax,
-                knnBuf::buffer<const pointT *> &out) const {
+                bufT &out) const {
+    if (out.outOfLeaves()) return;  // approximate search ran out of leaves
     if (update) {
       // compute current radius
-      auto tmp = out.keepK();
-      auto new_radius = tmp.cost;
+      auto newRadiusSqr = out.pruneRadius();
 
       // update the query box if necessary
-      if (new_radius < radius) {
-        radius = new_radius;
+      if (newRadiusSqr < radiusSqr) {
+        radiusSqr = newRadiusSqr;
+        double radius = sqrt(radiusSqr);
         // create box based on radius
         for (int i = 0; i < dim; i++) {
           qMin[i] = q.coordinate(i) - radius;
@@ -514,21 +626,21 @@ class kdNode {
     }
 
     // search only the intersection of the subtree with the radius-box
-    auto cmp = boxCompare(qMin, qMax, pMin, pMax);
+    auto cmp = boxCompare(qMin, qMax, getMin(), getMax());
     switch (cmp) {
       case BOX_EXCLUDE: {
         return;
       }
       case BOX_INCLUDE: {
-        knnAddToBuffer(q, tree_start, present, out, radius);
+        knnAddToBuffer(q, tree_start, present, mirror, out, radiusSqr);
         break;
       }
       case BOX_OVERLAP: {
         if (isLeaf()) {
-          knnAddToBuffer(q, tree_start, present, out, radius);
+          knnAddToBuffer(q, tree_start, present, mirror, out, radiusSqr);
         } else {
-          left->knnPrune<update>(q, tree_start, present, radius, qMin, qMax, out);
-          right->knnPrune<update>(q, tree_start, present, radius, qMin, qMax, out);
+          left->knnPrune<update>(q, tree_start, present, mirror, radiusSqr, qMin, qMax, out);
+          right->knnPrune<update>(q, tree_start, present, mirror, radiusSqr, qMin, qMax, out);
         }
         break;
       }
@@ -537,47 +649,51 @@ class kdNode {
 
   // Taken with modifications from:
   // https://github.mit.edu/yiqiuw/pargeo/blob/master/knnSearch/kdTree/kdtKnn.h#L365
-  template <bool update, bool recurse_sibling>
+  template <bool update, bool recurse_sibling, class bufT>
   void knnHelper(const pointT &q,
                  const objT *tree_start,
-                 const parlay::sequence<bool> &present,
-                 knnBuf::buffer<const pointT *> &out) const {
+                 const bitMask &present,
+                 const leafMirror<dim> &mirror,
+                 bufT &out) const {
     // first, find the leaf
     nodeT *other_child;
     if (isLeaf()) {
-      knnAddToBuffer(q, tree_start, present, out);
+      knnAddToBuffer(q, tree_start, present, mirror, out);
       return;  // base case
     } else {
       if (q.coordinate(split_dimension) < split_value) {
         // TODO: hint to compiler that [left] will pretty much never be null
-        if (left) left->knnHelper<update, recurse_sibling>(q, tree_start, present, out);
+        if (left)
+          left->knnHelper<update, recurse_sibling>(q, tree_start, present, mirror, out);
         other_child = right;
       } else {
-        if (right) right->knnHelper<update, recurse_sibling>(q, tree_start, present, out);
+        if (right)
+          right->knnHelper<update, recurse_sibling>(q, tree_start, present, mirror, out);
         other_child = left;
       }
     }
 
     // now, check alternate children with aggressive pruning
+    if (out.outOfLeaves()) return;
     if (!out.hasK()) {
       // try finding knn on other child
       if (recurse_sibling) {
-        other_child->knnHelper<update, recurse_sibling>(q, tree_start, present, out);
+        other_child->knnHelper<update, recurse_sibling>(q, tree_start, present, mirror, out);
       } else {
-        other_child->knnAddToBuffer(q, tree_start, present, out);
+        other_child->knnAddToBuffer(q, tree_start, present, mirror, out);
       }
     } else {
-      double radius = std::numeric_limits<double>::max();
+      double radiusSqr = std::numeric_limits<double>::max();
       pointT qMin, qMax;
 
       if (!update) {
         // compute current radius
-        auto tmp = out.keepK();
-        auto new_radius = tmp.cost;
+        auto newRadiusSqr = out.pruneRadius();
 
         // update the query box if necessary
-        if (new_radius < radius) {
-          radius = new_radius;
+        if (newRadiusSqr < radiusSqr) {
+          radiusSqr = newRadiusSqr;
+          double radius = sqrt(radiusSqr);
           // create box based on radius
           for (int i = 0; i < dim; i++) {
             qMin[i] = q.coordinate(i) - radius;
@@ -588,14 +704,10 @@ class kdNode {
         }
       }
 
-      other_child->knnPrune<update>(q, tree_start, present, radius, qMin, qMax, out);
+      other_child->knnPrune<update>(q, tree_start, present, mirror, radiusSqr, qMin, qMax, out);
     }
   }
 
-#endif
-
-  // TODO Dual knn tests fail potentially due to sqrt optimization above
-
   // Dual knn stuff
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
   template <int _dim, class _objT, bool _parallel, bool _coarsenq, bool _coarsenr>
@@ -621,8 +733,8 @@ class kdNode {
   int verify() const {
     if (isLeaf()) return countPoints();
 
-    auto left_points = left->verify();
-    auto right_points = right->verify();
+    auto left_points = getLeft()->verify();
+    auto right_points = getRight()->verify();
     // the children must be equal sized, or right has one more item
     if (!((left_points == right_points) || (left_points + 1 == right_points)))
       throw std::runtime_error("Invalid tree!: (left#, right#) = (" + std::to_string(left_points) +
@@ -635,7 +747,7 @@ class kdNode {
     ss << "idx = [" << idx.first << ", " << idx.second << ")";
     if (isLeaf()) {
       std::cout << "leaf: { " << ss.str() << "; ";
-      for (const auto &pt : subtree_items) {
+      for (const auto &pt : subtreeItems()) {
         std::cout << "(";
         for (int i = 0; i < dim; i++) {
           std::cout << pt->coordinate(i);
@@ -653,11 +765,11 @@ class kdNode {
   }
 };
 
-// Helper function to find bounding box distances between nodes
+// Helper function to find squared bounding box distances between nodes
 template <int dim, class objT, bool parallel>
-inline double KdNodeBoundingBoxDistance(const kdNode<dim, objT, parallel> *n1,
-                                        const kdNode<dim, objT, parallel> *n2) {
-  return BoundingBoxDistance(n1->getMin(), n1->getMax(), n2->getMin(), n2->getMax());
+inline double KdNodeBoundingBoxDistanceSqr(const kdNode<dim, objT, parallel> *n1,
+                                           const kdNode<dim, objT, parallel> *n2) {
+  return BoundingBoxDistanceSqr(n1->getMin(), n1->getMax(), n2->getMin(), n2->getMax());
 }
 
 // For now, this is not cache-oblivious. Instead, it uses a simple, d-dimension generalizable
@@ -23,13 +23,17 @@
 
 #pragma once
 
+#include <cstring>
+
 #include <parlay/parallel.h>
 #include <parlay/sequence.h>
 
 #include "kdnode.h"
 #include "utils.h"
 #include "knnbuffer.h"
+#include "object.h"
 #include "box.h"
+#include "bitmask.h"
 #include "macro.h"
 
 #include "mortonSort/mortonSort.h"
@@ -106,8 +110,9 @@ class KdTree {
   size_t build_size;      // the number of nodes it was built with
   const size_t max_size;  // the maximum size for this tree
 
-  parlay::sequence<bool> present;
+  bitMask present;
   parlay::sequence<objT> items;
+  parlay::sequence<double> leaf_coords;  // structure-of-arrays mirror of [items] (LEAF_SOA)
 
 #ifdef PRINT_KDTREE_TIMINGS
   timer timer_;
@@ -141,14 +146,8 @@ class KdTree {
     total_bbox_time = 0;
     total_leaf_time = 0;
 #endif
-    present = parlay::sequence<bool>(max_size);
-
-    // TODO: use new[] for type safety
-    nodes = (nodeT *)malloc((2 * max_size - 1) * sizeof(nodeT));
-
-    // parents = (nodeT **)malloc((2 * max_size - 1) * sizeof(nodeT *));
-    // parents[0] = nullptr;  // root
-
+    // storage is allocated on the first build, see [allocate]
+    nodes = nullptr;
     clear();
   }
 
@@ -163,46 +162,140 @@ class KdTree {
    * Clear out the contents of this tree
    */
   void clear() {
+    clearItems();
+#ifdef ALL_USE_BLOOM
+    bloom_filter.clear();
+#endif
+  }
+
+  /*!
+   * Clear out the contents of this tree but leave its bloom filter alone: the builds call this
+   * while they fill the filter in parallel.
+   */
+  void clearItems() {
     cur_size = 0;
     build_size = 0;
+    // TODO: this is probably wrong - should reset to false!
+    present.assign<parallel>(true);
+#ifndef NDEBUG
+    // mark all the nodes as empty again, only for debugging purposes
+    if (nodes != nullptr)
+      parlay::parallel_for(0, 2 * max_size - 1, [&](size_t i) { nodes[i].setEmpty(); });
+    // parlay::parallel_for(0, 2 * n - 1, [&](size_t i) { parents[i] = nullptr; });
+#endif
+  }
+
+  /*!
+   * Allocate the node and [present] arrays for this tree, if they are not already allocated.
+   * Called by the builds, so an empty tree holds no storage.
+   */
+  void allocate() {
+    if (nodes != nullptr) return;
+    // TODO: use new[] for type safety
+    nodes = (nodeT *)malloc((2 * max_size - 1) * sizeof(nodeT));
+
+    // parents = (nodeT **)malloc((2 * max_size - 1) * sizeof(nodeT *));
+    // parents[0] = nullptr;  // root
+
+    present = bitMask(max_size);
+    clearItems();
+  }
+
+  /*!
+   * Clear the tree and free its storage. It is reallocated by the next build.
+   */
+  void release() {
+    free(nodes);
+    nodes = nullptr;
+    present = bitMask();
+    items = parlay::sequence<objT>();
+    leaf_coords = parlay::sequence<double>();
+    clearItems();
+#ifdef ALL_USE_BLOOM
+    bloom_filter.release();
+#endif
+  }
+
+  /*!
+   * Rebuild the structure-of-arrays mirror of the built items used by the leaf scans. Called at
+   * the end of every build; a no-op unless LEAF_SOA is set.
+   */
+  void buildLeafMirror() {
+#if LEAF_SOA
+    if (leaf_coords.size() < dim * max_size) leaf_coords = parlay::sequence<double>(dim * max_size);
+    auto fill = [&](size_t i) {
+      for (int d = 0; d < dim; d++)
+        leaf_coords[d * max_size + i] = items[i].coordinate(d);
+    };
     if (parallel) {
-      // TODO: make this [present] reset better?
-      // TODO: this is probably wrong - should reset to false!
-      parlay::parallel_for(0, present.size(), [&](size_t i) { present[i] = true; });
+      parlay::parallel_for(0, build_size, fill);
     } else {
-      for (size_t i = 0; i < present.size(); i++) {
-        present[i] = true;
-      }
+      for (size_t i = 0; i < build_size; i++)
+        fill(i);
     }
+#endif
+  }
+
+  leafMirror<dim> getLeafMirror() const {
+    if (leaf_coords.empty()) return leafMirror<dim>();
+    return leafMirror<dim>{leaf_coords.begin(), max_size};
+  }
+
+  bool allocated() const { return nodes != nullptr; }
+
+  /*!
+   * Make this empty tree a copy of [other], which has the same capacity. The node, item and
+   * [present] arrays (and the leaf mirror) are copied, and the nodes pointed at the new items, so
+   * this is O(n) work instead of a rebuild.
+   */
+  void copyFrom(const KdTree &other) {
+    assert(max_size == other.max_size);
+    assert(empty());
+    if (!other.allocated()) return;
+    allocate();
+    items = other.items;
+    present = other.present;
+    leaf_coords = other.leaf_coords;
+    cur_size = other.cur_size;
+    build_size = other.build_size;
 #ifdef ALL_USE_BLOOM
-    bloom_filter.clear();
+    bloom_filter.build(items);
 #endif
-#ifndef NDEBUG
-    // mark all the nodes as empty again, only for debugging purposes
-    parlay::parallel_for(0, 2 * max_size - 1, [&](size_t i) { nodes[i].setEmpty(); });
-    // parlay::parallel_for(0, 2 * n - 1, [&](size_t i) { parents[i] = nullptr; });
+    if (build_size == 0) return;
+    std::memcpy(static_cast<void *>(nodes), other.nodes, num_nodes() * sizeof(nodeT));
+    nodes[0].rebase(other.items.begin(), items.begin(), other.nodes, nodes);
+  }
+
+  // the number of bytes of storage held by this tree (not including sizeof(*this))
+  size_t memory_footprint() const {
+    size_t ret = present.memory_footprint() + items.capacity() * sizeof(objT) +
+                 leaf_coords.capacity() * sizeof(double);
+    if (nodes != nullptr) ret += num_nodes() * sizeof(nodeT);
+#ifdef ALL_USE_BLOOM
+    ret += bloom_filter.memory_footprint();
 #endif
+    return ret;
   }
 
   /*!
-   * Move the elements of the tree and pack them into [dest]. Clear the tree.
+   * Pack the elements of the tree into [dest], leaving the tree unchanged.
    */
-  size_t moveElementsTo(parlay::slice<objT *, objT *> dest) {
-    size_t ret;
+  size_t copyElementsTo(parlay::slice<objT *, objT *> dest) const {
     assert(dest.size() >= size());
     if (parallel) {
-      ret = parlay::pack_into(parlay::slice(items.begin(), items.begin() + build_size),
-                              parlay::slice(present.begin(), present.begin() + build_size),
-                              dest);
+      return present.packIntoParallel(items.begin(), 0, build_size, dest.begin());
     } else {
-      ret = 0;
-      for (size_t i = 0; i < build_size; i++) {
-        if (present[i]) {
-          dest[ret++] = items[i];
-        }
-      }
+      return present.packInto(items.begin(), 0, build_size, dest.begin());
     }
-    clear();
+  }
+
+  /*!
+   * Move the elements of the tree and pack them into [dest]. Clear the tree, but not its bloom
+   * filter: the callers either rebuild it or keep adding to it.
+   */
+  size_t moveElementsTo(parlay::slice<objT *, objT *> dest) {
+    auto ret = copyElementsTo(dest);
+    clearItems();
     return ret;
   }
 
@@ -270,21 +363,147 @@ class KdTree {
         assert(subtree_idx >= 0);
         assert((size_t)subtree_idx < node->getValues().size());
         if (present[it - items.begin()] && p == *it) {
-          return {node - nodes, parent - nodes, gparent - nodes, (int)subtree_idx};
+          return {node - nodes,
+                  parent ? parent - nodes : FoundPoint::NOT_FOUND,
+                  gparent ? gparent - nodes : FoundPoint::NOT_FOUND,
+                  (int)subtree_idx};
         }
       }
     }
     return {FoundPoint::NOT_FOUND, FoundPoint::NOT_FOUND, FoundPoint::NOT_FOUND, -1};
   }
 
-  parlay::sequence<objT> orthogonalQuery(const objT &qMin, const objT &qMax) const {
-    parlay::sequence<objT> ret;
-    if (!empty()) {
-      nodes[0].orthogonalQuery(qMin, qMax, items.begin(), present, ret);
+  parlay::sequence<objT> orthogonalQuery(const pointT &qMin, const pointT &qMax) const {
+    rangeCountTree rec;
+    parlay::sequence<objT> ret(rangeCount(qMin, qMax, &rec));
+    [[maybe_unused]] auto num_written = orthogonalFill(qMin, qMax, ret.begin(), &rec);
+    assert(num_written == ret.size());
+    return ret;
+  }
+
+  /*!
+   * The number of points in the box [qMin, qMax], without materializing them. Subtrees inside the
+   * box are answered from their live counts. This is also the first pass of [orthogonalQuery],
+   * which passes [rec] to keep the counts for the second.
+   */
+  size_t rangeCount(const pointT &qMin, const pointT &qMax, rangeCountTree *rec = nullptr) const {
+    if (empty()) return 0;
+    return nodes[0].orthogonalCount(qMin, qMax, items.begin(), present, getLeafMirror(), rec);
+  }
+
+  // batched [rangeCount], in parallel across the boxes
+  parlay::sequence<size_t> rangeCount(const parlay::sequence<pointT> &qMins,
+                                      const parlay::sequence<pointT> &qMaxs) const {
+    assert(qMins.size() == qMaxs.size());
+    parlay::sequence<size_t> ret(qMins.size());
+    if (parallel) {
+      parlay::parallel_for(
+          0, qMins.size(), [&](size_t i) { ret[i] = rangeCount(qMins[i], qMaxs[i]); });
+    } else {
+      for (size_t i = 0; i < qMins.size(); i++)
+        ret[i] = rangeCount(qMins[i], qMaxs[i]);
+    }
+    return ret;
+  }
+
+  // the second pass of [orthogonalQuery]: write the points in the box to [out]
+  size_t orthogonalFill(const pointT &qMin,
+                        const pointT &qMax,
+                        objT *out,
+                        const rangeCountTree *rec = nullptr) const {
+    if (empty()) return 0;
+    return nodes[0].orthogonalFill(qMin, qMax, items.begin(), present, getLeafMirror(), out, rec);
+  }
+
+  /*!
+   * Batched [orthogonalQuery], in parallel across the boxes: returns (offsets, results), where the
+   * points in the box [qMins[i], qMaxs[i]] are results[offsets[i], offsets[i + 1]). The boxes are
+   * counted first, so the results are written straight into one array.
+   */
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> orthogonalQuery(
+      const parlay::sequence<pointT> &qMins, const parlay::sequence<pointT> &qMaxs) const {
+    assert(qMins.size() == qMaxs.size());
+    auto n = qMins.size();
+    parlay::sequence<size_t> offsets(n + 1, 0);
+    parlay::sequence<rangeCountTree> recs(parallel ? n : 0);  // only parallel fills need them
+    if (parallel) {
+      parlay::parallel_for(
+          0, n, [&](size_t i) { offsets[i] = rangeCount(qMins[i], qMaxs[i], &recs[i]); });
+    } else {
+      for (size_t i = 0; i < n; i++)
+        offsets[i] = rangeCount(qMins[i], qMaxs[i]);
+    }
+    parlay::scan_inplace(offsets);
+
+    parlay::sequence<objT> ret(offsets[n]);
+    if (parallel) {
+      parlay::parallel_for(0, n, [&](size_t i) {
+        orthogonalFill(qMins[i], qMaxs[i], ret.begin() + offsets[i], &recs[i]);
+      });
+    } else {
+      for (size_t i = 0; i < n; i++)
+        orthogonalFill(qMins[i], qMaxs[i], ret.begin() + offsets[i]);
     }
+    return {std::move(offsets), std::move(ret)};
+  }
+
+  // the number of points within distance [radius] of [q]; see [rangeCount] for [rec]
+  size_t ballCount(const pointT &q, double radius, rangeCountTree *rec = nullptr) const {
+    if (empty()) return 0;
+    return nodes[0].ballCount(q, radius * radius, items.begin(), present, getLeafMirror(), rec);
+  }
+
+  // the second pass of [ballQuery]: write the points within distance [radius] of [q] to [out]
+  size_t ballFill(const pointT &q,
+                  double radius,
+                  objT *out,
+                  const rangeCountTree *rec = nullptr) const {
+    if (empty()) return 0;
+    return nodes[0].ballFill(
+        q, radius * radius, items.begin(), present, getLeafMirror(), out, rec);
+  }
+
+  // all the points within distance [radius] of [q]
+  parlay::sequence<objT> ballQuery(const pointT &q, double radius) const {
+    rangeCountTree rec;
+    parlay::sequence<objT> ret(ballCount(q, radius, &rec));
+    [[maybe_unused]] auto num_written = ballFill(q, radius, ret.begin(), &rec);
+    assert(num_written == ret.size());
     return ret;
   }
 
+  /*!
+   * Batched [ballQuery], in parallel across the balls: returns (offsets, results), where the points
+   * within radii[i] of queries[i] are results[offsets[i], offsets[i + 1]). The balls are counted
+   * first, as in the batched [orthogonalQuery].
+   */
+  std::pair<parlay::sequence<size_t>, parlay::sequence<objT>> ballQuery(
+      const parlay::sequence<pointT> &queries, const parlay::sequence<double> &radii) const {
+    assert(queries.size() == radii.size());
+    auto n = queries.size();
+    parlay::sequence<size_t> offsets(n + 1, 0);
+    parlay::sequence<rangeCountTree> recs(parallel ? n : 0);  // only parallel fills need them
+    if (parallel) {
+      parlay::parallel_for(
+          0, n, [&](size_t i) { offsets[i] = ballCount(queries[i], radii[i], &recs[i]); });
+    } else {
+      for (size_t i = 0; i < n; i++)
+        offsets[i] = ballCount(queries[i], radii[i]);
+    }
+    parlay::scan_inplace(offsets);
+
+    parlay::sequence<objT> ret(offsets[n]);
+    if (parallel) {
+      parlay::parallel_for(0, n, [&](size_t i) {
+        ballFill(queries[i], radii[i], ret.begin() + offsets[i], &recs[i]);
+      });
+    } else {
+      for (size_t i = 0; i < n; i++)
+        ballFill(queries[i], radii[i], ret.begin() + offsets[i]);
+    }
+    return {std::move(offsets), std::move(ret)};
+  }
+
 #if (DUAL_KNN_MODE != DKNN_ARRAY)
   void updateDualDist(const parlay::slice<knnBuf::buffer<const pointT *> *,
                                           knnBuf::buffer<const pointT *> *> &buf_slice) {
@@ -298,31 +517,29 @@ class KdTree {
   }
 #endif
 
-  template <bool update, bool recurse_sibling>
-  void knnSinglePoint(const objT &p, knnBuf::buffer<const pointT *> &buf) const {
+  template <bool update, bool recurse_sibling, class bufT>
+  void knnSinglePoint(const objT &p, bufT &buf) const {
     nodes[0].template knnHelper<update, recurse_sibling>(
-        pointT(p.coordinate()), items.begin(), present, buf);
-    buf.keepK();  // TODO: could cause problems in logtree when running on nearly depleted
-                  // subtree
+        pointT(p.coordinate()), items.begin(), present, getLeafMirror(), buf);
+    if (buf.hasK()) buf.keepK();  // a nearly depleted tree (in a logtree) may hold fewer than k
   }
 
-  template <bool set_res, bool update, bool recurse_sibling>
+  // [outT] is the result type: a point pointer, an object id or a neighbor (see object.h)
+  template <bool set_res, bool update, bool recurse_sibling, class outT>
   void knnSinglePoint(
       const objT &p,
       int i,
       parlay::slice<knnBuf::elem<const pointT *> *, knnBuf::elem<const pointT *> *> &out,
-      parlay::slice<const pointT **, const pointT **> &res,
+      parlay::slice<outT *, outT *> &res,
       int k,
-      bool preload) const {
+      bool preload,
+      const knnBuf::knnApprox &approx) const {
     auto buf = knnBuf::buffer<const pointT *>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
+    buf.setApprox(approx);
     if (preload) buf.ptr = k;
     knnSinglePoint<update, recurse_sibling>(p, buf);
 
-    if (set_res) {
-      for (int j = 0; j < k; j++) {
-        res[i * k + j] = buf[j].entry;
-      }
-    }
+    if (set_res) storeKnnResults<objT>(res.begin() + i * k, buf);
   }
 
   template <bool update, bool recurse_sibling>
@@ -356,13 +573,14 @@ class KdTree {
     }
   }
 
-  template <bool set_res, bool update, bool recurse_sibling>
+  template <bool set_res, bool update, bool recurse_sibling, class outT>
   void knn(const parlay::sequence<objT> &queries,
            parlay::slice<knnBuf::elem<const pointT *> *, knnBuf::elem<const pointT *> *> &out,
-           parlay::slice<const pointT **, const pointT **> &res,
+           parlay::slice<outT *, outT *> &res,
            int k,
-           bool preload = false) const {
-    assert(res.size() == k * queries.size());
+           bool preload = false,
+           const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
+    assert(!set_res || res.size() == k * queries.size());
     assert(out.size() == 2 * k * queries.size());
 
 #if SPATIAL_SORT == 2
@@ -382,55 +600,126 @@ class KdTree {
 
     if (parallel) {
       parlay::parallel_for(0, queries.size(), [&](size_t i) {
-        knnSinglePoint<set_res, update, recurse_sibling>(queries[i], i, out, res, k, preload);
+        knnSinglePoint<set_res, update, recurse_sibling>(
+            queries[i], i, out, res, k, preload, approx);
       });
     } else {
       for (size_t i = 0; i < queries.size(); i++)
-        knnSinglePoint<set_res, update, recurse_sibling>(queries[i], i, out, res, k, preload);
+        knnSinglePoint<set_res, update, recurse_sibling>(
+            queries[i], i, out, res, k, preload, approx);
     }
   }
 
   template <bool update, bool recurse_sibling>
-  parlay::sequence<const pointT *> knn2(__attribute__((unused))
-                                        const parlay::sequence<objT> &queries,
-                                        __attribute__((unused)) int k) const {
+  parlay::sequence<const pointT *> knn2(
+      __attribute__((unused)) const parlay::sequence<objT> &queries,
+      __attribute__((unused)) int k,
+      __attribute__((unused)) const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
     throw std::runtime_error("Called knn2 on the wrong tree type!");
   }
   template <bool update, bool recurse_sibling>
-  parlay::sequence<const pointT *> knn3(__attribute__((unused))
-                                        const parlay::sequence<objT> &queries,
-                                        __attribute__((unused)) int k) const {
+  parlay::sequence<const pointT *> knn3(
+      __attribute__((unused)) const parlay::sequence<objT> &queries,
+      __attribute__((unused)) int k,
+      __attribute__((unused)) const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
     throw std::runtime_error("Called knn3 on the wrong tree type!");
   }
+  template <bool update, bool recurse_sibling>
+  parlay::sequence<const pointT *> knn4(
+      __attribute__((unused)) const parlay::sequence<objT> &queries,
+      __attribute__((unused)) int k,
+      __attribute__((unused)) const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
+    throw std::runtime_error("Called knn4 on the wrong tree type!");
+  }
 
+  // scratch space that callers may keep across knn calls, see knnbuffer.h
+  typedef knnBuf::workspace<const point<dim> *> knnWorkspace;
+
+  // [approx] selects approximate search, see knnbuffer.h
   template <bool update = false, bool recurse_sibling = false>
-  parlay::sequence<const pointT *> knn(const parlay::sequence<objT> &queries, int k) const {
+  parlay::sequence<const pointT *> knn(
+      const parlay::sequence<objT> &queries,
+      int k,
+      const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
     parlay::sequence<const pointT *> res(k * queries.size());
-    parlay::sequence<knnBuf::elem<const pointT *>> out(2 * k * queries.size());
+    knn<update, recurse_sibling>(queries, k, res.head(res.size()), approx);
+    return res;
+  }
 
-    auto res_slice = res.head(res.size());
-    auto out_slice = out.head(out.size());
-    knn<true, update, recurse_sibling>(queries, out_slice, res_slice, k);
+  // Same as above, but writes ids (objT::idT) or neighbors (neighbor<objT::idT>) into the
+  // caller-owned [res], which must hold k * queries.size() results. Results stay valid after the
+  // tree is modified.
+  template <bool update = false, bool recurse_sibling = false, class outT>
+  void knn(const parlay::sequence<objT> &queries,
+           int k,
+           parlay::slice<outT *, outT *> res,
+           const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
+    knnWorkspace ws;
+    knn<update, recurse_sibling>(queries, k, res, ws, approx);
+  }
+
+  // Same as above, with the scratch space taken from [ws]
+  template <bool update = false, bool recurse_sibling = false, class outT>
+  void knn(const parlay::sequence<objT> &queries,
+           int k,
+           parlay::slice<outT *, outT *> res,
+           knnWorkspace &ws,
+           const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
+    auto out_slice = ws.template elems<parallel>(2 * k * queries.size());
+    knn<true, update, recurse_sibling>(queries, out_slice, res, k, false, approx);
+  }
+
+  // knn with k = K fixed at compile time: each query keeps its candidates in a sorted array of K
+  // elements (knnBuf::buffer<T, K>) instead of the selection-based buffer. Meant for small K.
+  template <int K, bool update = false, bool recurse_sibling = false>
+  parlay::sequence<const pointT *> knnFixedK(
+      const parlay::sequence<objT> &queries,
+      const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
+    parlay::sequence<const pointT *> res(K * queries.size());
+    knnFixedK<K, update, recurse_sibling>(queries, res.head(res.size()), approx);
     return res;
   }
 
+  template <int K, bool update = false, bool recurse_sibling = false, class outT>
+  void knnFixedK(const parlay::sequence<objT> &queries,
+                 parlay::slice<outT *, outT *> res,
+                 const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
+    assert(res.size() == K * queries.size());
+    auto run_on_point = [&](size_t i) {
+      knnBuf::buffer<const pointT *, K> buf;
+      buf.setApprox(approx);
+      knnSinglePoint<update, recurse_sibling>(queries[i], buf);
+      storeKnnResults<objT>(res.begin() + i * K, buf);
+    };
+    if (parallel) {
+      parlay::parallel_for(0, queries.size(), run_on_point);
+    } else {
+      for (size_t i = 0; i < queries.size(); i++)
+        run_on_point(i);
+    }
+  }
+
   // Dual knn stuff
-  template <int _dim, class _objT, bool _parallel, bool _coarsen>
-  friend parlay::sequence<const point<_dim> *> dualKnn(
-      parlay::sequence<_objT> &queries,
-      const KdTree<_dim, _objT, _parallel, _coarsen> &rTree,
-      int k);
+  template <int _dim, class _objT, bool _parallel, bool _coarsen, class _outT>
+  friend void dualKnn(parlay::sequence<_objT> &queries,
+                      const KdTree<_dim, _objT, _parallel, _coarsen> &rTree,
+                      int k,
+                      parlay::slice<_outT *, _outT *> res,
+                      const knnBuf::knnApprox &approx);
 
   template <int _NUM_TREES,
             int _BUFFER_LOG2_SIZE,
             int _dim,
             class _objT,
             bool _parallel,
-            bool _coarsen>
-  friend parlay::sequence<const point<_dim> *> dualKnn(
+            bool _coarsen,
+            class _outT>
+  friend void dualKnn(
       parlay::sequence<_objT> &queries,
       const LogTree<_NUM_TREES, _BUFFER_LOG2_SIZE, _dim, _objT, _parallel, _coarsen> &rTree,
-      int k);
+      int k,
+      parlay::slice<_outT *, _outT *> res,
+      const knnBuf::knnApprox &approx);
 
 #if (DUAL_KNN_MODE == DKNN_ARRAY)
   template <int _dim, class _objT, bool _parallel, bool _coarsenq, bool _coarsenr>
@@ -451,19 +740,46 @@ class KdTree {
                                           knnBuf::buffer<const point<_dim> *> *> &bufs);
 #endif
 
-  parlay::sequence<const pointT *> dualKnnBase(const KdTree &queryTree, int k) const {
+  parlay::sequence<const pointT *> dualKnnBase(
+      const KdTree &queryTree,
+      int k,
+      const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
     parlay::sequence<const pointT *> res(k * queryTree.size());
-    parlay::sequence<knnBuf::elem<const pointT *>> out(2 * k * queryTree.size());
+    dualKnnBase(queryTree, k, res.head(res.size()), approx);
+    return res;
+  }
 
-    // allocate knn buffers
-    parlay::sequence<knnBuf::buffer<const pointT *>> bufs(queryTree.size());
+  // results for queryTree.getItems()[i] are written to res[i * k, (i + 1) * k)
+  template <class outT>
+  void dualKnnBase(const KdTree &queryTree,
+                   int k,
+                   parlay::slice<outT *, outT *> res,
+                   const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
+    knnWorkspace ws;
+    dualKnnBase(queryTree, k, res, ws, approx);
+  }
+
+  // Same as above, with the scratch space taken from [ws]
+  template <class outT>
+  void dualKnnBase(const KdTree &queryTree,
+                   int k,
+                   parlay::slice<outT *, outT *> res,
+                   knnWorkspace &ws,
+                   const knnBuf::knnApprox &approx = knnBuf::knnApprox()) const {
+    assert(res.size() == k * queryTree.size());
+    auto out = ws.template elems<parallel>(2 * k * queryTree.size());
+
+    // set up knn buffers
+    auto bufs = ws.buffers(queryTree.size());
     if (parallel) {
       parlay::parallel_for(0, bufs.size(), [&](size_t i) {
         bufs[i] = knnBuf::buffer<const pointT *>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
+        bufs[i].setApprox(approx);
       });
     } else {
       for (size_t i = 0; i < bufs.size(); i++) {
         bufs[i] = knnBuf::buffer<const pointT *>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
+        bufs[i].setApprox(approx);
       }
     }
 
@@ -481,20 +797,14 @@ class KdTree {
     if (parallel) {
       parlay::parallel_for(0, queryTree.size(), [&](size_t i) {
         bufs[i].keepK();
-        for (int j = 0; j < k; j++) {
-          res[i * k + j] = bufs[i][j].entry;
-        }
+        storeKnnResults<objT>(res.begin() + i * k, bufs[i]);
       });
     } else {
       for (size_t i = 0; i < queryTree.size(); i++) {
         bufs[i].keepK();
-        for (int j = 0; j < k; j++) {
-          res[i * k + j] = bufs[i][j].entry;
-        }
+        storeKnnResults<objT>(res.begin() + i * k, bufs[i]);
       }
     }
-
-    return res;
   }
 
   bool empty() const { return cur_size == 0; }
@@ -517,15 +827,52 @@ class KdTree {
   void erase(const FoundPoint &found_point) {
     assert(found_point.idx != FoundPoint::NOT_FOUND);
 
+    auto at = [&](long int idx) { return (idx == FoundPoint::NOT_FOUND) ? nullptr : nodes + idx; };
     auto node = nodes + found_point.idx;
-    auto parent = nodes + found_point.parent_idx;
-    auto gparent = nodes + found_point.gparent_idx;
+    auto parent = at(found_point.parent_idx);
+    auto gparent = at(found_point.gparent_idx);
 
     assert(node->isLeaf());
     assert((parent == nodes) || (gparent != nullptr));  // either child of root or has grandparent
 
-    // mark point as deleted
-    present[found_point.point_idx + (node->getStartValue() - items.begin())] = false;
+    // the ancestors of [node] each lose a point; walk down to it as [find] does
+    const auto &p = node->getStartValue()[found_point.point_idx];
+    for (auto cur = nodes; cur != node;) {
+      assert(cur != nullptr && !cur->isLeaf());
+      cur->removePoints(1);
+      cur = (p.coordinate(cur->getSplitDimension()) < cur->getSplitValue()) ? cur->getLeft()
+                                                                            : cur->getRight();
+    }
+    eraseFromLeaf<log_tree>(node, parent, gparent, found_point.point_idx);
+  }
+
+  // Erase-By-Index: Erase items[idx], if it is present. -------------------------------------------
+  // The leaf is found through the item ranges of the nodes instead of the split planes, so no
+  // coordinate is compared (see [LogTree::eraseIds]).
+  template <bool log_tree>
+  bool eraseAt(size_t idx) {
+    if (idx >= build_size || !present[idx]) return false;
+    auto holds = [&](const nodeT *n) {
+      if (n == nullptr) return false;
+      auto [s, e] = getNodeValueIdx(n);
+      return (size_t)s <= idx && idx < (size_t)e;
+    };
+    nodeT *node = nodes, *parent = nullptr, *gparent = nullptr;
+    while (!node->isLeaf()) {
+      assert(holds(node));
+      node->removePoints(1);
+      gparent = parent;
+      parent = node;
+      node = holds(node->getLeft()) ? node->getLeft() : node->getRight();
+    }
+    eraseFromLeaf<log_tree>(node, parent, gparent, idx - (node->getStartValue() - items.begin()));
+    return true;
+  }
+
+  // mark the [point_idx]-th point of the leaf [node] as deleted, once its ancestors are updated
+  template <bool log_tree>
+  void eraseFromLeaf(nodeT *node, nodeT *parent, nodeT *gparent, int point_idx) {
+    present.reset(point_idx + (node->getStartValue() - items.begin()));
     node->removePoints(1);
     cur_size -= 1;
 
@@ -548,7 +895,7 @@ class KdTree {
         assert(!gparent->isLeaf());
         gparent->recomputeBoundingBox();
         // if (node_sibling) parents[node_sibling - nodes] = gparent;
-      } else {
+      } else if (parent != nullptr) {
         if (!log_tree) {
           // only need to update structure if we're still gonna use it. -> in the case of a log
           // tree, if the entire side subtree of the root has been deleted, it will definitely be
@@ -642,7 +989,7 @@ class KdTree {
     for (const auto &pt_to_del : points) {
       for (auto it = node->getStartValue(); it != node->getEndValue(); ++it) {
         if (present[it - items.begin()] && pt_to_del == *it) {
-          present[it - items.begin()] = false;
+          present.reset(it - items.begin());
           num_removed++;
           break;
         }
@@ -701,7 +1048,10 @@ class KdTree {
         // parents[new_left - nodes] = node;
         // parents[new_right - nodes] = node;
         return node;
-      } else if (new_left == nullptr && new_right == nullptr) {
+      }
+      // keep my count right even though I am cut out: the root stays in place (see [bulk_erase])
+      node->removePoints(num_removed);
+      if (new_left == nullptr && new_right == nullptr) {
         // both children deleted -> delete me
         return nullptr;
       } else {
@@ -713,7 +1063,6 @@ class KdTree {
 
   nodeT *bulk_erase_helper_parallel(nodeT *node,
                                     parlay::slice<objT *, objT *> points,
-                                    parlay::slice<bool *, bool *> flags,
                                     size_t &num_removed) {
     assert(parallel);
     if (!eraseInParallel(points.size())) {  // just fallback to serial
@@ -734,7 +1083,7 @@ class KdTree {
       mtime("Start partition: " + std::to_string(points.size()));
 #endif
       auto right_start =
-          parallelPartition(points, flags, node->getSplitDimension(), node->getSplitValue());
+          parallelPartition(points, node->getSplitDimension(), node->getSplitValue());
 #ifdef PRINT_KDTREE_TIMINGS
       mtime("Finish partition: " + std::to_string(points.size()));
 #endif
@@ -746,13 +1095,11 @@ class KdTree {
           [&]() {
             new_left = bulk_erase_helper_parallel(node->getLeft(),
                                                   points.cut(0, right_start),
-                                                  flags.cut(0, right_start),
                                                   num_removed_left);
           },
           [&]() {
             new_right = bulk_erase_helper_parallel(node->getRight(),
                                                    points.cut(right_start, points.size()),
-                                                   flags.cut(right_start, points.size()),
                                                    num_removed_right);
           });
       num_removed = num_removed_left + num_removed_right;
@@ -773,7 +1120,10 @@ class KdTree {
         // parents[new_left - nodes] = node;
         // parents[new_right - nodes] = node;
         return node;
-      } else if (new_left == nullptr && new_right == nullptr) {
+      }
+      // keep my count right even though I am cut out: the root stays in place (see [bulk_erase])
+      node->removePoints(num_removed);
+      if (new_left == nullptr && new_right == nullptr) {
         // both children deleted -> delete me
         return nullptr;
       } else {
@@ -802,9 +1152,7 @@ class KdTree {
 #ifdef PRINT_KDTREE_TIMINGS
       this->mark_time("Erase Start");
 #endif
-      auto flags = parlay::sequence<bool>(points.size());
-      bulk_erase_helper_parallel(
-          nodes, points.cut(0, points.size()), flags.cut(0, points.size()), num_removed);
+      bulk_erase_helper_parallel(nodes, points.cut(0, points.size()), num_removed);
 #ifdef PRINT_KDTREE_TIMINGS
       this->mark_time("Erase Finish");
 #endif
@@ -820,13 +1168,14 @@ class KdTree {
    * left, or exactly one more.
    */
   bool verify() const {
+    if (empty()) return true;
     nodes[0].verify();
     return true;
   }
 
-  std::pair<parlay::slice<const objT *, const objT *>, parlay::slice<const bool *, const bool *>>
-  getItems() const {
-    return {items.cut(0, build_size), present.cut(0, build_size)};
+  // the built items, and which of them are still present
+  std::pair<parlay::slice<const objT *, const objT *>, const bitMask &> getItems() const {
+    return {items.cut(0, build_size), present};
   }
 
   /*!
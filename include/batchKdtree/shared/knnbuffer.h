@@ -34,18 +34,100 @@ typedef double floatT;
 
 template <typename T>
 struct elem {
-  floatT cost;  // Non-negative
+  floatT cost;  // squared distance, non-negative
   T entry;
   elem(floatT t_cost, T t_entry) : cost(t_cost), entry(t_entry) {}
-  elem() : cost(std::numeric_limits<floatT>::max()) {}
+  elem() : cost(std::numeric_limits<floatT>::max()), entry() {}
   bool operator<(const elem& b) const {
     if (cost < b.cost) return true;
     return false;
   }
 };
 
+/*!
+ * Approximate knn: subtrees are pruned against the current k-th distance shrunk by (1 + eps), so
+ * every reported neighbor is within (1 + eps) of the true one at its rank. A positive [max_leaves]
+ * additionally stops the search in a tree once it has scanned that many leaves and holds k
+ * candidates. The budget is per tree: every knn variant of a LogTree gives each of its trees
+ * [max_leaves] leaves again. The default is exact search.
+ */
+struct knnApprox {
+  floatT eps = 0;
+  intT max_leaves = 0;
+
+  knnApprox() {}
+  knnApprox(floatT t_eps, intT t_max_leaves = 0) : eps(t_eps), max_leaves(t_max_leaves) {}
+};
+
+// state of an approximate search, shared by the buffers below
+struct searchBudget {
+  floatT radius_scale = 1;  // 1 / (1 + eps)^2 on squared costs, see [knnApprox]
+  intT max_leaves = -1;     // leaf budget per tree, -1 if unlimited
+  intT leaves_left = -1;    // what is left of it in the current tree
+
+  void setApprox(const knnApprox& approx) {
+    radius_scale = 1 / ((1 + approx.eps) * (1 + approx.eps));
+    max_leaves = leaves_left = (approx.max_leaves > 0) ? approx.max_leaves : -1;
+  }
+
+  // the search moves on to another tree, with a full leaf budget
+  void nextTree() { leaves_left = max_leaves; }
+
+  void visitLeaf() {
+    if (leaves_left > 0) leaves_left--;
+  }
+};
+
+/*!
+ * Candidates of a knn search with k fixed at compile time: a sorted array of K elements, filled
+ * by insertion. Both the k-th distance and the sorted result are free, where the dynamic buffer
+ * (K = 0, below) needs a selection. Meant for small K.
+ */
+template <typename T, int K = 0>
+struct buffer : searchBudget {
+  static_assert(K > 0, "K = 0 is the dynamic buffer");
+  static constexpr intT k = K;
+  intT ptr;
+  elem<T> buf[K];  // buf[0, ptr) is sorted by cost
+
+  buffer() : ptr(0) {}
+
+  inline void reset() { ptr = 0; }
+
+  bool hasK() { return ptr >= K; }
+
+  bool outOfLeaves() { return leaves_left == 0 && hasK(); }
+
+  floatT pruneRadius() { return keepK().cost * radius_scale; }
+
+  elem<T> keepK() {
+    if (ptr < K) throw std::runtime_error("Error, kbuffer not enough k.");
+    return buf[K - 1];
+  }
+
+  void insert(elem<T> t_elem) {
+    if (ptr == K) {
+      if (!(t_elem < buf[K - 1])) return;
+      ptr--;
+    }
+    intT i = ptr++;
+    for (; i > 0 && t_elem < buf[i - 1]; i--)
+      buf[i] = buf[i - 1];
+    buf[i] = t_elem;
+  }
+
+  void sortK() {}  // always sorted
+
+  elem<T> operator[](intT i) {
+    if (i < ptr)
+      return buf[i];
+    else
+      return elem<T>();
+  }
+};
+
 template <typename T>
-struct buffer {
+struct buffer<T, 0> : searchBudget {
   typedef parlay::slice<elem<T>*, elem<T>*> sliceT;
   /*const*/ intT k;  // not const because of assignment in dualKnn
   intT ptr;
@@ -59,6 +141,12 @@ struct buffer {
 
   bool hasK() { return ptr >= k; }
 
+  // whether the search may stop: the leaf budget is spent and k candidates are in
+  bool outOfLeaves() { return leaves_left == 0 && hasK(); }
+
+  // the k-th squared distance so far, shrunk for approximate search
+  floatT pruneRadius() { return keepK().cost * radius_scale; }
+
   elem<T> keepK() {
     if (ptr < k) throw std::runtime_error("Error, kbuffer not enough k.");
     if (!cached) {  // only need to do this if modified since last call
@@ -69,6 +157,12 @@ struct buffer {
     return buf[k - 1];
   }
 
+  // keep the (at most) k nearest and order them by cost
+  void sortK() {
+    if (ptr > k) keepK();
+    std::sort(buf.begin(), buf.begin() + ptr);
+  }
+
   void insert(elem<T> t_elem) {
     buf[ptr++] = t_elem;
     cached = false;
@@ -83,17 +177,66 @@ struct buffer {
   }
 };
 
+/*!
+ * Scratch space for knn queries, kept by the caller across batches so that repeated queries do not
+ * allocate (and page-fault) their candidate arrays every time. Storage only grows.
+ */
+template <typename T>
+class workspace {
+  parlay::sequence<elem<T>> out;
+  parlay::sequence<buffer<T>> bufs;
+  parlay::sequence<std::pair<double, int>> order;
+
+ public:
+  typedef parlay::slice<elem<T>*, elem<T>*> elemSlice;
+  typedef parlay::slice<buffer<T>*, buffer<T>*> bufferSlice;
+  typedef parlay::slice<std::pair<double, int>*, std::pair<double, int>*> orderSlice;
+
+  // [n] empty elements, as a freshly allocated array would hold: preloaded buffers rely on this
+  template <bool parallel>
+  elemSlice elems(size_t n) {
+    if (out.size() < n) {
+      out = parlay::sequence<elem<T>>(n);
+    } else if (parallel) {
+      parlay::parallel_for(0, n, [&](size_t i) { out[i] = elem<T>(); });
+    } else {
+      std::fill(out.begin(), out.begin() + n, elem<T>());
+    }
+    return out.cut(0, n);
+  }
+
+  // [n] buffers, each to be assigned before use
+  bufferSlice buffers(size_t n) {
+    if (bufs.size() < n) bufs = parlay::sequence<buffer<T>>(n);
+    return bufs.cut(0, n);
+  }
+
+  // [n] (distance, tree) pairs, for the searches that order the trees of a LogTree per query;
+  // each to be assigned before use
+  orderSlice treeOrder(size_t n) {
+    if (order.size() < n) order = parlay::sequence<std::pair<double, int>>(n);
+    return order.cut(0, n);
+  }
+
+  size_t memory_footprint() const {
+    return out.capacity() * sizeof(elem<T>) + bufs.capacity() * sizeof(buffer<T>) +
+           order.capacity() * sizeof(std::pair<double, int>);
+  }
+};
+
+// the k nearest neighbors of each of [queries] among [points], in no particular order
 template <int dim>
 parlay::sequence<const point<dim>*> bruteforceKnn(const parlay::sequence<point<dim>>& queries,
+                                                  const parlay::sequence<point<dim>>& points,
                                                   size_t k) {
   auto out = parlay::sequence<elem<const point<dim>*>>(2 * k * queries.size());
   auto idx = parlay::sequence<const point<dim>*>(k * queries.size());
   parlay::parallel_for(0, queries.size(), [&](size_t i) {
     auto q = queries[i];
     buffer buf = buffer<const point<dim>*>(k, out.cut(i * 2 * k, (i + 1) * 2 * k));
-    for (intT j = 0; j < (int)queries.size(); ++j) {
-      auto p = &queries[j];
-      buf.insert(elem(q.dist(p), p));
+    for (intT j = 0; j < (int)points.size(); ++j) {
+      auto p = &points[j];
+      buf.insert(elem(q.distSqr(p), p));
     }
     buf.keepK();
 
@@ -105,4 +248,10 @@ parlay::sequence<const point<dim>*> bruteforceKnn(const parlay::sequence<point<d
   return idx;
 }
 
+template <int dim>
+parlay::sequence<const point<dim>*> bruteforceKnn(const parlay::sequence<point<dim>>& queries,
+                                                  size_t k) {
+  return bruteforceKnn(queries, queries, k);
+}
+
 }  // namespace batchKdTree::knnBuf
@@ -0,0 +1,116 @@
+// This code is part of the project "Parallel Batch-Dynamic Kd-Trees"
+// Copyright (c) 2021-2022 Rahul Yesantharao, Yiqiu Wang, Laxman Dhulipala, Julian Shun
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "parlay/sequence.h"
+#include "common/geometry.h"
+
+#include "macro.h"
+
+namespace batchKdTree {
+
+/*!
+ * Structure-of-arrays copy of a tree's item coordinates: coordinate [d] of items[i] is at
+ * coords[d * stride + i]. It is (re)built after every build (items do not move in between) and lets
+ * the leaf scans handle a whole leaf/cluster with vector instructions.
+ * An empty mirror ([coords] == nullptr) means the scans read the items directly.
+ */
+template <int dim>
+struct leafMirror {
+  const double *coords = nullptr;
+  size_t stride = 0;
+
+  bool empty() const { return coords == nullptr; }
+  const double *column(int d, size_t start) const { return coords + d * stride + start; }
+};
+
+// Number of items handled per call of the kernels below
+constexpr size_t LEAF_SCAN_BLOCK = 64;
+
+/*!
+ * Squared distances from [q] to the items [start, start + n) of [m]; n <= LEAF_SCAN_BLOCK.
+ * The per-lane arithmetic is the same as point::distSqr (summed in dimension order).
+ */
+template <int dim>
+inline void leafDistSqr(
+    const leafMirror<dim> &m, size_t start, size_t n, const point<dim> &q, double *out) {
+  size_t i = 0;
+#if defined(__AVX512F__)
+  for (; i + 8 <= n; i += 8) {
+    __m512d acc = _mm512_setzero_pd();
+    for (int d = 0; d < dim; d++) {
+      __m512d t = _mm512_sub_pd(_mm512_loadu_pd(m.column(d, start + i)),
+                                _mm512_set1_pd(q.coordinate(d)));
+      acc = _mm512_add_pd(acc, _mm512_mul_pd(t, t));
+    }
+    _mm512_storeu_pd(out + i, acc);
+  }
+#elif defined(__AVX2__)
+  for (; i + 4 <= n; i += 4) {
+    __m256d acc = _mm256_setzero_pd();
+    for (int d = 0; d < dim; d++) {
+      __m256d t = _mm256_sub_pd(_mm256_loadu_pd(m.column(d, start + i)),
+                                _mm256_set1_pd(q.coordinate(d)));
+      acc = _mm256_add_pd(acc, _mm256_mul_pd(t, t));
+    }
+    _mm256_storeu_pd(out + i, acc);
+  }
+#endif
+  for (; i < n; i++) {
+    double acc = 0;
+    for (int d = 0; d < dim; d++) {
+      double t = m.column(d, start)[i] - q.coordinate(d);
+      acc += t * t;
+    }
+    out[i] = acc;
+  }
+}
+
+/*!
+ * Box membership of the items [start, start + n) of [m] in [qMin, qMax]; n <= LEAF_SCAN_BLOCK.
+ * Written branch-free over the columns so that the compiler vectorizes it.
+ */
+template <int dim>
+inline void leafInBox(const leafMirror<dim> &m,
+                      size_t start,
+                      size_t n,
+                      const point<dim> &qMin,
+                      const point<dim> &qMax,
+                      bool *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = true;
+  for (int d = 0; d < dim; d++) {
+    const double *c = m.column(d, start);
+    const double lo = qMin.coordinate(d), hi = qMax.coordinate(d);
+    for (size_t i = 0; i < n; i++)
+      out[i] &= (c[i] >= lo) & (c[i] <= hi);
+  }
+}
+
+}  // End namespace batchKdTree
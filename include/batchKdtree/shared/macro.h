@@ -32,13 +32,12 @@ namespace batchKdTree {
 //#define PRINT_DELETE_TIMINGS
 //#define PRINT_KDTREE_TIMINGS
 //#define PRINT_COKDTREE_TIMINGS
-//#define USE_MEDIAN_SELECTION
+//#define USE_MEDIAN_SORT
 //#define PRINT_PARALLEL_PARTITION_TIMINGS
 //#define ERASE_SEARCH_TIMES
 
 //#define ALL_USE_BLOOM
 //#define LOGTREE_USE_BLOOM
-//#define BLOOM_FILTER_BUILD_COPY
 
 #define PARTITION_OBJECT_MEDIAN 0
 #define PARTITION_SPATIAL_MEDIAN 1
@@ -58,12 +57,33 @@ namespace batchKdTree {
 // LOGTREE BUFFER
 #define BHL_BUFFER 0
 #define ARR_BUFFER 1
+#ifndef LOGTREE_BUFFER
 #define LOGTREE_BUFFER BHL_BUFFER
+#endif
+
+// LOGTREE MERGE POLICY (see log-tree/policy.h)
+#define LEVELED_MERGE 0
+#define TIERED_MERGE 1
+#ifndef LOGTREE_MERGE_POLICY
+#define LOGTREE_MERGE_POLICY LEVELED_MERGE
+#endif
+
+#ifndef LOGTREE_FANOUT
+#define LOGTREE_FANOUT 2
+#endif
+
+#ifndef LOGTREE_MAX_RUNS
+#define LOGTREE_MAX_RUNS 1
+#endif
 
 // KNN OPTIMIZATION
-#define FEWER_SQRT 0
 #define SPATIAL_SORT 0
 
+// keep a structure-of-arrays copy of the item coordinates for SIMD leaf scans
+#ifndef LEAF_SOA
+#define LEAF_SOA 0
+#endif
+
 // LEAF CLUSTER SIZE
 #ifndef CLUSTER_SIZE
 #define CLUSTER_SIZE 16
@@ -98,23 +118,22 @@ namespace batchKdTree {
 #define BHL_BUILD_BASE_CASE 1000
 #endif
 
-#ifdef PRINT_CONFIG
-#include <iostream>
-void print_config() {
-  std::cout << "DUAL_KNN_MODE = " << DUAL_KNN_MODE << ";\n"
-            << "PARTITION_TYPE = " << PARTITION_TYPE << ";\n"
-            << "LOGTREE_BUFFER = " << LOGTREE_BUFFER << ";\n"
-            << "CLUSTER_SIZE = " << CLUSTER_SIZE << ";\n"
-            << "ERASE_BASE_CASE = " << ERASE_BASE_CASE << ";\n"
-            << "RANGEQUERY_BASE_CASE = " << RANGEQUERY_BASE_CASE << ";\n"
-            << "BOUNDINGBOX_BASE_CASE = " << BOUNDINGBOX_BASE_CASE << ";\n"
-            << "DUALKNN_BASE_CASE = " << DUALKNN_BASE_CASE << ";\n"
-            << "CO_TOP_BUILD_BASE_CASE = " << CO_TOP_BUILD_BASE_CASE << ";\n"
-            << "CO_BOTTOM_BUILD_BASE_CASE = " << CO_BOTTOM_BUILD_BASE_CASE << ";\n"
-            << "BHL_BUILD_BASE_CASE = " << BHL_BUILD_BASE_CASE << std::endl;
-}
-#else
-void print_config() {}
+#ifndef MEDIAN_SELECT_BASE_CASE
+#define MEDIAN_SELECT_BASE_CASE 10000
+#endif
+
+// multi-level partition: number of top levels split in one pass, and the minimum size to use it
+#ifndef MULTILEVEL_PARTITION_LEVELS
+#define MULTILEVEL_PARTITION_LEVELS 4
+#endif
+
+#ifndef MULTILEVEL_PARTITION_BASE_CASE
+#define MULTILEVEL_PARTITION_BASE_CASE 100000
+#endif
+
+// VersionedLogTree, INSERT_ASYNC: the number of staged (not yet merged) points before inserts wait
+#ifndef LOGTREE_STAGING_BUDGET
+#define LOGTREE_STAGING_BUDGET (1 << 22)
 #endif
 
 } // End namespace batchKdTree
\ No newline at end of file
@@ -0,0 +1,105 @@
+// This code is part of the project "Parallel Batch-Dynamic Kd-Trees"
+// Copyright (c) 2021-2022 Rahul Yesantharao, Yiqiu Wang, Laxman Dhulipala, Julian Shun
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include "common/geometry.h"
+
+#include "knnbuffer.h"
+
+namespace batchKdTree {
+
+// Payload storage for [object]; the void specialization is empty so that it takes no space.
+template <class payloadT>
+struct objectPayload {
+  payloadT payload;
+  objectPayload() : payload() {}
+  objectPayload(const payloadT &payload_) : payload(payload_) {}
+};
+template <>
+struct objectPayload<void> {};
+
+/*!
+ * A point that carries a user-assigned id and an optional fixed-size payload. Objects can be used
+ * as [objT] in every tree: the trees only look at the [point] part, and the id/payload travel with
+ * the coordinates through builds, rebuilds and queries.
+ */
+template <int _dim, class _payloadT = void, class _idT = size_t>
+class object : public point<_dim>, public objectPayload<_payloadT> {
+  typedef point<_dim> pointT;
+  typedef objectPayload<_payloadT> payloadBase;
+
+ public:
+  typedef _idT idT;
+  typedef _payloadT payloadT;
+  static constexpr idT NO_ID = std::numeric_limits<idT>::max();
+
+  idT id;
+
+  object() : pointT(), payloadBase(), id(NO_ID) {}
+  object(const pointT &p, idT id_) : pointT(p), payloadBase(), id(id_) {}
+  template <class P = _payloadT, class = std::enable_if_t<!std::is_void<P>::value>>
+  object(const pointT &p, idT id_, const P &payload_) : pointT(p), payloadBase(payload_), id(id_) {}
+
+  // two objects are the same if they have the same id at the same location
+  friend bool operator==(const object &a, const object &b) {
+    return (a.id == b.id) && (static_cast<const pointT &>(a) == static_cast<const pointT &>(b));
+  }
+  friend bool operator!=(const object &a, const object &b) { return !(a == b); }
+};
+
+// A single knn result: the id of the neighbor and its distance from the query.
+template <class idT>
+struct neighbor {
+  idT id;
+  double dist;
+};
+
+// Convert a knn buffer entry into a caller-facing result. [objT] is the element type of the tree
+// the entry points into; the entry itself is a (base class) point pointer.
+template <class objT, class pointT>
+inline void storeKnnResult(const pointT *&dest, const knnBuf::elem<const pointT *> &e) {
+  dest = e.entry;
+}
+template <class objT, class pointT>
+inline void storeKnnResult(typename objT::idT &dest, const knnBuf::elem<const pointT *> &e) {
+  dest = e.entry ? static_cast<const objT *>(e.entry)->id : objT::NO_ID;
+}
+template <class objT, class pointT>
+inline void storeKnnResult(neighbor<typename objT::idT> &dest,
+                           const knnBuf::elem<const pointT *> &e) {
+  dest.id = e.entry ? static_cast<const objT *>(e.entry)->id : objT::NO_ID;
+  dest.dist = std::sqrt(e.cost);  // buffer costs are squared distances
+}
+
+// Store the k nearest candidates of [buf] into dest[0, k), nearest first.
+template <class objT, class outT, class bufT>
+inline void storeKnnResults(outT *dest, bufT &buf) {
+  buf.sortK();
+  for (int j = 0; j < buf.k; j++)
+    storeKnnResult<objT>(dest[j], buf[j]);
+}
+
+}  // End namespace batchKdTree
@@ -0,0 +1,156 @@
+// This code is part of the project "Parallel Batch-Dynamic Kd-Trees"
+// Copyright (c) 2021-2022 Rahul Yesantharao, Yiqiu Wang, Laxman Dhulipala, Julian Shun
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "macro.h"
+
+// environment variable naming a tuning profile to load when the tuning is first used
+#ifndef TUNING_PROFILE_ENV
+#define TUNING_PROFILE_ENV "BATCHKDTREE_TUNING"
+#endif
+
+namespace batchKdTree {
+
+/*!
+ * Runtime leaf size and parallel grain sizes. Every field defaults to the macro of the same
+ * (upper-case) name in macro.h. A profile is a list of "NAME = value;" lines, as written by
+ * [write]; names it leaves out keep their current value, and '#' starts a comment.
+ */
+struct tuningParams {
+  size_t cluster_size = CLUSTER_SIZE;
+  size_t erase_base_case = ERASE_BASE_CASE;
+  size_t rangequery_base_case = RANGEQUERY_BASE_CASE;
+  size_t boundingbox_base_case = BOUNDINGBOX_BASE_CASE;
+  size_t dualknn_base_case = DUALKNN_BASE_CASE;
+  size_t co_top_build_base_case = CO_TOP_BUILD_BASE_CASE;
+  size_t co_bottom_build_base_case = CO_BOTTOM_BUILD_BASE_CASE;
+  size_t bhl_build_base_case = BHL_BUILD_BASE_CASE;
+  size_t multilevel_partition_base_case = MULTILEVEL_PARTITION_BASE_CASE;
+
+  // call f(name, member) for every field
+  template <class F>
+  static void forEachField(F f) {
+    f("CLUSTER_SIZE", &tuningParams::cluster_size);
+    f("ERASE_BASE_CASE", &tuningParams::erase_base_case);
+    f("RANGEQUERY_BASE_CASE", &tuningParams::rangequery_base_case);
+    f("BOUNDINGBOX_BASE_CASE", &tuningParams::boundingbox_base_case);
+    f("DUALKNN_BASE_CASE", &tuningParams::dualknn_base_case);
+    f("CO_TOP_BUILD_BASE_CASE", &tuningParams::co_top_build_base_case);
+    f("CO_BOTTOM_BUILD_BASE_CASE", &tuningParams::co_bottom_build_base_case);
+    f("BHL_BUILD_BASE_CASE", &tuningParams::bhl_build_base_case);
+    f("MULTILEVEL_PARTITION_BASE_CASE", &tuningParams::multilevel_partition_base_case);
+  }
+
+  void set(const std::string &name, size_t value) {
+    bool found = false;
+    forEachField([&](const char *field_name, size_t tuningParams::*field) {
+      if (name == field_name) {
+        this->*field = value;
+        found = true;
+      }
+    });
+    if (!found) throw std::runtime_error("Unknown tuning parameter: " + name);
+    if (cluster_size == 0) throw std::runtime_error("CLUSTER_SIZE must be positive");
+  }
+
+  void read(std::istream &is) {
+    std::string line;
+    while (std::getline(is, line)) {
+      auto comment = line.find('#');
+      if (comment != std::string::npos) line.erase(comment);
+      for (auto &c : line)
+        if (c == '=' || c == ';') c = ' ';
+      std::istringstream ss(line);
+      std::string name;
+      long long value;
+      if (!(ss >> name)) continue;  // blank line
+      if (!(ss >> value) || value < 0)
+        throw std::runtime_error("Invalid tuning profile line: " + line);
+      set(name, (size_t)value);
+    }
+  }
+
+  void write(std::ostream &os) const {
+    forEachField([&](const char *name, size_t tuningParams::*field) {
+      os << name << " = " << this->*field << ";\n";
+    });
+  }
+
+  void load(const std::string &path) {
+    std::ifstream is(path);
+    if (!is) throw std::runtime_error("Could not open tuning profile " + path);
+    read(is);
+  }
+
+  void save(const std::string &path) const {
+    std::ofstream os(path);
+    if (!os) throw std::runtime_error("Could not write tuning profile " + path);
+    write(os);
+  }
+};
+
+/*!
+ * The process-wide tuning consulted by the trees. On first use it loads the profile named by
+ * $TUNING_PROFILE_ENV, if set. Trees read [cluster_size] when they are constructed, and the grain
+ * sizes on every call, so set it up before building trees.
+ */
+inline tuningParams &tuning() {
+  static tuningParams params = []() {
+    tuningParams ret;
+    if (const char *path = std::getenv(TUNING_PROFILE_ENV)) ret.load(path);
+    return ret;
+  }();
+  return params;
+}
+
+// Write the configuration as a tuning profile: the compile-time options as comments, then the
+// current [tuning], so the output loads back.
+inline void writeConfig(std::ostream &os) {
+  os << "# DUAL_KNN_MODE = " << DUAL_KNN_MODE << ";\n"
+     << "# PARTITION_TYPE = " << PARTITION_TYPE << ";\n"
+     << "# LOGTREE_BUFFER = " << LOGTREE_BUFFER << ";\n"
+     << "# LOGTREE_MERGE_POLICY = " << LOGTREE_MERGE_POLICY << ";\n"
+     << "# LOGTREE_FANOUT = " << LOGTREE_FANOUT << ";\n"
+     << "# LOGTREE_MAX_RUNS = " << LOGTREE_MAX_RUNS << ";\n"
+     << "# LEAF_SOA = " << LEAF_SOA << ";\n"
+     << "# MEDIAN_SELECT_BASE_CASE = " << MEDIAN_SELECT_BASE_CASE << ";\n"
+     << "# MULTILEVEL_PARTITION_LEVELS = " << MULTILEVEL_PARTITION_LEVELS << ";\n"
+     << "# LOGTREE_STAGING_BUDGET = " << LOGTREE_STAGING_BUDGET << ";\n";
+  tuning().write(os);
+}
+
+#ifdef PRINT_CONFIG
+inline void print_config() { writeConfig(std::cout); }
+#else
+inline void print_config() {}
+#endif
+
+}  // End namespace batchKdTree
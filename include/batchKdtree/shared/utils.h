@@ -23,13 +23,18 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+
 #include "parlay/parallel.h"
 #include "parlay/sequence.h"
 #include "parlay/primitives.h"
 #include "parlay/monoid.h"
 #include "parlay/delayed_sequence.h"
+#include "parlay/utilities.h"
 
 #include "macro.h"
+#include "tuning.h"
 
 namespace batchKdTree {
 
@@ -91,16 +96,104 @@ static inline void serialMedianPartitionSelect(parlay::slice<objT *, objT *> &it
   std::nth_element(items.begin(), items.begin() + split_point, items.end(), compare);
 }
 
+// parallel select based implementation (sample select): choose two pivots from a sample so that
+// the k-th element most likely falls between them, partition [items] three ways around them in
+// parallel, and recurse on the bucket that contains the k-th element.
+// Afterwards, items[k] is the k-th smallest element, and everything before (after) it is <= (>=).
+template <class objT>
+static void parallelSelect(parlay::slice<objT *, objT *> items, int dimension, size_t k) {
+  auto compare = [dimension](const objT &l, const objT &r) {
+    return l.coordinate(dimension) < r.coordinate(dimension);
+  };
+  const size_t n = items.size();
+  assert(k < n);
+  if (n < MEDIAN_SELECT_BASE_CASE) {
+    std::nth_element(items.begin(), items.begin() + k, items.end(), compare);
+    return;
+  }
+
+  // pick the pivots: order statistics of a sample that bracket the k-th element w.h.p.
+  const size_t num_samples = std::min(n, 8 * (size_t)std::sqrt((double)n));
+  auto samples = parlay::tabulate(num_samples, [&](size_t i) {
+    return items[parlay::hash64(n + i) % n].coordinate(dimension);
+  });
+  std::sort(samples.begin(), samples.end());
+  const size_t sample_k = (k * num_samples) / n;
+  const size_t delta = 2 * (size_t)std::sqrt((double)num_samples) + 1;
+  const double lo = samples[sample_k > delta ? sample_k - delta : 0];
+  const double hi = samples[std::min(num_samples - 1, sample_k + delta)];
+  auto bucket = [lo, hi, dimension](const objT &o) {
+    auto c = o.coordinate(dimension);
+    return (c < lo) ? 0 : ((c > hi) ? 2 : 1);
+  };
+
+  // count the bucket sizes in each block
+  const size_t num_blocks = std::min(parlay::num_workers() * 8, (n + 1023) / 1024);
+  const size_t block_size = (n + num_blocks - 1) / num_blocks;
+  parlay::sequence<size_t> offsets(3 * num_blocks);  // [bucket][block]
+  parlay::parallel_for(0, num_blocks, [&](size_t b) {
+    size_t counts[3] = {0, 0, 0};
+    auto end = std::min((b + 1) * block_size, n);
+    for (size_t j = b * block_size; j < end; j++)
+      counts[bucket(items[j])]++;
+    for (int c = 0; c < 3; c++)
+      offsets[c * num_blocks + b] = counts[c];
+  });
+  size_t bucket_start[4];
+  size_t total = 0;
+  for (int c = 0; c < 3; c++) {
+    bucket_start[c] = total;
+    for (size_t b = 0; b < num_blocks; b++) {
+      auto cnt = offsets[c * num_blocks + b];
+      offsets[c * num_blocks + b] = total;
+      total += cnt;
+    }
+  }
+  bucket_start[3] = total;
+
+  // scatter into [less | between | greater] and copy back
+  parlay::sequence<objT> tmp(n);
+  parlay::parallel_for(0, num_blocks, [&](size_t b) {
+    size_t pos[3];
+    for (int c = 0; c < 3; c++)
+      pos[c] = offsets[c * num_blocks + b];
+    auto end = std::min((b + 1) * block_size, n);
+    for (size_t j = b * block_size; j < end; j++)
+      tmp[pos[bucket(items[j])]++] = items[j];
+  });
+  parlay::parallel_for(0, num_blocks, [&](size_t b) {
+    auto end = std::min((b + 1) * block_size, n);
+    for (size_t j = b * block_size; j < end; j++)
+      items[j] = tmp[j];
+  });
+
+  // recurse into the bucket that holds the k-th element
+  int c = (k < bucket_start[1]) ? 0 : ((k < bucket_start[2]) ? 1 : 2);
+  auto sub = items.cut(bucket_start[c], bucket_start[c + 1]);
+  if (c == 1 && lo == hi) return;  // all equal
+  if (sub.size() == n) {           // no progress (heavily duplicated keys); finish serially
+    std::nth_element(items.begin(), items.begin() + k, items.end(), compare);
+    return;
+  }
+  parallelSelect<objT>(sub, dimension, k - bucket_start[c]);
+}
+
+template <class objT>
+static inline void parallelMedianPartitionSelect(parlay::slice<objT *, objT *> &items,
+                                                 int dimension) {
+  parallelSelect<objT>(items, dimension, split_n(items));
+}
+
 // Top level functions ------------------
 // object median
 template <class objT>
 double parallelMedianPartition(parlay::slice<objT *, objT *> items, int dimension) {
-#ifdef USE_MEDIAN_SELECTION
-  serialMedianPartitionSelect<objT>(items, dimension);  // selection-based version
-  return split_val<objT, true>(items, dimension);
-#else
+#ifdef USE_MEDIAN_SORT
   medianPartitionSort<objT, true>(items, dimension);  // sort-based version
   return split_val(items, dimension);
+#else
+  parallelMedianPartitionSelect<objT>(items, dimension);  // selection-based version
+  return split_val<objT, true>(items, dimension);
 #endif
 }
 
@@ -115,6 +208,187 @@ double serialMedianPartition(parlay::slice<objT *, objT *> items, int dimension)
   //#endif
 }
 
+// MULTI-LEVEL PARTITION ---------------------------------------------------------------------------
+// Object-median partition for the top [num_levels] levels of a subtree in one pass over [items],
+// instead of one full partition per level. Level l splits on dimension (split_dim + l) % dim.
+//
+// A sample gives every node of the top tree a bracket [lo, hi] around its median. One read pass
+// routes each point down the brackets: it either ends up in one of the 2^num_levels leaf buckets
+// or stops at the first node whose bracket it falls into. One scatter groups the points by
+// bucket, the (few) stopped points are resolved top-down with an exact selection per node, and
+// the buckets are copied back. The result is the same as num_levels rounds of
+// parallelMedianPartition: every bucket has exactly the object-median size.
+//
+// On success, [splits] holds the split values in heap order (the children of splits[i] are
+// splits[2i+1] and splits[2i+2]) and [items] holds the 2^num_levels buckets left to right.
+// Returns false (and leaves [items] untouched) when the sample missed a median; the caller then
+// falls back to partitioning level by level.
+inline bool multiLevelPartitionInParallel(size_t num_points) {
+  return num_points >= tuning().multilevel_partition_base_case;
+}
+
+template <class objT>
+bool multiLevelMedianPartition(parlay::slice<objT *, objT *> items,
+                               int split_dim,
+                               int num_levels,
+                               parlay::sequence<double> &splits) {
+  constexpr int dim = objT::dim;
+  const size_t n = items.size();
+  const size_t num_leaves = (size_t)1 << num_levels;
+  const size_t num_nodes = num_leaves - 1;
+  const size_t num_buckets = num_leaves + num_nodes;  // [leaves | stopped at node]
+  assert(num_levels >= 1);
+  if ((n >> num_levels) == 0) return false;
+  auto coord = [&](size_t i, int level) {
+    return items[i].coordinate((split_dim + level) % dim);
+  };
+
+  // brackets: split a sample on its own medians, top down
+  const size_t num_samples =
+      std::min(n, num_leaves * 8 * (size_t)std::sqrt((double)(n >> num_levels)));
+  auto samples = parlay::tabulate(num_samples, [&](size_t i) { return parlay::hash64(n + i) % n; });
+  parlay::sequence<double> lo(num_nodes), hi(num_nodes);
+  for (int level = 0; level < num_levels; level++) {
+    size_t first = ((size_t)1 << level) - 1;
+    parlay::parallel_for(0, (size_t)1 << level, [&](size_t j) {
+      size_t s = (j * num_samples) >> level, e = ((j + 1) * num_samples) >> level, m = e - s;
+      if (m == 0) {
+        lo[first + j] = std::numeric_limits<double>::lowest();
+        hi[first + j] = std::numeric_limits<double>::max();
+        return;
+      }
+      std::sort(samples.begin() + s, samples.begin() + e, [&](size_t l, size_t r) {
+        return coord(l, level) < coord(r, level);
+      });
+      const size_t delta = 2 * (size_t)std::sqrt((double)m) + 1;
+      lo[first + j] = coord(samples[s + (m / 2 > delta ? m / 2 - delta : 0)], level);
+      hi[first + j] = coord(samples[s + std::min(m - 1, m / 2 + delta)], level);
+    });
+  }
+  auto bucket = [&](size_t i) {
+    size_t v = 0;
+    for (int level = 0; level < num_levels; level++) {
+      auto c = coord(i, level);
+      if (c < lo[v])
+        v = 2 * v + 1;
+      else if (c > hi[v])
+        v = 2 * v + 2;
+      else
+        return num_leaves + v;
+    }
+    return v - num_nodes;
+  };
+
+  // count the bucket sizes in each block
+  const size_t num_blocks = std::min(parlay::num_workers() * 8, (n + 1023) / 1024);
+  const size_t block_size = (n + num_blocks - 1) / num_blocks;
+  parlay::sequence<size_t> offsets(num_buckets * num_blocks);  // [bucket][block]
+  parlay::parallel_for(0, num_blocks, [&](size_t b) {
+    parlay::sequence<size_t> counts(num_buckets, 0);
+    auto end = std::min((b + 1) * block_size, n);
+    for (size_t j = b * block_size; j < end; j++)
+      counts[bucket(j)]++;
+    for (size_t c = 0; c < num_buckets; c++)
+      offsets[c * num_blocks + b] = counts[c];
+  });
+  parlay::sequence<size_t> bucket_start(num_buckets + 1);
+  size_t total = 0;
+  for (size_t c = 0; c < num_buckets; c++) {
+    bucket_start[c] = total;
+    for (size_t b = 0; b < num_blocks; b++) {
+      auto cnt = offsets[c * num_blocks + b];
+      offsets[c * num_blocks + b] = total;
+      total += cnt;
+    }
+  }
+  bucket_start[num_buckets] = total;
+
+  // scatter by bucket
+  parlay::sequence<objT> tmp(n);
+  parlay::parallel_for(0, num_blocks, [&](size_t b) {
+    parlay::sequence<size_t> pos(num_buckets);
+    for (size_t c = 0; c < num_buckets; c++)
+      pos[c] = offsets[c * num_blocks + b];
+    auto end = std::min((b + 1) * block_size, n);
+    for (size_t j = b * block_size; j < end; j++)
+      tmp[pos[bucket(j)]++] = items[j];
+  });
+
+  // number of routed points below each node of the full heap (leaves at num_nodes..)
+  parlay::sequence<size_t> below(num_nodes + num_leaves);
+  for (size_t h = num_nodes + num_leaves; h-- > 0;) {
+    if (h >= num_nodes)
+      below[h] = bucket_start[h - num_nodes + 1] - bucket_start[h - num_nodes];
+    else
+      below[h] = bucket_start[num_leaves + h + 1] - bucket_start[num_leaves + h] +
+                 below[2 * h + 1] + below[2 * h + 2];
+  }
+
+  // resolve the stopped points top down: [loose] holds the points (indices into [tmp]) that
+  // belong to a node but were not routed into its subtree
+  splits = parlay::sequence<double>(num_nodes);
+  parlay::sequence<parlay::sequence<size_t>> loose(1);
+  for (int level = 0; level < num_levels; level++) {
+    size_t first = ((size_t)1 << level) - 1;
+    int d = (split_dim + level) % dim;
+    auto key = [&](size_t i) { return tmp[i].coordinate(d); };
+    parlay::sequence<parlay::sequence<size_t>> next((size_t)2 << level);
+    parlay::sequence<bool> ok((size_t)1 << level, true);
+    parlay::parallel_for(0, (size_t)1 << level, [&](size_t j) {
+      size_t v = first + j;
+      parlay::sequence<size_t> left, right;
+      auto stopped = bucket_start[num_leaves + v];
+      auto middle = parlay::tabulate(bucket_start[num_leaves + v + 1] - stopped,
+                                     [&](size_t i) { return stopped + i; });
+      for (auto i : loose[j]) {
+        if (key(i) < lo[v])
+          left.push_back(i);
+        else if (key(i) > hi[v])
+          right.push_back(i);
+        else
+          middle.push_back(i);
+      }
+
+      // the object median must be among the middle points
+      size_t k = (below[v] + loose[j].size()) / 2;
+      size_t num_left = below[2 * v + 1] + left.size();
+      if (k < num_left || k >= num_left + middle.size()) {
+        ok[j] = false;
+        return;
+      }
+      auto mid = middle.begin() + (k - num_left);
+      std::nth_element(middle.begin(), mid, middle.end(), [&](size_t l, size_t r) {
+        return key(l) < key(r);
+      });
+      splits[v] = key(*mid);
+      left.append(middle.cut(0, mid - middle.begin()));
+      right.append(middle.cut(mid - middle.begin(), middle.size()));
+      next[2 * j] = std::move(left);
+      next[2 * j + 1] = std::move(right);
+    });
+    for (auto b : ok)
+      if (!b) return false;
+    loose = std::move(next);
+  }
+
+  // copy back: each leaf bucket followed by the points resolved into it
+  parlay::sequence<size_t> leaf_start(num_leaves + 1);
+  leaf_start[0] = 0;
+  for (size_t b = 0; b < num_leaves; b++)
+    leaf_start[b + 1] = leaf_start[b] + below[num_nodes + b] + loose[b].size();
+  assert(leaf_start[num_leaves] == n);
+  parlay::parallel_for(0, num_leaves, [&](size_t b) {
+    auto routed = below[num_nodes + b];
+    parlay::parallel_for(0, routed, [&](size_t i) {
+      items[leaf_start[b] + i] = tmp[bucket_start[b] + i];
+    });
+    parlay::parallel_for(0, loose[b].size(), [&](size_t i) {
+      items[leaf_start[b] + routed + i] = tmp[loose[b][i]];
+    });
+  }, 1);
+  return true;
+}
+
 // PARTITION FUNCTIONS -----------------------------------------------------------------------------
 
 template <class objT>
@@ -124,12 +398,14 @@ auto serialPartition(parlay::slice<objT *, objT *> points, int dimension, double
   return ret_it - points.begin();
 }
 
+/*!
+ * Partition [points] in place around [value] on [dimension], and return the number of points below
+ * it. Each block is partitioned serially; then the points at or above [value] left of the split are
+ * swapped with the points below it right of the split, pairing them up by rank. No temporary is
+ * allocated and each misplaced point moves once.
+ */
 template <class objT>
-auto parallelPartition(parlay::slice<objT *, objT *> points,
-                       parlay::slice<bool *, bool *> flags,
-                       int dimension,
-                       double value) {
-  // construct partition flags (split_two puts false first)
+size_t parallelPartition(parlay::slice<objT *, objT *> points, int dimension, double value) {
 #ifdef PRINT_PARALLEL_PARTITION_TIMINGS
   bool print_timings = (points.size() == 2000000);
   timer t("parallelPartition");
@@ -138,41 +414,63 @@ auto parallelPartition(parlay::slice<objT *, objT *> points,
   };
 #endif
 
-  parlay::parallel_for(0, points.size(), [dimension, value, points, flags](size_t i) {
-    if (points[i].coordinate(dimension) < value)
-      flags[i] = false;
-    else
-      flags[i] = true;
-  });
-
-#ifdef PRINT_PARALLEL_PARTITION_TIMINGS
-  mtime("flags set");
-#endif
+  const size_t n = points.size();
+  if (n == 0) return 0;
+  const size_t block_size = (n + parlay::num_workers() * 8 - 1) / (parlay::num_workers() * 8);
+  const size_t num_blocks = (n + block_size - 1) / block_size;
+  auto block_start = [&](size_t b) { return b * block_size; };
+  auto block_end = [&](size_t b) { return std::min(n, (b + 1) * block_size); };
 
-  // perform partition and copy back to original points array
-  const auto &[res, split_pt] = parlay::internal::split_two(points, flags);
+  // the points below [value] are at [block_start(b), block_mid[b])
+  parlay::sequence<size_t> block_mid(num_blocks);
+  parlay::parallel_for(
+      0, num_blocks, [&](size_t b) {
+        auto block = points.cut(block_start(b), block_end(b));
+        block_mid[b] = block_start(b) + serialPartition(block, dimension, value);
+      }, 1);
+  size_t split_pt = 0;
+  for (size_t b = 0; b < num_blocks; b++)
+    split_pt += block_mid[b] - block_start(b);
 
 #ifdef PRINT_PARALLEL_PARTITION_TIMINGS
-  mtime("split2: " + std::to_string(res.size()));
+  mtime("blocks partitioned");
 #endif
 
-  const size_t num_blocks = parlay::num_workers() * 8;
-  const size_t block_size = (points.size() + num_blocks - 1) / num_blocks;
-  parlay::parallel_for(0, num_blocks, [&](size_t i) {
-    auto start_idx = i * block_size;
-    auto end_idx = std::min((i + 1) * block_size, points.size());
-    for (size_t j = start_idx; j < end_idx; j++)
-      points[j] = res[j];
-  });
+  // the misplaced points of block b: [block_mid[b], block_end(b)) below [split_pt] and
+  // [block_start(b), block_mid[b]) from [split_pt] on
+  auto high_start = [&](size_t b) { return block_mid[b]; };
+  auto low_start = [&](size_t b) { return std::max(block_start(b), split_pt); };
+  parlay::sequence<size_t> high_rank(num_blocks), low_rank(num_blocks);
+  for (size_t b = 0; b < num_blocks; b++) {
+    high_rank[b] = std::min(block_end(b), split_pt) - std::min(block_mid[b], split_pt);
+    low_rank[b] = std::max(block_mid[b], split_pt) - low_start(b);
+  }
+  [[maybe_unused]] auto num_misplaced = parlay::scan_inplace(high_rank);
+  [[maybe_unused]] auto num_misplaced_low = parlay::scan_inplace(low_rank);
+  assert(num_misplaced == num_misplaced_low);
+
+  // the k-th misplaced high point is swapped with the k-th misplaced low point
+  parlay::parallel_for(
+      0, num_blocks, [&](size_t b) {
+        auto end = (b + 1 < num_blocks) ? high_rank[b + 1] : num_misplaced;
+        size_t j = std::upper_bound(low_rank.begin(), low_rank.end(), high_rank[b]) -
+                   low_rank.begin() - 1;
+        for (size_t r = high_rank[b]; r < end; r++) {
+          while (j + 1 < num_blocks && low_rank[j + 1] <= r)
+            j++;
+          std::swap(points[high_start(b) + (r - high_rank[b])],
+                    points[low_start(j) + (r - low_rank[j])]);
+        }
+      }, 1);
 
 #ifdef PRINT_PARALLEL_PARTITION_TIMINGS
-  mtime("copyback");
+  mtime("swapped");
 #endif
 
   return split_pt;
 }
 
-bool eraseInParallel(size_t num_points) { return num_points >= ERASE_BASE_CASE; }
+inline bool eraseInParallel(size_t num_points) { return num_points >= tuning().erase_base_case; }
 
 template <class TT>
 struct minmaxm {
@@ -185,7 +483,6 @@ struct minmaxm {
 // other partition functions
 template <class objT>
 double parallelSpatialPartition(parlay::slice<objT *, objT *> items,
-                                parlay::slice<bool *, bool *> flags,
                                 int dimension,
                                 size_t &split_pt) {
   // compute median
@@ -200,7 +497,7 @@ double parallelSpatialPartition(parlay::slice<objT *, objT *> items,
   auto imed = (imin + imax) / 2;
 
   // partition
-  split_pt = parallelPartition(items, flags, dimension, imed);
+  split_pt = parallelPartition(items, dimension, imed);
   return imed;
 }
 
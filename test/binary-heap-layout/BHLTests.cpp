@@ -5,6 +5,7 @@
 
 #include "../shared/Shared2DTest.h"
 #include "../shared/QueryTest.h"
+#include "../shared/ObjectTest.h"
 #include "BHL2DStructureTest.h"
 
 using namespace batchKdTree;
@@ -37,3 +38,10 @@ typedef BHL_KdTree<dim, point<dim>, true, true> parallelCoarseTreeT;
 
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_BHL, Shared2DTest, parallelCoarseTreeT);
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_BHL, QueryTest, parallelCoarseTreeT);
+
+// objects with ids
+typedef BHL_KdTree<dim, object<dim>, false, false> serialObjectTreeT;
+typedef BHL_KdTree<dim, object<dim>, true, true> parallelCoarseObjectTreeT;
+
+INSTANTIATE_TYPED_TEST_SUITE_P(Serial_BHL, ObjectTest, serialObjectTreeT);
+INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_BHL, ObjectTest, parallelCoarseObjectTreeT);
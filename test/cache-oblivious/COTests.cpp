@@ -6,6 +6,7 @@
 #include "CO2DStructureTest.h"
 #include "../shared/Shared2DTest.h"
 #include "../shared/QueryTest.h"
+#include "../shared/ObjectTest.h"
 
 using namespace batchKdTree;
 
@@ -37,3 +38,10 @@ typedef CO_KdTree<dim, point<dim>, true, true> parallelCoarseTreeT;
 
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_CO, Shared2DTest, parallelCoarseTreeT);
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_CO, QueryTest, parallelCoarseTreeT);
+
+// objects with ids
+typedef CO_KdTree<dim, object<dim>, false, false> serialObjectTreeT;
+typedef CO_KdTree<dim, object<dim>, true, true> parallelCoarseObjectTreeT;
+
+INSTANTIATE_TYPED_TEST_SUITE_P(Serial_CO, ObjectTest, serialObjectTreeT);
+INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_CO, ObjectTest, parallelCoarseObjectTreeT);
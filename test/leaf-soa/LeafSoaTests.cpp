@@ -0,0 +1,29 @@
+#include <gtest/gtest.h>
+#include "common/geometryIO.h"
+
+#include <batchKdtree/binary-heap-layout/bhlkdtree.h>
+#include <batchKdtree/cache-oblivious/cokdtree.h>
+#include <batchKdtree/log-tree/logtree.h>
+
+#include "../shared/QueryTest.h"
+
+#if !LEAF_SOA
+#error "test_leaf_soa must be built with LEAF_SOA=1"
+#endif
+
+using namespace batchKdTree;
+
+static constexpr int dim = 2;
+
+// <dim, objT, parallel, coarse>: coarse trees have multi-point leaves
+typedef BHL_KdTree<dim, point<dim>, false, true> serialCoarseBHLT;
+typedef BHL_KdTree<dim, point<dim>, true, true> parallelCoarseBHLT;
+typedef CO_KdTree<dim, point<dim>, false, true> serialCoarseCOT;
+typedef CO_KdTree<dim, point<dim>, true, true> parallelCoarseCOT;
+typedef LogTree<14, 5, dim, point<dim>, true, true> parallelCoarseLTT;  // buffer > leaf size
+
+INSTANTIATE_TYPED_TEST_SUITE_P(SerialCoarse_BHL, QueryTest, serialCoarseBHLT);
+INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_BHL, QueryTest, parallelCoarseBHLT);
+INSTANTIATE_TYPED_TEST_SUITE_P(SerialCoarse_CO, QueryTest, serialCoarseCOT);
+INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_CO, QueryTest, parallelCoarseCOT);
+INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_LT, QueryTest, parallelCoarseLTT);
@@ -217,7 +217,130 @@ TYPED_TEST_P(LT2DStructureTest, BasicKnn3) {
   }
 }
 
-REGISTER_TYPED_TEST_SUITE_P(
-    LT2DStructureTest, LayoutSize32, LayoutSize64, Verify, BasicKnn2, BasicKnn3);
+TYPED_TEST_P(LT2DStructureTest, BasicKnn4) {
+  const char* test_file = "../resources/2d-UniformInSphere-1k.pbbs";
+  int check_dim = readDimensionFromFile(test_file);
+  ASSERT_EQ(check_dim, this->DIM);
+  auto points = readPointsFromFile<pointT>(test_file);
+
+  // spread the points over several trees, then erase some of them
+  TypeParam tree;
+  size_t inserted = 0;
+  for (size_t batch : {512, 256, 128, 64, 32, 8}) {
+    tree.insert(parlay::sequence<pointT>(points.begin() + inserted,
+                                         points.begin() + inserted + batch));
+    inserted += batch;
+  }
+  ASSERT_EQ(inserted, points.size());
+  parlay::sequence<pointT> erased, live;
+  for (size_t i = 0; i < points.size(); i++)
+    (i % 7 == 0 ? erased : live).push_back(points[i]);
+  tree.template erase<false>(erased);
+  ASSERT_EQ(tree.size(), live.size());
+  ASSERT_GT(__builtin_popcount(tree.getTreeMask()), 1);
+
+  constexpr int k = 4;
+  auto check = knnBuf::bruteforceKnn(points, live, k);
+  for (int i = 0; i < 4; i++) {
+    parlay::sequence<const pointT*> res;
+    if (i == 0) {
+      res = tree.template knn4<false, false>(points, k);
+    } else if (i == 1) {
+      res = tree.template knn4<false, true>(points, k);
+    } else if (i == 2) {
+      res = tree.template knn4<true, false>(points, k);
+    } else {
+      res = tree.template knn4<true, true>(points, k);
+    }
+
+    // verify result: same distances as the brute force solution
+    ASSERT_EQ(res.size(), k * points.size());
+    for (size_t j = 0; j < points.size(); j++) {
+      std::vector<double> res_dist, check_dist;
+      for (int g = 0; g < k; g++) {
+        res_dist.push_back(points[j].dist(*res[j * k + g]));
+        check_dist.push_back(points[j].dist(*check[j * k + g]));
+      }
+      std::sort(res_dist.begin(), res_dist.end());
+      std::sort(check_dist.begin(), check_dist.end());
+      EXPECT_EQ(res_dist, check_dist) << "query " << j;
+    }
+  }
+}
+
+TYPED_TEST_P(LT2DStructureTest, KnnWorkspace) {
+  const char* test_file = "../resources/2d-UniformInSphere-1k.pbbs";
+  auto points = readPointsFromFile<pointT>(test_file);
+  TypeParam tree;
+  tree.insert(parlay::sequence<pointT>(points.begin(), points.begin() + 992));
+  tree.insert(parlay::sequence<pointT>(points.begin() + 992, points.end()));
+
+  // one workspace shared by all the knn variants, in turn, gives their fresh results
+  typename TypeParam::knnWorkspace ws;
+  constexpr int k = 4;
+  parlay::sequence<const pointT*> res(k * points.size());
+  auto res_slice = res.head(res.size());
+  for (int round = 0; round < 2; round++) {
+    for (int variant = 0; variant < 5; variant++) {
+      parlay::sequence<const pointT*> expected;
+      if (variant == 0) {
+        expected = tree.template knn<false, false>(points, k);
+        tree.template knn<false, false>(points, k, res_slice, ws);
+      } else if (variant == 1) {
+        expected = tree.template knn2<false, false>(points, k);
+        tree.template knn2<false, false>(points, k, res_slice, ws);
+      } else if (variant == 2) {
+        expected = tree.template knn3<false, false>(points, k);
+        tree.template knn3<false, false>(points, k, res_slice, ws);
+      } else if (variant == 3) {
+        expected = tree.template knn4<false, false>(points, k);
+        tree.template knn4<false, false>(points, k, res_slice, ws);
+      } else {
+        expected = tree.template knnFixedK<k, false, false>(points);
+        tree.template knnFixedK<k, false, false>(points, res_slice, ws);
+      }
+      for (size_t i = 0; i < res.size(); i++)
+        ASSERT_EQ(res[i], expected[i]) << "variant " << variant << ", i = " << i;
+    }
+  }
+}
+
+TYPED_TEST_P(LT2DStructureTest, LazyStorage) {
+  const char* test_file = "../resources/2d-UniformInSphere-1k.pbbs";
+  int check_dim = readDimensionFromFile(test_file);
+  ASSERT_EQ(check_dim, this->DIM);
+  auto points = readPointsFromFile<pointT>(test_file);
+
+  // an empty tree holds no level storage
+  TypeParam tree;
+  auto empty_bytes = tree.memory_footprint();
+
+  tree.insert(points);
+  auto full_bytes = tree.memory_footprint();
+  ASSERT_GT(full_bytes, empty_bytes + points.size() * sizeof(pointT));
+
+  // erasing everything releases the static levels
+  tree.template erase<false>(points);
+  ASSERT_EQ(tree.size(), 0);
+  ASSERT_EQ(tree.getTreeMask(), 0);
+  ASSERT_LT(tree.memory_footprint(), full_bytes / 2);
+
+  // and they can be reallocated
+  tree.insert(points);
+  for (const auto& p : points) {
+    ASSERT_TRUE(tree.contains(p));
+  }
+  ASSERT_EQ(tree.memory_footprint(), full_bytes);
+}
+
+REGISTER_TYPED_TEST_SUITE_P(LT2DStructureTest,
+                            LayoutSize32,
+                            LayoutSize64,
+                            Verify,
+                            BasicKnn2,
+                            BasicKnn3,
+                            BasicKnn4,
+                            KnnWorkspace,
+                            LazyStorage);
 
 #endif  // TEST_LOGTREE_LT2DSTRUCTURETEST_H
@@ -1,11 +1,18 @@
 #include <gtest/gtest.h>
 #include "common/geometryIO.h"
 
+#include <atomic>
+#include <thread>
+
 #include <batchKdtree/log-tree/logtree.h>
+#include <batchKdtree/log-tree/buffer.h>
+#include <batchKdtree/log-tree/versioned.h>
+#include <batchKdtree/shared/tuning.h>
 
 #include "LT2DStructureTest.h"
 #include "LT2DDeleteTest.h"
 #include "../shared/QueryTest.h"
+#include "../shared/ObjectTest.h"
 
 using namespace batchKdTree;
 
@@ -55,3 +62,558 @@ INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_LT, LT2DStructureTest, parallelCoa
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_LT_NB, LT2DDeleteTest, PCNoBulk);
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_LT_B, LT2DDeleteTest, PCBulk);
 INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_LT, QueryTest, parallelCoarseTreeT);
+
+// objects with ids
+typedef LogTree<NUM_TREES, BUFFER_LOG2_SIZE, dim, object<dim>, false, false> serialObjectTreeT;
+typedef LogTree<NUM_TREES, 5, dim, object<dim>, true, true> parallelCoarseObjectTreeT;
+
+INSTANTIATE_TYPED_TEST_SUITE_P(Serial_LT, ObjectTest, serialObjectTreeT);
+INSTANTIATE_TYPED_TEST_SUITE_P(ParallelCoarse_LT, ObjectTest, parallelCoarseObjectTreeT);
+
+// the i-th of n test points: for n coprime to 37 no two of them share a coordinate, so erasing
+// one never depends on how ties at a split are broken
+static pointT gridPoint(size_t i, size_t n) {
+  return pointT({(double)i, (double)((i * 37) % n)});
+}
+
+static parlay::sequence<pointT> gridPoints(size_t n) {
+  return parlay::tabulate(n, [&](size_t i) { return gridPoint(i, n); });
+}
+
+// [res] holds the k nearest neighbours of each query in [live], nearest first; ties may pick
+// other points than the brute force, so the distances are compared
+template <class resT>
+static ::testing::AssertionResult sameKnn(const parlay::sequence<pointT>& queries,
+                                          const parlay::sequence<pointT>& live, const resT& res,
+                                          int k) {
+  auto check = knnBuf::bruteforceKnn(queries, live, k);
+  for (size_t i = 0; i < queries.size(); i++) {
+    std::vector<double> got, want;
+    for (int j = 0; j < k; j++) {
+      if (res[i * k + j] == nullptr) return ::testing::AssertionFailure() << "query " << i;
+      got.push_back(queries[i].distSqr(*res[i * k + j]));
+      want.push_back(queries[i].distSqr(*check[i * k + j]));
+    }
+    std::sort(want.begin(), want.end());
+    if (got != want) return ::testing::AssertionFailure() << "query " << i;
+  }
+  return ::testing::AssertionSuccess();
+}
+
+// the array buffer on its own, whichever buffer the log-trees above use
+template <bool parallel>
+void checkBufferErase() {
+  LogTreeBuffer<dim, pointT, parallel> buffer(7);
+  parlay::sequence<pointT> points;
+  for (int i = 0; i < 160; i++)  // points 150..159 repeat 0..9
+    points.push_back(pointT({(double)(i % 150), (double)(i % 150) * 2}));
+  const auto &const_points = points;
+  auto erase = [&](size_t s, size_t e) {
+    buffer.bulk_erase(parlay::sequence<pointT>(points.begin() + s, points.begin() + e));
+  };
+
+  buffer.insert(const_points.cut(0, 100));
+  ASSERT_EQ(buffer.size(), 100u);
+  erase(0, 40);
+  buffer.bulk_erase(parlay::sequence<pointT>(1, pointT({-1.0, -1.0})));  // not in the buffer
+  ASSERT_EQ(buffer.size(), 60u);
+  for (int i = 0; i < 100; i++)
+    ASSERT_EQ(buffer.contains(points[i]), i >= 40) << i;
+
+  // does not fit after the erased items, so the buffer is compacted
+  buffer.insert(const_points.cut(100, 160));
+  ASSERT_EQ(buffer.size(), 120u);
+  ASSERT_TRUE(buffer.contains(points[0]));  // re-inserted as points[150]
+
+  // a second copy of 40..47: erasing removes both
+  buffer.insert(const_points.cut(40, 48));
+  ASSERT_EQ(buffer.size(), 128u);
+  erase(40, 50);
+  ASSERT_EQ(buffer.size(), 110u);
+  ASSERT_FALSE(buffer.contains(points[45]));
+  ASSERT_TRUE(buffer.contains(points[50]));
+
+  parlay::sequence<pointT> moved(buffer.size());
+  ASSERT_EQ(buffer.moveElementsTo(moved.cut(0, moved.size())), 110u);
+  ASSERT_TRUE(buffer.empty());
+  ASSERT_FALSE(buffer.contains(points[50]));
+}
+
+TEST(LogTreeBuffer, HashedErase) {
+  checkBufferErase<false>();
+  checkBufferErase<true>();
+}
+
+// readers of a snapshot see neither the updates published after it nor half-applied ones
+template <class treeT>
+void checkSnapshots(InsertMode mode) {
+  constexpr size_t batch = 256;
+  constexpr int num_batches = 12;
+  auto points = gridPoints(batch * num_batches);
+  auto batchOf = [&](int b) {
+    return parlay::sequence<pointT>(points.begin() + b * batch, points.begin() + (b + 1) * batch);
+  };
+  const pointT pMin({-1.0, -1.0}), pMax({1e9, 1e9});
+
+  VersionedLogTree<treeT> tree(mode, 4 * batch);
+  tree.insert(batchOf(0));
+  tree.drain();
+  auto first = tree.snapshot();
+
+  // every version holds whole batches, and its range count agrees with its size
+  std::atomic<bool> done(false), consistent(true);
+  std::atomic<size_t> num_reads(0);
+  auto read = [&]() {
+    while (!done || num_reads == 0) {
+      auto snap = tree.snapshot();
+      auto n = snap->size();
+      if (n % batch != 0 || snap->rangeCount(pMin, pMax) != n) consistent = false;
+      num_reads++;
+    }
+  };
+  std::thread reader1(read), reader2(read);
+  for (int b = 1; b < num_batches; b++)
+    tree.insert(batchOf(b));
+  tree.bulk_erase(batchOf(0));
+  done = true;
+  reader1.join();
+  reader2.join();
+  ASSERT_TRUE(consistent);
+
+  ASSERT_EQ(first->size(), batch);
+  ASSERT_EQ(first->rangeCount(pMin, pMax), batch);
+  for (size_t i = 0; i < 2 * batch; i++)
+    ASSERT_EQ(first->contains(points[i]), i < batch) << i;
+
+  // the erase merged everything staged before it
+  auto erased = tree.snapshot();
+  ASSERT_EQ(erased->numStaged(), 0u);
+  ASSERT_EQ(erased->size(), (num_batches - 1) * batch);
+  for (size_t i = 0; i < points.size(); i++)
+    ASSERT_EQ(erased->contains(points[i]), i >= batch) << i;
+
+  // knn over a version that may still have staged batches
+  constexpr int k = 5;
+  tree.insert(batchOf(0));
+  auto snap = tree.snapshot();
+  auto snap_points = snap->orthogonalQuery(pMin, pMax);
+  ASSERT_EQ(snap_points.size(), snap->size());
+  ASSERT_TRUE(sameKnn(snap_points, snap_points, snap->knn(snap_points, k), k));
+
+  tree.drain();
+  ASSERT_EQ(tree.snapshot()->numStaged(), 0u);
+  ASSERT_EQ(tree.size(), points.size());
+}
+
+TEST(VersionedLogTree, SnapshotIsolation) {
+  checkSnapshots<serialSingleTreeT>(INSERT_SYNC);
+  checkSnapshots<parallelCoarseTreeT>(INSERT_SYNC);
+}
+
+TEST(VersionedLogTree, AsyncInsert) {
+  checkSnapshots<serialSingleTreeT>(INSERT_ASYNC);
+  checkSnapshots<parallelCoarseTreeT>(INSERT_ASYNC);
+}
+
+// parallel kNN queries on snapshots, from another thread, while the staged batches are merged
+template <class treeT>
+void checkQueriesDuringMerges() {
+  constexpr size_t batch = 512;
+  constexpr int num_batches = 16;
+  constexpr int k = 4;
+  constexpr size_t n = batch * num_batches;
+  auto points = gridPoints(n);
+  auto queries = parlay::tabulate(64, [&](size_t i) { return points[i * 97 % n]; });
+  const pointT pMin({-1.0, -1.0}), pMax({1e9, 1e9});
+
+  VersionedLogTree<treeT> tree(INSERT_ASYNC, 2 * batch);
+  std::atomic<bool> done(false), correct(true);
+  std::atomic<size_t> num_reads(0);
+  std::thread reader([&]() {
+    while (!done || num_reads == 0) {
+      auto snap = tree.snapshot();
+      auto live = snap->orthogonalQuery(pMin, pMax);
+      // every version holds whole batches, so it has either no points or at least k
+      if (!live.empty() && !sameKnn(queries, live, snap->knn(queries, k), k)) correct = false;
+      num_reads++;
+    }
+  });
+  for (int b = 0; b < num_batches; b++)
+    tree.insert(parlay::sequence<pointT>(points.begin() + b * batch,
+                                         points.begin() + (b + 1) * batch));
+  done = true;
+  reader.join();
+  ASSERT_TRUE(correct);
+  tree.drain();
+  ASSERT_EQ(tree.size(), n);
+}
+
+TEST(VersionedLogTree, QueriesDuringMerges) {
+  checkQueriesDuringMerges<parallelCoarseTreeT>();
+}
+
+// erasing from a copy of a tree copies the levels it touches and leaves the original intact
+template <class treeT>
+void checkEraseFromCopy() {
+  constexpr size_t n = 1000;
+  auto points = gridPoints(n);
+  const pointT pMin({-1.0, -1.0}), pMax({1e9, 1e9});
+  treeT tree(points);
+  treeT copy(tree);
+
+  parlay::sequence<pointT> bulk, single;
+  for (size_t i = 0; i < n; i++) {
+    if (i % 3 == 0) bulk.push_back(points[i]);
+    if (i % 3 == 1) single.push_back(points[i]);
+  }
+  copy.bulk_erase(bulk);
+  copy.template erase<false>(single);
+  ASSERT_EQ(tree.size(), n);
+  ASSERT_EQ(tree.rangeCount(pMin, pMax), n);
+  ASSERT_EQ(copy.size(), n - bulk.size() - single.size());
+  ASSERT_EQ(copy.rangeCount(pMin, pMax), copy.size());
+  for (size_t i = 0; i < n; i++) {
+    ASSERT_TRUE(tree.contains(points[i])) << i;
+    ASSERT_EQ(copy.contains(points[i]), i % 3 == 2) << i;
+  }
+}
+
+TEST(LogTreeCopy, EraseFromCopy) {
+  checkEraseFromCopy<serialSingleTreeT>();
+  checkEraseFromCopy<parallelCoarseTreeT>();
+}
+
+// knn on a tree with no points in use finds no neighbors, before any insert and after erasing
+// everything
+template <class treeT>
+void checkEmptyKnn() {
+  constexpr int k = 3;
+  auto points = gridPoints(100);
+  auto allMissing = [&](const parlay::sequence<const pointT*>& res) {
+    for (auto p : res)
+      if (p != nullptr) return false;
+    return res.size() == k * points.size();
+  };
+  treeT tree;
+  ASSERT_TRUE(allMissing(tree.knn(points, k)));
+  ASSERT_TRUE(allMissing(dualKnn(points, tree, k)));
+  tree.insert(points);
+  tree.bulk_erase(points);
+  ASSERT_EQ(tree.size(), 0u);
+  ASSERT_TRUE(allMissing(tree.knn(points, k)));
+  ASSERT_TRUE(allMissing(dualKnn(points, tree, k)));
+}
+
+TEST(LogTreeKnn, EmptyTree) {
+  checkEmptyKnn<serialSingleTreeT>();
+  checkEmptyKnn<parallelCoarseTreeT>();
+}
+
+// every merge policy keeps the points through inserts and erasures
+template <class treeT>
+void checkMergePolicy(const mergePolicy& policy) {
+  constexpr size_t n = 3000;
+  auto points = gridPoints(n);
+  auto slice = [&](size_t s, size_t e) {
+    return parlay::sequence<pointT>(points.begin() + s, points.begin() + e);
+  };
+
+  treeT tree(policy);
+  size_t inserted = 0;
+  for (size_t batch : {5, 7, 64, 100, 300, 3, 528, 999}) {
+    tree.insert(slice(inserted, inserted + batch));
+    inserted += batch;
+  }
+  tree.insert(slice(inserted, n));
+  ASSERT_EQ(tree.size(), n);
+  for (const auto& p : points)
+    ASSERT_TRUE(tree.contains(p));
+
+  // erase every third point, then put about half of them back (a whole number of buffers: the
+  // buffer is not rebuilt over a single point)
+  parlay::sequence<pointT> erased, live;
+  for (size_t i = 0; i < n; i++)
+    (i % 3 == 0 ? erased : live).push_back(points[i]);
+  tree.bulk_erase(erased);
+  ASSERT_EQ(tree.size(), live.size());
+  parlay::sequence<pointT> back(erased.begin(), erased.begin() + 512);
+  tree.insert(back);
+  live.append(back);
+  ASSERT_EQ(tree.size(), live.size());
+  for (size_t i = 0; i < erased.size(); i++)
+    ASSERT_EQ(tree.contains(erased[i]), i < back.size()) << i;
+
+  constexpr int k = 3;
+  ASSERT_TRUE(sameKnn(points, live, tree.knn(points, k), k));
+}
+
+TEST(LogTreePolicy, LeveledAndTiered) {
+  for (auto policy : {mergePolicy(LEVELED_MERGE, 2), mergePolicy(LEVELED_MERGE, 3),
+                      mergePolicy(LEVELED_MERGE, 8), mergePolicy(TIERED_MERGE, 2, 1),
+                      mergePolicy(TIERED_MERGE, 4, 2), mergePolicy(TIERED_MERGE, 5, 1)}) {
+    checkMergePolicy<serialSingleTreeT>(policy);
+    checkMergePolicy<parallelCoarseTreeT>(policy);
+  }
+}
+
+// leveled and tiered with fan-out 2 and one run per level are both the binary counter
+TEST(LogTreePolicy, BinaryCounter) {
+  serialSingleTreeT leveled(mergePolicy(LEVELED_MERGE, 2));
+  serialSingleTreeT tiered(mergePolicy(TIERED_MERGE, 2, 1));
+  for (int b = 1; b < 30; b++) {
+    parlay::sequence<pointT> batch;
+    for (int i = 0; i < 4 * b; i++)
+      batch.push_back(pointT({(double)b, (double)i}));
+    leveled.insert(batch);
+    tiered.insert(batch);
+    ASSERT_EQ(leveled.getTreeMask(), tiered.getTreeMask()) << b;
+  }
+}
+
+TEST(LogTreePolicy, Invalid) {
+  EXPECT_THROW(mergePolicy(LEVELED_MERGE, 1), std::runtime_error);
+  EXPECT_THROW(mergePolicy(TIERED_MERGE, 4, 4), std::runtime_error);
+  EXPECT_THROW(mergePolicy(TIERED_MERGE, 4, 0), std::runtime_error);
+}
+
+// the static trees outgrow the NUM_TREES reserved up front, and the empty top levels are
+// dropped again once most of the points are erased
+TEST(LogTreeGrowth, GrowAndTrim) {
+  typedef LogTree<2, BUFFER_LOG2_SIZE, dim, pointT, false, false> smallTreeT;
+  constexpr size_t n = 4096;
+  auto points = gridPoints(n);
+
+  for (auto policy : {mergePolicy(LEVELED_MERGE, 2), mergePolicy(TIERED_MERGE, 4, 2)}) {
+    smallTreeT tree(policy);
+    for (size_t i = 0; i < n; i += 512)
+      tree.insert(parlay::sequence<pointT>(points.begin() + i, points.begin() + i + 512));
+    ASSERT_EQ(tree.size(), n);
+    auto grown = tree.numTrees();
+    ASSERT_GT(grown, 2u);
+    ASSERT_EQ(grown % policy.runsPerLevel(), 0u);
+    for (const auto& p : points)
+      ASSERT_TRUE(tree.contains(p));
+
+    tree.bulk_erase(parlay::sequence<pointT>(points.begin() + 128, points.end()));
+    ASSERT_EQ(tree.size(), 128u);
+    ASSERT_LT(tree.numTrees(), grown);
+    for (size_t i = 0; i < n; i++)
+      ASSERT_EQ(tree.contains(points[i]), i < 128) << i;
+
+    tree.bulk_erase(parlay::sequence<pointT>(points.begin(), points.begin() + 128));
+    ASSERT_EQ(tree.size(), 0u);
+    ASSERT_EQ(tree.numTrees(), 0u);
+  }
+}
+
+TEST(LogTreeGrowth, RuntimeBufferSize) {
+  serialSingleTreeT tree(mergePolicy(), 6);
+  ASSERT_EQ(tree.getBufferLog2Size(), 6);
+  auto points = gridPoints(128);
+
+  tree.insert(parlay::sequence<pointT>(points.begin(), points.begin() + 63));
+  ASSERT_EQ(tree.getTreeMask(), 0);  // the 63 points fit in the buffer
+  tree.insert(parlay::sequence<pointT>(points.begin() + 63, points.end()));
+  ASSERT_EQ(tree.getTreeMask(), 0b1);
+  ASSERT_EQ(tree.size(), 128u);
+  for (const auto& p : points)
+    ASSERT_TRUE(tree.contains(p));
+
+  EXPECT_THROW(serialSingleTreeT(mergePolicy(), -1), std::runtime_error);
+  EXPECT_THROW(serialSingleTreeT(mergePolicy(), 31), std::runtime_error);
+}
+
+// moving points: each tick, [update] erases the old position of some points and inserts the new
+template <class treeT>
+void checkMovingPoints() {
+  constexpr size_t n = 2048, m = 256, ticks = 12;
+  auto position = [&](size_t i, size_t tick) { return gridPoint(i + tick * n, n); };
+  parlay::sequence<pointT> cur;
+  for (size_t i = 0; i < n; i++)
+    cur.push_back(position(i, 0));
+  treeT tree;
+  tree.insert(cur);
+
+  for (size_t t = 1; t <= ticks; t++) {
+    parlay::sequence<pointT> deletes, inserts;
+    for (size_t i = (t * m) % n; i < (t * m) % n + m; i++) {
+      deletes.push_back(cur[i]);
+      cur[i] = position(i, t);
+      inserts.push_back(cur[i]);
+    }
+    tree.update(inserts, deletes);
+    ASSERT_EQ(tree.size(), n) << t;
+    for (const auto& p : cur)
+      ASSERT_TRUE(tree.contains(p)) << t;
+    for (const auto& p : deletes)
+      ASSERT_FALSE(tree.contains(p)) << t;
+  }
+
+  constexpr int k = 4;
+  ASSERT_TRUE(sameKnn(cur, cur, tree.knn(cur, k), k));
+}
+
+TEST(LogTreeUpdate, MovingPoints) {
+  checkMovingPoints<serialSingleTreeT>();
+  checkMovingPoints<parallelCoarseTreeT>();
+}
+
+// objects with ids are erased straight from their leaves through the locator
+template <class treeT>
+void checkEraseIds() {
+  typedef object<dim> objT;
+  constexpr size_t n = 3004;  // leaves points in the buffer
+  parlay::sequence<objT> objects;
+  for (size_t i = 0; i < n; i++)
+    objects.push_back(objT(gridPoint(i, n), i));
+  auto pick = [&](size_t r) {
+    return parlay::filter(objects, [&](const objT& o) { return o.id % 3 == r; });
+  };
+  treeT tree;
+  auto check = [&](auto live) {
+    size_t num_live = 0;
+    for (const auto& o : objects) {
+      ASSERT_EQ(tree.contains(o), live(o.id)) << o.id;
+      num_live += live(o.id);
+    }
+    ASSERT_EQ(tree.size(), num_live);
+  };
+
+  // the objects of the first batch are already in a static tree when the locator is added
+  for (size_t i = 0; i < n; i += 1000) {
+    auto end = std::min(n, i + 1000);
+    tree.insert(parlay::sequence<objT>(objects.begin() + i, objects.begin() + end));
+    if (i == 0) tree.locateIds(n);
+  }
+
+  // by id
+  auto erased = pick(0);
+  auto ids = parlay::tabulate(erased.size(), [&](size_t i) { return erased[i].id; });
+  tree.eraseIds(ids);
+  check([](size_t id) { return id % 3 != 0; });
+  tree.eraseIds(ids);  // already erased
+  check([](size_t id) { return id % 3 != 0; });
+
+  // by object: the located ones skip the search, and the id must be at the same position
+  tree.bulk_erase(parlay::sequence<objT>{objT(pointT({-1.0, -1.0}), 1)});
+  check([](size_t id) { return id % 3 != 0; });
+  tree.bulk_erase(pick(1));
+  check([](size_t id) { return id % 3 == 2; });
+}
+
+TEST(LogTreeLocator, EraseIds) {
+  checkEraseIds<serialObjectTreeT>();
+  checkEraseIds<parallelCoarseObjectTreeT>();
+
+  // again with the located objects of each tree erased in one bulk pass
+  auto saved = tuning().erase_base_case;
+  tuning().erase_base_case = 8;
+  checkEraseIds<serialObjectTreeT>();
+  checkEraseIds<parallelCoarseObjectTreeT>();
+  tuning().erase_base_case = saved;
+}
+
+// the copies of a tree share its locator: erasing by id from one leaves the other intact
+TEST(LogTreeLocator, Snapshot) {
+  typedef object<dim> objT;
+  parlay::sequence<objT> objects;
+  for (size_t i = 0; i < 512; i++)
+    objects.push_back(objT(gridPoint(i, 512), i));
+  VersionedLogTree<serialObjectTreeT> tree(objects);
+  tree.locateIds(512);
+  auto before = tree.snapshot();
+
+  parlay::sequence<size_t> ids;
+  for (size_t i = 0; i < 512; i += 2)
+    ids.push_back(i);
+  tree.eraseIds(ids);
+  auto after = tree.snapshot();
+  ASSERT_EQ(before->size(), 512u);
+  ASSERT_EQ(after->size(), 256u);
+  for (const auto& o : objects) {
+    ASSERT_TRUE(before->contains(o));
+    ASSERT_EQ(after->contains(o), o.id % 2 == 1);
+  }
+}
+
+// two copies of a tree that both rebuild levels keep finding their own objects by id
+template <class treeT>
+void checkLocatorCopies() {
+  typedef object<dim> objT;
+  constexpr size_t n = 3000;
+  auto objects = parlay::tabulate(n, [&](size_t i) { return objT(gridPoint(i, n), i); });
+  treeT tree;
+  tree.locateIds(n);
+  for (size_t i = 0; i < n; i += 300)
+    tree.insert(parlay::sequence<objT>(objects.begin() + i, objects.begin() + i + 300));
+  auto ids = [&](size_t r, size_t m) {
+    parlay::sequence<size_t> ret;
+    for (size_t i = r; i < n; i += m)
+      ret.push_back(i);
+    return ret;
+  };
+  auto check = [&](const treeT& t, auto live) {
+    for (const auto& o : objects)
+      ASSERT_EQ(t.contains(o), live(o.id)) << o.id;
+    auto num_live = parlay::count_if(objects, [&](const objT& o) { return live(o.id); });
+    ASSERT_EQ(t.size(), (size_t)num_live);
+  };
+
+  treeT copy(tree);
+  copy.eraseIds(ids(0, 2));  // depletes every static tree of the copy, which rebuilds them
+  tree.eraseIds(ids(0, 3));
+  check(copy, [](size_t id) { return id % 2 != 0; });
+  check(tree, [](size_t id) { return id % 3 != 0; });
+  copy.eraseIds(ids(1, 4));
+  tree.eraseIds(ids(1, 3));
+  check(copy, [](size_t id) { return id % 4 == 3; });
+  check(tree, [](size_t id) { return id % 3 == 2; });
+}
+
+TEST(LogTreeLocator, Copies) {
+  checkLocatorCopies<serialObjectTreeT>();
+  checkLocatorCopies<parallelCoarseObjectTreeT>();
+}
+
+// without a locator the ids may be sparse; with one, they must stay below its bound
+TEST(LogTreeLocator, IdBound) {
+  typedef object<dim> objT;
+  constexpr size_t n = 512;
+  constexpr size_t sparse = (size_t)1 << 40;
+  auto objects = parlay::tabulate(n, [&](size_t i) { return objT(gridPoint(i, n), sparse * i); });
+  serialObjectTreeT tree(objects);
+  tree.bulk_erase(parlay::sequence<objT>(objects.begin(), objects.begin() + n / 2));
+  ASSERT_EQ(tree.size(), n / 2);
+  for (size_t i = 0; i < n; i++)
+    ASSERT_EQ(tree.contains(objects[i]), i >= n / 2) << i;
+  EXPECT_THROW(tree.eraseIds(parlay::sequence<size_t>{sparse * (n - 1)}), std::runtime_error);
+  EXPECT_THROW(tree.locateIds(n), std::runtime_error);  // the live ids are above the bound
+  ASSERT_EQ(tree.size(), n / 2);
+
+  serialObjectTreeT dense;
+  dense.locateIds(n);
+  EXPECT_THROW(dense.insert(parlay::sequence<objT>{objT(gridPoint(0, n), n)}), std::runtime_error);
+  ASSERT_EQ(dense.size(), 0u);
+  dense.insert(parlay::tabulate(n, [&](size_t i) { return objT(gridPoint(i, n), i); }));
+  dense.eraseIds(parlay::tabulate(n / 2, [&](size_t i) { return i; }));
+  ASSERT_EQ(dense.size(), n / 2);
+
+  // an update with an id out of bound fails before erasing anything
+  auto moved = parlay::tabulate(n / 2, [&](size_t i) { return objT(gridPoint(i, n), i); });
+  auto kept = parlay::tabulate(n / 2, [&](size_t i) {
+    return objT(gridPoint(i + n / 2, n), i + n / 2);
+  });
+  moved[0].id = n;
+  EXPECT_THROW(dense.update(moved, kept), std::runtime_error);
+  ASSERT_EQ(dense.size(), n / 2);
+  for (const auto& o : kept)
+    ASSERT_TRUE(dense.contains(o));
+
+  // a staged insert is checked on the caller's thread, not by the merge
+  VersionedLogTree<serialObjectTreeT> async(INSERT_ASYNC);
+  async.locateIds(n);
+  EXPECT_THROW(async.insert(moved), std::runtime_error);
+  async.insert(kept);
+  async.drain();
+  ASSERT_EQ(async.size(), n / 2);
+}
@@ -0,0 +1,141 @@
+#ifndef TEST_OBJECTTEST_H
+#define TEST_OBJECTTEST_H
+
+#include "BasicStructure.h"
+#include <gtest/gtest.h>
+#include "common/geometryIO.h"
+
+#include <algorithm>
+#include <batchKdtree/shared/box.h>
+#include <batchKdtree/shared/dual.h>
+#include <batchKdtree/shared/object.h>
+
+using namespace batchKdTree;
+
+// Tree must be instantiated with objT = object<2>
+template <typename Tree>
+class ObjectTest : public ::testing::Test {
+ public:
+  static const int DIM = 2;
+  typedef object<DIM> objT;
+  typedef objT::idT idT;
+
+  // the 1k test points, with id i for the i-th point
+  static parlay::sequence<objT> OBJECTS_1000() {
+    const char* test_file = "../resources/2d-UniformInSphere-1k.pbbs";
+    int check_dim = readDimensionFromFile(test_file);
+    if (check_dim != DIM) throw std::runtime_error("Invalid input file!");
+
+    auto points = readPointsFromFile<point<DIM>>(test_file);
+    parlay::sequence<objT> objects(points.size());
+    for (size_t i = 0; i < points.size(); i++)
+      objects[i] = objT(points[i], i);
+    return objects;
+  }
+
+  // brute force knn ids (sorted) for every object
+  static parlay::sequence<idT> BRUTEFORCE_IDS(const parlay::sequence<objT>& objects, int k) {
+    parlay::sequence<point<DIM>> points(objects.size());
+    for (size_t i = 0; i < objects.size(); i++)
+      points[i] = objects[i];
+    auto check = knnBuf::bruteforceKnn(points, k);
+    parlay::sequence<idT> ret(check.size());
+    for (size_t i = 0; i < check.size(); i++)
+      ret[i] = objects[check[i] - points.begin()].id;
+    for (size_t i = 0; i < objects.size(); i++)
+      std::sort(ret.begin() + i * k, ret.begin() + (i + 1) * k);
+    return ret;
+  }
+};
+
+TYPED_TEST_SUITE_P(ObjectTest);
+
+TYPED_TEST_P(ObjectTest, KnnIds) {
+  typedef typename TestFixture::idT idT;
+  constexpr int k = 4;
+  auto objects = this->OBJECTS_1000();
+  TypeParam tree(objects);
+  ASSERT_EQ(tree.size(), objects.size());
+  auto check = this->BRUTEFORCE_IDS(objects, k);
+
+  parlay::sequence<idT> res(k * objects.size());
+  tree.knn(objects, k, res.head(res.size()));
+  for (size_t i = 0; i < objects.size(); i++) {
+    std::sort(res.begin() + i * k, res.begin() + (i + 1) * k);
+    for (int j = 0; j < k; j++)
+      ASSERT_EQ(res[i * k + j], check[i * k + j]) << "query " << i << ", neighbor " << j;
+  }
+}
+
+TYPED_TEST_P(ObjectTest, KnnNeighbors) {
+  typedef typename TestFixture::idT idT;
+  constexpr int k = 4;
+  auto objects = this->OBJECTS_1000();
+  TypeParam tree(objects);
+  auto check = this->BRUTEFORCE_IDS(objects, k);
+
+  parlay::sequence<neighbor<idT>> res(k * objects.size());
+  tree.knn(objects, k, res.head(res.size()));
+  for (size_t i = 0; i < objects.size(); i++) {
+    auto start = res.begin() + i * k;
+    std::sort(start, start + k, [](const auto& l, const auto& r) { return l.id < r.id; });
+    for (int j = 0; j < k; j++) {
+      ASSERT_EQ(start[j].id, check[i * k + j]);
+      EXPECT_DOUBLE_EQ(start[j].dist, objects[i].dist(objects[start[j].id]));
+    }
+  }
+}
+
+TYPED_TEST_P(ObjectTest, DualKnnIds) {
+  typedef typename TestFixture::idT idT;
+  constexpr int k = 4;
+  auto objects = this->OBJECTS_1000();
+  TypeParam tree(objects);
+
+  // dualKnn reorders the queries, so keep the ids with them
+  auto queries = objects;
+  parlay::sequence<idT> res(k * queries.size());
+  dualKnn(queries, tree, k, res.head(res.size()));
+  ASSERT_EQ(queries.size(), objects.size());
+
+  auto check = this->BRUTEFORCE_IDS(objects, k);
+  for (size_t i = 0; i < queries.size(); i++) {
+    auto q = queries[i].id;
+    std::sort(res.begin() + i * k, res.begin() + (i + 1) * k);
+    for (int j = 0; j < k; j++)
+      ASSERT_EQ(res[i * k + j], check[q * k + j]);
+  }
+}
+
+TYPED_TEST_P(ObjectTest, IdsSurviveErase) {
+  typedef typename TestFixture::idT idT;
+  constexpr int k = 2;
+  auto objects = this->OBJECTS_1000();
+  TypeParam tree(objects);
+
+  parlay::sequence<idT> res(k * objects.size());
+  tree.knn(objects, k, res.head(res.size()));
+
+  // erasing objects moves the remaining items around, but the ids still name the same objects
+  auto to_erase = KEEP_ODD(objects);
+  tree.template erase<false>(to_erase.cut(0, to_erase.size()));
+  ASSERT_EQ(tree.size(), objects.size() - to_erase.size());
+  for (size_t i = 0; i < res.size(); i++) {
+    ASSERT_LT(res[i], objects.size());
+    ASSERT_EQ(tree.contains(objects[res[i]]), res[i] % 2 == 0);
+  }
+
+  // range queries return whole objects
+  point<TestFixture::DIM> qMin, qMax;
+  boundingBoxSerial(qMin, qMax, objects.cut(0, objects.size()));
+  auto in_box = tree.orthogonalQuery(qMin, qMax);
+  ASSERT_EQ(in_box.size(), tree.size());
+  for (const auto& o : in_box) {
+    ASSERT_EQ(o.id % 2, 0);
+    ASSERT_EQ(o, objects[o.id]);
+  }
+}
+
+REGISTER_TYPED_TEST_SUITE_P(ObjectTest, KnnIds, KnnNeighbors, DualKnnIds, IdsSurviveErase);
+
+#endif  // TEST_OBJECTTEST_H
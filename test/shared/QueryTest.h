@@ -6,8 +6,10 @@
 #include "common/geometryIO.h"
 
 #include <algorithm>
+#include <set>
 #include <batchKdtree/shared/box.h>
 #include <batchKdtree/shared/dual.h>
+#include <batchKdtree/shared/tuning.h>
 
 using namespace batchKdTree;
 
@@ -138,6 +140,241 @@ TYPED_TEST_P(QueryTest, DualKnn) {
   }
 }
 
-REGISTER_TYPED_TEST_SUITE_P(QueryTest, BasicRangeQuery, BasicKnn, DualKnn);
+TYPED_TEST_P(QueryTest, BallQuery) {
+  auto tree = this->CONSTRUCT_RESOURCES_1000();
+  auto points = this->RESOURCES_1000();
+
+  auto compare = [&](const pointT& l, const pointT& r) {
+    return l.coordinate(0) < r.coordinate(0) ||
+           (l.coordinate(0) == r.coordinate(0) && l.coordinate(1) < r.coordinate(1));
+  };
+  auto bruteforce = [&](const pointT& q, double r) {
+    parlay::sequence<pointT> ret;
+    for (const auto& p : points)
+      if (q.dist(p) <= r) ret.push_back(p);
+    parlay::sort_inplace(ret, compare);
+    return ret;
+  };
+
+  // a few radii, from (nearly) empty to the whole set
+  parlay::sequence<pointT> queries;
+  parlay::sequence<double> radii;
+  for (size_t i = 0; i < points.size(); i += 50) {
+    for (double r : {0.0, 0.02, 0.1, 0.5, 10.0}) {
+      queries.push_back(points[i]);
+      radii.push_back(r);
+    }
+  }
+
+  for (size_t i = 0; i < queries.size(); i++) {
+    auto res = tree.ballQuery(queries[i], radii[i]);
+    auto check = bruteforce(queries[i], radii[i]);
+    ASSERT_EQ(res.size(), check.size());
+    parlay::sort_inplace(res, compare);
+    for (size_t j = 0; j < res.size(); j++)
+      ASSERT_EQ(res[j], check[j]);
+  }
+
+  auto [offsets, flat] = tree.ballQuery(queries, radii);
+  ASSERT_EQ(offsets.size(), queries.size() + 1);
+  ASSERT_EQ(offsets.back(), flat.size());
+  for (size_t i = 0; i < queries.size(); i++) {
+    auto check = bruteforce(queries[i], radii[i]);
+    parlay::sequence<pointT> res(flat.begin() + offsets[i], flat.begin() + offsets[i + 1]);
+    ASSERT_EQ(res.size(), check.size());
+    parlay::sort_inplace(res, compare);
+    for (size_t j = 0; j < res.size(); j++)
+      ASSERT_EQ(res[j], check[j]);
+  }
+}
+
+TYPED_TEST_P(QueryTest, BatchedRangeQuery) {
+  auto tree = this->CONSTRUCT_RESOURCES_1000();
+  auto points = this->RESOURCES_1000();
+
+  auto compare = [&](const pointT& l, const pointT& r) {
+    return l.coordinate(0) < r.coordinate(0) ||
+           (l.coordinate(0) == r.coordinate(0) && l.coordinate(1) < r.coordinate(1));
+  };
+
+  // boxes around every 20th point, of a few sizes, plus one that covers everything
+  parlay::sequence<pointT> qMins, qMaxs;
+  for (size_t i = 0; i < points.size(); i += 20) {
+    for (double w : {0.0, 0.05, 0.3}) {
+      qMins.push_back(pointT({points[i][0] - w, points[i][1] - 2 * w}));
+      qMaxs.push_back(pointT({points[i][0] + 2 * w, points[i][1] + w}));
+    }
+  }
+  qMins.push_back(pointT({-1e9, -1e9}));
+  qMaxs.push_back(pointT({1e9, 1e9}));
+
+  auto check_all = [&]() {
+    auto [offsets, flat] = tree.orthogonalQuery(qMins, qMaxs);
+    ASSERT_EQ(offsets.size(), qMins.size() + 1);
+    ASSERT_EQ(offsets.back(), flat.size());
+    ASSERT_EQ(offsets.back() - offsets[offsets.size() - 2], points.size());
+    for (size_t i = 0; i < qMins.size(); i++) {
+      parlay::sequence<pointT> check;
+      for (const auto& p : points)
+        if (itemInBox(qMins[i], qMaxs[i], &p)) check.push_back(p);
+      parlay::sequence<pointT> res(flat.begin() + offsets[i], flat.begin() + offsets[i + 1]);
+      auto single = tree.orthogonalQuery(qMins[i], qMaxs[i]);
+      ASSERT_EQ(res.size(), check.size());
+      ASSERT_EQ(single.size(), check.size());
+      parlay::sort_inplace(res, compare);
+      parlay::sort_inplace(single, compare);
+      parlay::sort_inplace(check, compare);
+      for (size_t j = 0; j < res.size(); j++) {
+        ASSERT_EQ(res[j], check[j]);
+        ASSERT_EQ(single[j], check[j]);
+      }
+    }
+  };
+  check_all();
+
+  // again with every internal node filled in parallel (for parallel trees)
+  auto saved = tuning().rangequery_base_case;
+  tuning().rangequery_base_case = 1;
+  check_all();
+  tuning().rangequery_base_case = saved;
+}
+
+TYPED_TEST_P(QueryTest, RangeCount) {
+  auto tree = this->CONSTRUCT_RESOURCES_1000();
+  auto points = this->RESOURCES_1000();
+
+  parlay::sequence<pointT> qMins, qMaxs;
+  for (size_t i = 0; i < points.size(); i += 25) {
+    for (double w : {0.01, 0.1, 0.5}) {
+      qMins.push_back(pointT({points[i][0] - w, points[i][1] - w}));
+      qMaxs.push_back(pointT({points[i][0] + w, points[i][1] + w}));
+    }
+  }
+  qMins.push_back(pointT({-1e9, -1e9}));
+  qMaxs.push_back(pointT({1e9, 1e9}));
+
+  parlay::sequence<bool> live(points.size(), true);
+  auto check = [&]() {
+    auto counts = tree.rangeCount(qMins, qMaxs);
+    ASSERT_EQ(counts.size(), qMins.size());
+    for (size_t i = 0; i < qMins.size(); i++) {
+      size_t expected = 0;
+      for (size_t j = 0; j < points.size(); j++)
+        expected += live[j] && itemInBox(qMins[i], qMaxs[i], &points[j]);
+      ASSERT_EQ(counts[i], expected) << "box " << i;
+      ASSERT_EQ(tree.rangeCount(qMins[i], qMaxs[i]), expected);
+      ASSERT_EQ(tree.orthogonalQuery(qMins[i], qMaxs[i]).size(), expected);
+    }
+  };
+  check();
+
+  // the counts follow both single-point and bulk erasures
+  parlay::sequence<pointT> erase_single, erase_bulk;
+  for (size_t j = 0; j < points.size(); j++) {
+    if (j % 3 == 0) erase_single.push_back(points[j]);
+    if (j % 3 == 1) erase_bulk.push_back(points[j]);
+    live[j] = (j % 3 == 2);
+  }
+  tree.template erase<false>(erase_single.cut(0, erase_single.size()));
+  tree.bulk_erase(erase_bulk);
+  ASSERT_EQ(tree.size(), points.size() - erase_single.size() - erase_bulk.size());
+  check();
+}
+
+TYPED_TEST_P(QueryTest, ApproxKnn) {
+  constexpr int k = 4;
+  constexpr double eps = 0.5;
+  auto tree = this->CONSTRUCT_RESOURCES_1000();
+  auto points = this->RESOURCES_1000();
+
+  // the i-th nearest distance of each result is within (1 + eps) of the exact one
+  auto verify = [&](const parlay::sequence<pointT>& queries,
+                    const parlay::sequence<const pointT*>& res,
+                    double slack) {
+    auto check = knnBuf::bruteforceKnn(queries, k);
+    ASSERT_EQ(res.size(), check.size());
+    for (size_t i = 0; i < queries.size(); i++) {
+      std::vector<double> res_dist, check_dist;
+      for (int j = 0; j < k; j++) {
+        ASSERT_NE(res[i * k + j], nullptr);
+        res_dist.push_back(queries[i].dist(*res[i * k + j]));
+        check_dist.push_back(queries[i].dist(*check[i * k + j]));
+      }
+      std::sort(res_dist.begin(), res_dist.end());
+      std::sort(check_dist.begin(), check_dist.end());
+      for (int j = 0; j < k; j++)
+        EXPECT_LE(res_dist[j], slack * check_dist[j] + 1e-9) << i << ". (" << j << ")";
+    }
+  };
+
+  verify(points, tree.template knn<false, false>(points, k, knnBuf::knnApprox(eps)), 1 + eps);
+  verify(points, tree.template knn<true, false>(points, k, knnBuf::knnApprox(eps)), 1 + eps);
+
+  auto queries = points;
+  auto dual_res = dualKnn(queries, tree, k, knnBuf::knnApprox(eps));
+  verify(queries, dual_res, 1 + eps);
+
+  // with a leaf cap the answers are k distinct points, not necessarily close ones
+  auto capped = tree.template knn<false, false>(points, k, knnBuf::knnApprox(0, 1));
+  ASSERT_EQ(capped.size(), k * points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    std::set<const pointT*> distinct(capped.begin() + i * k, capped.begin() + (i + 1) * k);
+    EXPECT_EQ(distinct.size(), k);
+    EXPECT_EQ(distinct.count(nullptr), 0);
+  }
+}
+
+TYPED_TEST_P(QueryTest, KnnWorkspace) {
+  auto tree = this->CONSTRUCT_RESOURCES_1000();
+  auto points = this->RESOURCES_1000();
+  typename decltype(tree)::knnWorkspace ws;
+
+  // a workspace reused across calls gives the same results as fresh allocations
+  size_t max_bytes = 0;
+  for (int k : {8, 4, 1}) {
+    auto expected = tree.template knn<false, false>(points, k);
+    parlay::sequence<const pointT*> res(k * points.size());
+    tree.template knn<false, false>(points, k, res.head(res.size()), ws);
+    for (size_t i = 0; i < res.size(); i++)
+      ASSERT_EQ(res[i], expected[i]) << "k = " << k << ", i = " << i;
+
+    // and it only grows for the largest batch
+    if (max_bytes == 0) max_bytes = ws.memory_footprint();
+    ASSERT_EQ(ws.memory_footprint(), max_bytes);
+  }
+}
+
+TYPED_TEST_P(QueryTest, FixedKKnn) {
+  constexpr int k = 4;
+  auto tree = this->CONSTRUCT_RESOURCES_1000();
+  auto points = this->RESOURCES_1000();
+  auto check = knnBuf::bruteforceKnn(points, k);
+
+  // both buffers give the brute force neighbors, nearest first
+  auto fixed = tree.template knnFixedK<k, false, false>(points);
+  auto dynamic = tree.template knn<false, false>(points, k);
+  ASSERT_EQ(fixed.size(), k * points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    std::vector<double> check_dist;
+    for (int j = 0; j < k; j++)
+      check_dist.push_back(points[i].dist(*check[i * k + j]));
+    std::sort(check_dist.begin(), check_dist.end());
+    for (int j = 0; j < k; j++) {
+      EXPECT_EQ(points[i].dist(*fixed[i * k + j]), check_dist[j]) << i << ". (" << j << ")";
+      EXPECT_EQ(points[i].dist(*dynamic[i * k + j]), check_dist[j]) << i << ". (" << j << ")";
+    }
+  }
+}
+
+REGISTER_TYPED_TEST_SUITE_P(QueryTest,
+                            BasicRangeQuery,
+                            BasicKnn,
+                            DualKnn,
+                            BallQuery,
+                            BatchedRangeQuery,
+                            RangeCount,
+                            ApproxKnn,
+                            KnnWorkspace,
+                            FixedKKnn);
 
 #endif  // TEST_QUERYTEST_H
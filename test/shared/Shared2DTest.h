@@ -6,7 +6,10 @@
 #include "common/geometryIO.h"
 
 #include <algorithm>
+#include <limits>
+#include <vector>
 #include <batchKdtree/shared/box.h>
+#include <batchKdtree/shared/tuning.h>
 
 typedef point<2> pointT;
 template <typename Tree>
@@ -123,7 +126,47 @@ TYPED_TEST_P(Shared2DTest, BulkInsert) {
   }
 }
 
+// the same splits at every internal node and the same points in every leaf
+template <class nodeT>
+void expectSameStructure(const nodeT* a, const nodeT* b) {
+  ASSERT_EQ(a->isLeaf(), b->isLeaf());
+  ASSERT_EQ(a->countPoints(), b->countPoints());
+  if (a->isLeaf()) {
+    auto less = [](const auto& l, const auto& r) {
+      return std::lexicographical_compare(l.x, l.x + 2, r.x, r.x + 2);
+    };
+    std::vector<point<2>> pa(a->getStartValue(), a->getEndValue());
+    std::vector<point<2>> pb(b->getStartValue(), b->getEndValue());
+    std::sort(pa.begin(), pa.end(), less);
+    std::sort(pb.begin(), pb.end(), less);
+    ASSERT_EQ(pa, pb);
+    return;
+  }
+  ASSERT_EQ(a->getSplitDimension(), b->getSplitDimension());
+  ASSERT_EQ(a->getSplitValue(), b->getSplitValue());
+  expectSameStructure(a->getLeft(), b->getLeft());
+  expectSameStructure(a->getRight(), b->getRight());
+}
+
+TYPED_TEST_P(Shared2DTest, MultiLevelBuild) {
+  auto points = this->RESOURCES_1000();
+  auto saved = tuning();
+
+  // build in parallel down to small subtrees, without and with the multi-level partition
+  tuning().bhl_build_base_case = 1;
+  tuning().co_top_build_base_case = 1;
+  tuning().co_bottom_build_base_case = 1;
+  tuning().multilevel_partition_base_case = std::numeric_limits<size_t>::max();
+  TypeParam level_by_level(points);
+  tuning().multilevel_partition_base_case = 64;
+  TypeParam multi_level(points);
+  tuning() = saved;
+
+  ASSERT_TRUE(multi_level.verify());
+  expectSameStructure(level_by_level.root(), multi_level.root());
+}
+
 REGISTER_TYPED_TEST_SUITE_P(
-    Shared2DTest, Verify, SimpleDelete, SerialDelete, BulkDelete, BulkInsert);
+    Shared2DTest, Verify, SimpleDelete, SerialDelete, BulkDelete, BulkInsert, MultiLevelBuild);
 
 #endif  // TEST_SHARED2DTEST_H
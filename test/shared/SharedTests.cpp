@@ -1,8 +1,14 @@
+#include <functional>
 #include <set>
 #include <gtest/gtest.h>
 #include "common/geometryIO.h"
+#include "batchKdtree/shared/bitmask.h"
 #include "batchKdtree/shared/box.h"
 #include "batchKdtree/shared/bloom.h"
+#include "batchKdtree/shared/kdnode.h"
+#include "batchKdtree/shared/leafscan.h"
+#include "batchKdtree/shared/tuning.h"
+#include "batchKdtree/shared/utils.h"
 #include "BasicStructure.h"
 
 using namespace batchKdTree;
@@ -13,6 +19,9 @@ TEST_F(SharedTests, BoundingBoxDistance) {
   auto ret1 =
       BoundingBoxDistance(point<2>({0, 0}), point<2>({1, 1}), point<2>({4, 5}), point<2>({6, 6}));
   ASSERT_EQ(ret1, 5);
+  auto ret2 = BoundingBoxDistanceSqr(
+      point<2>({0, 0}), point<2>({1, 1}), point<2>({4, 5}), point<2>({6, 6}));
+  ASSERT_EQ(ret2, 25);
 }
 
 TEST_F(SharedTests, BloomFilter) {
@@ -41,4 +50,236 @@ TEST_F(SharedTests, BloomFilter) {
     ASSERT_EQ(filtered_points.count(round(ipt.coordinate(0))), 1)
         << "missing point " << ipt.coordinate(0) << " rounded -> " << round(ipt.coordinate(0));
   }
+
+  // about 8 bits per key: one byte per point, a few percent false positives
+  ASSERT_LE(bf.memory_footprint(), to_insert.size() + 64);
+  auto false_positives = filtered.size() - to_insert.size();
+  ASSERT_LT(false_positives, (points.size() - to_insert.size()) / 10);
+}
+
+TEST_F(SharedTests, ParallelMedianPartition) {
+  // distinct keys, then heavily duplicated keys
+  for (int mod : {1 << 30, 7}) {
+    constexpr size_t n = 100001;
+    parlay::sequence<point<2>> points(n);
+    for (size_t i = 0; i < n; i++) {
+      points[i] = point<2>({(double)(parlay::hash64(i) % mod), (double)i});
+    }
+    auto sorted = points;
+    std::sort(sorted.begin(), sorted.end(), [](const point<2>& l, const point<2>& r) {
+      return l.coordinate(0) < r.coordinate(0);
+    });
+
+    auto median = parallelMedianPartition<point<2>>(points.cut(0, n), 0);
+    auto k = n / 2;
+    ASSERT_EQ(median, sorted[k].coordinate(0));
+    ASSERT_EQ(points[k].coordinate(0), median);
+    for (size_t i = 0; i < k; i++)
+      ASSERT_LE(points[i].coordinate(0), median);
+    for (size_t i = k; i < n; i++)
+      ASSERT_GE(points[i].coordinate(0), median);
+
+    // no points were lost or duplicated (second coordinate is unique)
+    parlay::sequence<bool> seen(n, false);
+    for (const auto& p : points)
+      seen[(size_t)p.coordinate(1)] = true;
+    for (size_t i = 0; i < n; i++)
+      ASSERT_TRUE(seen[i]);
+  }
+}
+
+TEST_F(SharedTests, ParallelPartition) {
+  // sizes below and above one point per block, split values with every point on one side
+  for (size_t n : {0, 1, 5, 31, 1000, 100003}) {
+    for (double value : {-1.0, 0.0, 3.0, 50.0, 1e9}) {
+      parlay::sequence<point<2>> points(n);
+      for (size_t i = 0; i < n; i++)
+        points[i] = point<2>({(double)(parlay::hash64(i) % 100), (double)i});
+      auto below = std::count_if(points.begin(), points.end(),
+                                 [&](const point<2>& p) { return p.coordinate(0) < value; });
+
+      auto split = parallelPartition<point<2>>(points.cut(0, n), 0, value);
+      ASSERT_EQ(split, (size_t)below) << n << " " << value;
+      for (size_t i = 0; i < n; i++)
+        ASSERT_EQ(points[i].coordinate(0) < value, i < split) << i;
+
+      // no points were lost or duplicated (second coordinate is unique)
+      parlay::sequence<bool> seen(n, false);
+      for (const auto& p : points)
+        seen[(size_t)p.coordinate(1)] = true;
+      for (size_t i = 0; i < n; i++)
+        ASSERT_TRUE(seen[i]);
+    }
+  }
+}
+
+TEST_F(SharedTests, MultiLevelMedianPartition) {
+  constexpr size_t n = 100003;
+  constexpr int num_levels = 4;
+  parlay::sequence<point<2>> points(n);
+  for (size_t i = 0; i < n; i++) {
+    points[i] = point<2>({(double)(parlay::hash64(i) % 1000), (double)i});
+  }
+
+  parlay::sequence<double> splits;
+  ASSERT_TRUE(multiLevelMedianPartition<point<2>>(points.cut(0, n), 1, num_levels, splits));
+  ASSERT_EQ(splits.size(), (size_t(1) << num_levels) - 1);
+
+  // every node is an object-median split of its range, the same as partitioning level by level
+  std::function<void(size_t, size_t, size_t, int)> check = [&](size_t v, size_t s, size_t e,
+                                                               int level) {
+    if (level == num_levels) return;
+    int d = (1 + level) % 2;
+    auto mid = s + (e - s) / 2;
+    double right_min = points[mid].coordinate(d);
+    for (size_t i = s; i < mid; i++)
+      ASSERT_LE(points[i].coordinate(d), splits[v]);
+    for (size_t i = mid; i < e; i++) {
+      ASSERT_GE(points[i].coordinate(d), splits[v]);
+      right_min = std::min(right_min, points[i].coordinate(d));
+    }
+    ASSERT_EQ(right_min, splits[v]);
+    check(2 * v + 1, s, mid, level + 1);
+    check(2 * v + 2, mid, e, level + 1);
+  };
+  check(0, 0, n, 0);
+
+  // no points were lost or duplicated (second coordinate is unique)
+  parlay::sequence<bool> seen(n, false);
+  for (const auto& p : points)
+    seen[(size_t)p.coordinate(1)] = true;
+  for (size_t i = 0; i < n; i++)
+    ASSERT_TRUE(seen[i]);
+}
+
+TEST_F(SharedTests, NodeBoxAndChildren) {
+  typedef kdNode<2, point<2>, false> nodeT;
+
+  // the bounding box is exact
+  parlay::sequence<point<2>> points;
+  for (int i = 0; i < 16; i++) {
+    points.push_back(point<2>({0.1 * i + 1e-9, -1.0 / 3 - i}));
+  }
+  nodeT leaf(points.cut(0, points.size()));
+  ASSERT_EQ(leaf.getMin().coordinate(0), points[0].coordinate(0));
+  ASSERT_EQ(leaf.getMax().coordinate(0), points[15].coordinate(0));
+  ASSERT_EQ(leaf.getMin().coordinate(1), points[15].coordinate(1));
+  ASSERT_EQ(leaf.getMax().coordinate(1), points[0].coordinate(1));
+
+  alignas(nodeT) unsigned char storage[3 * sizeof(nodeT)];
+  auto nodes = reinterpret_cast<nodeT*>(storage);
+  for (int i = 0; i < 3; i++)
+    new (&nodes[i]) nodeT(points.cut(0, points.size()));
+  nodes[0].setLeft(&nodes[1]);
+  nodes[0].setRight(&nodes[2]);
+  ASSERT_EQ(nodes[0].getLeft(), &nodes[1]);
+  ASSERT_EQ(nodes[0].getRight(), &nodes[2]);
+  ASSERT_FALSE(nodes[0].isLeaf());
+  ASSERT_TRUE(nodes[1].isLeaf());
+}
+
+TEST_F(SharedTests, LeafScanKernels) {
+  constexpr int n = 37;  // not a multiple of the vector width
+  parlay::sequence<point<3>> points(n);
+  for (int i = 0; i < n; i++) {
+    points[i] = point<3>({0.5 * i, 1.0 / (i + 1), (double)(parlay::hash64(i) % 100)});
+  }
+  parlay::sequence<double> coords(3 * n);
+  for (int d = 0; d < 3; d++)
+    for (int i = 0; i < n; i++)
+      coords[d * n + i] = points[i].coordinate(d);
+  leafMirror<3> mirror{coords.begin(), n};
+
+  auto q = point<3>({4.25, 0.3, 50});
+  double dists[LEAF_SCAN_BLOCK];
+  leafDistSqr(mirror, 2, n - 2, q, dists);
+  for (int i = 2; i < n; i++)
+    ASSERT_EQ(dists[i - 2], q.distSqr(points[i]));
+
+  auto qMin = point<3>({2, 0, 20}), qMax = point<3>({12, 0.5, 80});
+  bool in_box[LEAF_SCAN_BLOCK];
+  leafInBox(mirror, 0, n, qMin, qMax, in_box);
+  for (int i = 0; i < n; i++)
+    ASSERT_EQ(in_box[i], itemInBox(qMin, qMax, &points[i]));
+}
+
+TEST_F(SharedTests, BitMask) {
+  constexpr size_t n = 10000;
+  bitMask mask(n);
+  parlay::sequence<bool> expected(n, false);
+  mask.assign(100, 9000, true);
+  for (size_t i = 100; i < 9000; i++)
+    expected[i] = true;
+  for (size_t i = 0; i < n; i++) {
+    if (parlay::hash64(i) % 3 == 0) {
+      mask.reset(i);
+      expected[i] = false;
+    }
+  }
+  for (size_t i = 0; i < n; i += 7) {
+    mask.set(i);
+    expected[i] = true;
+  }
+
+  parlay::sequence<size_t> src(n);
+  for (size_t i = 0; i < n; i++)
+    src[i] = i;
+  for (auto [s, e] : {std::pair<size_t, size_t>{0, n}, {3, 61}, {64, 128}, {70, 9999}, {5, 5}}) {
+    size_t count = 0;
+    bool all = true;
+    parlay::sequence<size_t> packed;
+    for (size_t i = s; i < e; i++) {
+      ASSERT_EQ(mask[i], expected[i]);
+      count += expected[i];
+      all = all && expected[i];
+      if (expected[i]) packed.push_back(i);
+    }
+    ASSERT_EQ(mask.count(s, e), count);
+    ASSERT_EQ(mask.all(s, e), all);
+
+    parlay::sequence<size_t> dest(e - s);
+    ASSERT_EQ(mask.packInto(src.begin() + s, s, e, dest.begin()), count);
+    ASSERT_EQ(mask.packIntoParallel(src.begin() + s, s, e, dest.begin()), count);
+    for (size_t i = 0; i < count; i++)
+      ASSERT_EQ(dest[i], packed[i]);
+  }
+  ASSERT_TRUE(mask.all(7, 8));
+  mask.assign(0, n, true);
+  ASSERT_TRUE(mask.all(0, n));
+  ASSERT_EQ(mask.getBits(30, 64), ~0ULL);
+}
+
+TEST_F(SharedTests, TuningProfile) {
+  tuningParams params;
+  ASSERT_EQ(params.cluster_size, (size_t)CLUSTER_SIZE);
+  ASSERT_EQ(params.bhl_build_base_case, (size_t)BHL_BUILD_BASE_CASE);
+
+  std::istringstream profile("# a comment\nCLUSTER_SIZE = 32;\n\nERASE_BASE_CASE = 4000;\n");
+  params.read(profile);
+  ASSERT_EQ(params.cluster_size, 32u);
+  ASSERT_EQ(params.erase_base_case, 4000u);
+  ASSERT_EQ(params.rangequery_base_case, (size_t)RANGEQUERY_BASE_CASE);
+
+  // what [write] prints reads back to the same values
+  params.dualknn_base_case = 123;
+  std::stringstream ss;
+  params.write(ss);
+  tuningParams copy;
+  copy.read(ss);
+  tuningParams::forEachField([&](const char *, size_t tuningParams::*field) {
+    ASSERT_EQ(copy.*field, params.*field);
+  });
+
+  // so does the printed configuration
+  std::stringstream config;
+  writeConfig(config);
+  tuningParams loaded;
+  loaded.cluster_size = 1;
+  loaded.read(config);
+  ASSERT_EQ(loaded.cluster_size, tuning().cluster_size);
+  ASSERT_EQ(loaded.multilevel_partition_base_case, tuning().multilevel_partition_base_case);
+
+  std::istringstream unknown("NOT_A_PARAMETER = 1;\n"), zero("CLUSTER_SIZE = 0;\n");
+  ASSERT_THROW(copy.read(unknown), std::runtime_error);
+  ASSERT_THROW(copy.read(zero), std::runtime_error);
 }